@@ -0,0 +1,130 @@
+/**
+ * @file aes128-backend.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Block-level kernels implemented by each AES backend
+ * @version 0.9.4
+ * @date 2022-02-06
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway.
+ *
+ */
+
+#pragma once
+
+#include "aes128.h"
+
+/**
+ * @brief One of several independent streams handed to a multi-lane kernel
+ */
+typedef struct aes128_lane_t {
+    const uint32_t *round_key;
+    const uint32_t *mac_key;
+    uint8_t *iv;
+    uint8_t *state;
+    uint8_t *chunk;
+    size_t blocks;
+} aes128_lane_t;
+
+/**
+ * @brief Multi-block kernels behind the aes128_t API. Every kernel processes whole blocks in-place.
+ * Key schedules are passed as stored in aes128_t, and `iv` / `state` are updated to allow chaining calls.
+ */
+typedef struct aes128_backend_t {
+    const char *name;
+
+    // Encrypt a single block
+    void (*encrypt_block)(const uint32_t *round_key, uint8_t *block);
+
+    // CBC-encrypt `blocks` blocks
+    void (*encrypt_cbc)(const uint32_t *round_key, uint8_t *iv, uint8_t *chunk, size_t blocks);
+
+    // CBC-decrypt `blocks` blocks
+    void (*decrypt_cbc)(const uint32_t *inv_round_key, uint8_t *iv, uint8_t *chunk, size_t blocks);
+
+    // CBC-MAC `blocks` blocks of `msg` into `state`
+    void (*cbc_mac)(const uint32_t *round_key, uint8_t *state, const uint8_t *msg, size_t blocks);
+
+    // CBC-encrypt `blocks` blocks, MAC'ing all but the last ciphertext block into `state`
+    void (*encrypt_cbc_mac)(const uint32_t *round_key, uint8_t *iv, const uint32_t *mac_key, uint8_t *state, uint8_t *chunk, size_t blocks);
+
+    // CBC-decrypt `blocks` blocks, MAC'ing all but the last ciphertext block into `state`
+    void (*decrypt_cbc_mac)(const uint32_t *inv_round_key, uint8_t *iv, const uint32_t *mac_key, uint8_t *state, uint8_t *chunk, size_t blocks);
+
+    // encrypt_cbc_mac() over up to AES_LANES lanes at once
+    void (*encrypt_cbc_mac_lanes)(aes128_lane_t *lanes, size_t count);
+} aes128_backend_t;
+
+/**
+ * @brief Multi-block GCM kernels. `counter` has its low 32 bits incremented once per block
+ * and `state` is the running GHASH value, both updated to allow chaining calls.
+ */
+typedef struct aes128_gcm_backend_t {
+    const char *name;
+
+    // GHASH `blocks` blocks of `msg` into `state` under hash subkey `h`
+    void (*ghash)(const uint8_t *h, uint8_t *state, const uint8_t *msg, size_t blocks);
+
+    // XOR the keystream into `blocks` blocks
+    void (*ctr)(const uint32_t *round_key, uint8_t *counter, uint8_t *chunk, size_t blocks);
+
+    // XOR the keystream into `blocks` blocks, then GHASH the ciphertext
+    void (*encrypt_ctr_ghash)(const uint32_t *round_key, uint8_t *counter, const uint8_t *h, uint8_t *state, uint8_t *chunk, size_t blocks);
+
+    // GHASH `blocks` blocks of ciphertext, then XOR the keystream into them
+    void (*decrypt_ctr_ghash)(const uint32_t *round_key, uint8_t *counter, const uint8_t *h, uint8_t *state, uint8_t *chunk, size_t blocks);
+} aes128_gcm_backend_t;
+
+/**
+ * @brief One bit plane of 8 bitsliced blocks. Element c holds column c, and bit 8r + b is row r of block b
+ */
+typedef uint32_t aes_slice_t __attribute__((vector_size(16)));
+
+typedef struct aes128_bitsliced_t {
+    aes_slice_t round_key[AES_ROUNDS + 1][8];
+} aes128_bitsliced_t;
+
+/**
+ * @brief Convert a key schedule into bit planes
+ *
+ * @param[out] bs bitsliced key schedule
+ * @param[in] round_key aes128_t round_key for encryption, or inv_round_key for decryption
+ */
+void aes128_bs_init(aes128_bitsliced_t *bs, const uint32_t *round_key);
+
+/**
+ * @brief Convert a separate key schedule for each of the 8 blocks into bit planes
+ *
+ * @param[out] bs bitsliced key schedule
+ * @param[in] round_keys pointers to 8 key schedules, laid out as in aes128_bs_init()
+ */
+void aes128_bs_init_lanes(aes128_bitsliced_t *bs, const uint32_t *const *round_keys);
+
+/**
+ * @brief Encrypt 8 independent blocks in-place without any secret-dependent memory access
+ *
+ * @param[in] bs bitsliced key schedule
+ * @param[inout] blocks pointers to 8 blocks
+ */
+void aes128_bs_encrypt(const aes128_bitsliced_t *bs, uint8_t *const *blocks);
+
+/**
+ * @brief Decrypt 8 independent blocks in-place without any secret-dependent memory access
+ *
+ * @param[in] bs bitsliced key schedule, from an inv_round_key
+ * @param[inout] blocks pointers to 8 blocks
+ */
+void aes128_bs_decrypt(const aes128_bitsliced_t *bs, uint8_t *const *blocks);
+
+/**
+ * @brief AES-NI backend
+ *
+ * @return NULL if the host is not x86 or lacks AES-NI
+ */
+const aes128_backend_t *aes128_ni_backend(void);
+
+/**
+ * @brief AES-NI and PCLMULQDQ GCM backend
+ *
+ * @return NULL if the host is not x86 or lacks AES-NI or PCLMULQDQ
+ */
+const aes128_gcm_backend_t *aes128_gcm_ni_backend(void);
@@ -0,0 +1,404 @@
+/**
+ * @file aes128-bs.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Bitsliced, table-free AES operating on 8 independent blocks at once
+ * @ref https://eprint.iacr.org/2009/191.pdf
+ * @ref https://www.bearssl.org/constanttime.html
+ * @ref https://en.wikipedia.org/wiki/Rijndael_MixColumns
+ * @version 0.9.4
+ * @date 2022-02-06
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway.
+ *
+ */
+
+#include "aes128-backend.h"
+
+static inline uint32_t load32(const uint8_t *src)
+{
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static inline void store32(uint8_t *dst, uint32_t src)
+{
+    dst[0] = (uint8_t)src;
+    dst[1] = (uint8_t)(src >> 8);
+    dst[2] = (uint8_t)(src >> 16);
+    dst[3] = (uint8_t)(src >> 24);
+}
+
+static inline void swap_move(aes_slice_t *a, aes_slice_t *b, uint32_t mask, uint32_t n)
+{
+    const aes_slice_t t = ((*a >> n) ^ *b) & mask;
+    *b ^= t;
+    *a ^= t << n;
+}
+
+// Transpose the 8x8 bit matrix of block index and bit index found in every byte position.
+// The transpose is an involution, so this both splits blocks into bit planes and joins them back
+static void bs_orthogonalize(aes_slice_t *q)
+{
+    for (size_t i = 0; i < 8; i += 2) {
+        swap_move(&q[i], &q[i + 1], 0x55555555, 1);
+    }
+    for (size_t i = 0; i < 8; i += 4) {
+        swap_move(&q[i], &q[i + 2], 0x33333333, 2);
+        swap_move(&q[i + 1], &q[i + 3], 0x33333333, 2);
+    }
+    for (size_t i = 0; i < 4; i++) {
+        swap_move(&q[i], &q[i + 4], 0x0f0f0f0f, 4);
+    }
+}
+
+// Split 8 blocks into bit planes: bit 8r + b of column c in plane i is bit i of byte (r, c) of block b
+static void bs_load(aes_slice_t *q, uint8_t *const *blocks)
+{
+    for (size_t b = 0; b < 8; b++) {
+        q[b] = (aes_slice_t) { load32(&blocks[b][0x0]), load32(&blocks[b][0x4]), load32(&blocks[b][0x8]), load32(&blocks[b][0xc]) };
+    }
+    bs_orthogonalize(q);
+}
+
+// Inverse of bs_load()
+static void bs_store(uint8_t *const *blocks, aes_slice_t *q)
+{
+    bs_orthogonalize(q);
+    for (size_t b = 0; b < 8; b++) {
+        for (size_t c = 0; c < 4; c++) {
+            store32(&blocks[b][4 * c], q[b][c]);
+        }
+    }
+}
+
+// Boyar-Peralta S-box circuit, x0 being the most-significant bit
+static void bs_substitute_bytes(aes_slice_t *q)
+{
+    const aes_slice_t x0 = q[7];
+    const aes_slice_t x1 = q[6];
+    const aes_slice_t x2 = q[5];
+    const aes_slice_t x3 = q[4];
+    const aes_slice_t x4 = q[3];
+    const aes_slice_t x5 = q[2];
+    const aes_slice_t x6 = q[1];
+    const aes_slice_t x7 = q[0];
+
+    // Top linear transformation
+    const aes_slice_t y14 = x3 ^ x5;
+    const aes_slice_t y13 = x0 ^ x6;
+    const aes_slice_t y9 = x0 ^ x3;
+    const aes_slice_t y8 = x0 ^ x5;
+    const aes_slice_t t0 = x1 ^ x2;
+    const aes_slice_t y1 = t0 ^ x7;
+    const aes_slice_t y4 = y1 ^ x3;
+    const aes_slice_t y12 = y13 ^ y14;
+    const aes_slice_t y2 = y1 ^ x0;
+    const aes_slice_t y5 = y1 ^ x6;
+    const aes_slice_t y3 = y5 ^ y8;
+    const aes_slice_t t1 = x4 ^ y12;
+    const aes_slice_t y15 = t1 ^ x5;
+    const aes_slice_t y20 = t1 ^ x1;
+    const aes_slice_t y6 = y15 ^ x7;
+    const aes_slice_t y10 = y15 ^ t0;
+    const aes_slice_t y11 = y20 ^ y9;
+    const aes_slice_t y7 = x7 ^ y11;
+    const aes_slice_t y17 = y10 ^ y11;
+    const aes_slice_t y19 = y10 ^ y8;
+    const aes_slice_t y16 = t0 ^ y11;
+    const aes_slice_t y21 = y13 ^ y16;
+    const aes_slice_t y18 = x0 ^ y16;
+
+    // Non-linear section
+    const aes_slice_t t2 = y12 & y15;
+    const aes_slice_t t3 = y3 & y6;
+    const aes_slice_t t4 = t3 ^ t2;
+    const aes_slice_t t5 = y4 & x7;
+    const aes_slice_t t6 = t5 ^ t2;
+    const aes_slice_t t7 = y13 & y16;
+    const aes_slice_t t8 = y5 & y1;
+    const aes_slice_t t9 = t8 ^ t7;
+    const aes_slice_t t10 = y2 & y7;
+    const aes_slice_t t11 = t10 ^ t7;
+    const aes_slice_t t12 = y9 & y11;
+    const aes_slice_t t13 = y14 & y17;
+    const aes_slice_t t14 = t13 ^ t12;
+    const aes_slice_t t15 = y8 & y10;
+    const aes_slice_t t16 = t15 ^ t12;
+    const aes_slice_t t17 = t4 ^ t14;
+    const aes_slice_t t18 = t6 ^ t16;
+    const aes_slice_t t19 = t9 ^ t14;
+    const aes_slice_t t20 = t11 ^ t16;
+    const aes_slice_t t21 = t17 ^ y20;
+    const aes_slice_t t22 = t18 ^ y19;
+    const aes_slice_t t23 = t19 ^ y21;
+    const aes_slice_t t24 = t20 ^ y18;
+
+    const aes_slice_t t25 = t21 ^ t22;
+    const aes_slice_t t26 = t21 & t23;
+    const aes_slice_t t27 = t24 ^ t26;
+    const aes_slice_t t28 = t25 & t27;
+    const aes_slice_t t29 = t28 ^ t22;
+    const aes_slice_t t30 = t23 ^ t24;
+    const aes_slice_t t31 = t22 ^ t26;
+    const aes_slice_t t32 = t31 & t30;
+    const aes_slice_t t33 = t32 ^ t24;
+    const aes_slice_t t34 = t23 ^ t33;
+    const aes_slice_t t35 = t27 ^ t33;
+    const aes_slice_t t36 = t24 & t35;
+    const aes_slice_t t37 = t36 ^ t34;
+    const aes_slice_t t38 = t27 ^ t36;
+    const aes_slice_t t39 = t29 & t38;
+    const aes_slice_t t40 = t25 ^ t39;
+
+    const aes_slice_t t41 = t40 ^ t37;
+    const aes_slice_t t42 = t29 ^ t33;
+    const aes_slice_t t43 = t29 ^ t40;
+    const aes_slice_t t44 = t33 ^ t37;
+    const aes_slice_t t45 = t42 ^ t41;
+    const aes_slice_t z0 = t44 & y15;
+    const aes_slice_t z1 = t37 & y6;
+    const aes_slice_t z2 = t33 & x7;
+    const aes_slice_t z3 = t43 & y16;
+    const aes_slice_t z4 = t40 & y1;
+    const aes_slice_t z5 = t29 & y7;
+    const aes_slice_t z6 = t42 & y11;
+    const aes_slice_t z7 = t45 & y17;
+    const aes_slice_t z8 = t41 & y10;
+    const aes_slice_t z9 = t44 & y12;
+    const aes_slice_t z10 = t37 & y3;
+    const aes_slice_t z11 = t33 & y4;
+    const aes_slice_t z12 = t43 & y13;
+    const aes_slice_t z13 = t40 & y5;
+    const aes_slice_t z14 = t29 & y2;
+    const aes_slice_t z15 = t42 & y9;
+    const aes_slice_t z16 = t45 & y14;
+    const aes_slice_t z17 = t41 & y8;
+
+    // Bottom linear transformation
+    const aes_slice_t t46 = z15 ^ z16;
+    const aes_slice_t t47 = z10 ^ z11;
+    const aes_slice_t t48 = z5 ^ z13;
+    const aes_slice_t t49 = z9 ^ z10;
+    const aes_slice_t t50 = z2 ^ z12;
+    const aes_slice_t t51 = z2 ^ z5;
+    const aes_slice_t t52 = z7 ^ z8;
+    const aes_slice_t t53 = z0 ^ z3;
+    const aes_slice_t t54 = z6 ^ z7;
+    const aes_slice_t t55 = z16 ^ z17;
+    const aes_slice_t t56 = z12 ^ t48;
+    const aes_slice_t t57 = t50 ^ t53;
+    const aes_slice_t t58 = z4 ^ t46;
+    const aes_slice_t t59 = z3 ^ t54;
+    const aes_slice_t t60 = t46 ^ t57;
+    const aes_slice_t t61 = z14 ^ t57;
+    const aes_slice_t t62 = t52 ^ t58;
+    const aes_slice_t t63 = t49 ^ t58;
+    const aes_slice_t t64 = z4 ^ t59;
+    const aes_slice_t t65 = t61 ^ t62;
+    const aes_slice_t t66 = z1 ^ t63;
+    const aes_slice_t t67 = t64 ^ t65;
+
+    const aes_slice_t s0 = t59 ^ t63;
+    const aes_slice_t s3 = t53 ^ t66;
+    const aes_slice_t s4 = t51 ^ t66;
+    const aes_slice_t s5 = t47 ^ t65;
+    const aes_slice_t s6 = t56 ^ ~t62;
+    const aes_slice_t s7 = t48 ^ ~t60;
+    const aes_slice_t s1 = t64 ^ ~s3;
+    const aes_slice_t s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+// B(x ^ 0x63), where B is the inverse of the S-box's affine transformation
+static void bs_inv_affine(aes_slice_t *q)
+{
+    const aes_slice_t q0 = ~q[0];
+    const aes_slice_t q1 = ~q[1];
+    const aes_slice_t q2 = q[2];
+    const aes_slice_t q3 = q[3];
+    const aes_slice_t q4 = q[4];
+    const aes_slice_t q5 = ~q[5];
+    const aes_slice_t q6 = ~q[6];
+    const aes_slice_t q7 = q[7];
+
+    q[7] = q1 ^ q4 ^ q6;
+    q[6] = q0 ^ q3 ^ q5;
+    q[5] = q7 ^ q2 ^ q4;
+    q[4] = q6 ^ q1 ^ q3;
+    q[3] = q5 ^ q0 ^ q2;
+    q[2] = q4 ^ q7 ^ q1;
+    q[1] = q3 ^ q6 ^ q0;
+    q[0] = q2 ^ q5 ^ q7;
+}
+
+// Inversion is an involution, so InvSubBytes(x) = B(S(B(x ^ 0x63)) ^ 0x63)
+static void bs_inv_substitute_bytes(aes_slice_t *q)
+{
+    bs_inv_affine(q);
+    bs_substitute_bytes(q);
+    bs_inv_affine(q);
+}
+
+// Column c of the result holds column c + 1, c + 2, and c + 3 of `x` respectively
+static inline aes_slice_t bs_next_column(aes_slice_t x)
+{
+    return (aes_slice_t) { x[1], x[2], x[3], x[0] };
+}
+
+static inline aes_slice_t bs_opposite_column(aes_slice_t x)
+{
+    return (aes_slice_t) { x[2], x[3], x[0], x[1] };
+}
+
+static inline aes_slice_t bs_prev_column(aes_slice_t x)
+{
+    return (aes_slice_t) { x[3], x[0], x[1], x[2] };
+}
+
+// Row r of the result holds row r + n of `x`
+static inline aes_slice_t bs_rotate_rows(aes_slice_t x, uint32_t n)
+{
+    return (x >> (8 * n)) | (x << (32 - 8 * n));
+}
+
+// Byte (r, c) moves to (r, c - r)
+static void bs_shift_rows(aes_slice_t *q)
+{
+    for (size_t i = 0; i < 8; i++) {
+        q[i] = (q[i] & 0x000000ff) |
+               (bs_next_column(q[i]) & 0x0000ff00) |
+               (bs_opposite_column(q[i]) & 0x00ff0000) |
+               (bs_prev_column(q[i]) & 0xff000000);
+    }
+}
+
+// Byte (r, c) moves to (r, c + r)
+static void bs_inv_shift_rows(aes_slice_t *q)
+{
+    for (size_t i = 0; i < 8; i++) {
+        q[i] = (q[i] & 0x000000ff) |
+               (bs_prev_column(q[i]) & 0x0000ff00) |
+               (bs_opposite_column(q[i]) & 0x00ff0000) |
+               (bs_next_column(q[i]) & 0xff000000);
+    }
+}
+
+// Multiply every byte by x in GF(2^8)
+static void bs_xtime(aes_slice_t *dst, const aes_slice_t *src)
+{
+    const aes_slice_t hi = src[7];
+    dst[7] = src[6];
+    dst[6] = src[5];
+    dst[5] = src[4];
+    dst[4] = src[3] ^ hi;
+    dst[3] = src[2] ^ hi;
+    dst[2] = src[1];
+    dst[1] = src[0] ^ hi;
+    dst[0] = hi;
+}
+
+// s'(r) = 2s(r) ^ 3s(r + 1) ^ s(r + 2) ^ s(r + 3) = xtime(s(r) ^ s(r + 1)) ^ s(r) ^ (s(0) ^ s(1) ^ s(2) ^ s(3))
+static void bs_mix_columns(aes_slice_t *q)
+{
+    aes_slice_t t[8];
+    for (size_t i = 0; i < 8; i++) {
+        t[i] = q[i] ^ bs_rotate_rows(q[i], 1);
+    }
+    bs_xtime(t, t);
+
+    for (size_t i = 0; i < 8; i++) {
+        const aes_slice_t pair = q[i] ^ bs_rotate_rows(q[i], 2);
+        q[i] ^= t[i] ^ pair ^ bs_rotate_rows(pair, 1);
+    }
+}
+
+// InvMixColumns(s) = MixColumns(s ^ xtime(xtime(s(r) ^ s(r + 2))))
+static void bs_inv_mix_columns(aes_slice_t *q)
+{
+    aes_slice_t u[8];
+    for (size_t i = 0; i < 8; i++) {
+        u[i] = q[i] ^ bs_rotate_rows(q[i], 2);
+    }
+    bs_xtime(u, u);
+    bs_xtime(u, u);
+
+    for (size_t i = 0; i < 8; i++) {
+        q[i] ^= u[i];
+    }
+    bs_mix_columns(q);
+}
+
+static inline void bs_add_round_key(aes_slice_t *q, const aes_slice_t *round_key)
+{
+    for (size_t i = 0; i < 8; i++) {
+        q[i] ^= round_key[i];
+    }
+}
+
+void aes128_bs_init_lanes(aes128_bitsliced_t *bs, const uint32_t *const *round_keys)
+{
+    for (size_t round = 0; round <= AES_ROUNDS; round++) {
+        aes_slice_t *q = bs->round_key[round];
+        for (size_t b = 0; b < 8; b++) {
+            const uint32_t *round_key = &round_keys[b][AES_WORD_COUNT * round];
+            q[b] = (aes_slice_t) { round_key[0], round_key[1], round_key[2], round_key[3] };
+        }
+        bs_orthogonalize(q);
+    }
+}
+
+void aes128_bs_init(aes128_bitsliced_t *bs, const uint32_t *round_key)
+{
+    // Same key schedule in every block
+    const uint32_t *round_keys[8] = {
+        round_key, round_key, round_key, round_key,
+        round_key, round_key, round_key, round_key,
+    };
+    aes128_bs_init_lanes(bs, round_keys);
+}
+
+void aes128_bs_encrypt(const aes128_bitsliced_t *bs, uint8_t *const *blocks)
+{
+    aes_slice_t q[8];
+    bs_load(q, blocks);
+
+    bs_add_round_key(q, bs->round_key[0]);
+    for (size_t round = 1; round < AES_ROUNDS; round++) {
+        bs_substitute_bytes(q);
+        bs_shift_rows(q);
+        bs_mix_columns(q);
+        bs_add_round_key(q, bs->round_key[round]);
+    }
+    bs_substitute_bytes(q);
+    bs_shift_rows(q);
+    bs_add_round_key(q, bs->round_key[AES_ROUNDS]);
+
+    bs_store(blocks, q);
+}
+
+// Equivalent inverse cipher, the same round structure as aes128_bs_encrypt()
+void aes128_bs_decrypt(const aes128_bitsliced_t *bs, uint8_t *const *blocks)
+{
+    aes_slice_t q[8];
+    bs_load(q, blocks);
+
+    bs_add_round_key(q, bs->round_key[0]);
+    for (size_t round = 1; round < AES_ROUNDS; round++) {
+        bs_inv_substitute_bytes(q);
+        bs_inv_shift_rows(q);
+        bs_inv_mix_columns(q);
+        bs_add_round_key(q, bs->round_key[round]);
+    }
+    bs_inv_substitute_bytes(q);
+    bs_inv_shift_rows(q);
+    bs_add_round_key(q, bs->round_key[AES_ROUNDS]);
+
+    bs_store(blocks, q);
+}
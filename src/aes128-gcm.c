@@ -0,0 +1,330 @@
+/**
+ * @file aes128-gcm.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief AES-128 in Galois/Counter Mode following NIST SP 800-38D
+ * @ref https://nvlpubs.nist.gov/nistpubs/Legacy/SP/nistspecialpublication800-38d.pdf
+ * @ref https://www.bearssl.org/constanttime.html#ghash-for-gcm
+ * @version 0.9.4
+ * @date 2022-02-06
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway.
+ *
+ */
+
+#include "aes128.h"
+#include "aes128-backend.h"
+
+static inline uint64_t load64_be(const uint8_t *src)
+{
+    uint64_t x = 0;
+    for (size_t i = 0; i < 8; i++) {
+        x = (x << 8) | src[i];
+    }
+    return x;
+}
+
+static inline void store64_be(uint8_t *dst, uint64_t src)
+{
+    for (size_t i = 0; i < 8; i++) {
+        dst[i] = (uint8_t)(src >> (56 - 8 * i));
+    }
+}
+
+static inline uint32_t load32_be(const uint8_t *src)
+{
+    return (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 8 | (uint32_t)src[3];
+}
+
+static inline void store32_be(uint8_t *dst, uint32_t src)
+{
+    dst[0] = (uint8_t)(src >> 24);
+    dst[1] = (uint8_t)(src >> 16);
+    dst[2] = (uint8_t)(src >> 8);
+    dst[3] = (uint8_t)src;
+}
+
+static void xor128(uint8_t *a, const uint8_t *b)
+{
+    for (size_t i = 0; i < AES_BLOCK_SIZE; i++) {
+        a[i] ^= b[i];
+    }
+}
+
+// Low 64 bits of the carry-less product, computed with integer multiplies on operands
+// split into every fourth bit so that carries fall into the holes and get masked off
+static inline uint64_t bmul64(uint64_t x, uint64_t y)
+{
+    const uint64_t x0 = x & 0x1111111111111111ull;
+    const uint64_t x1 = x & 0x2222222222222222ull;
+    const uint64_t x2 = x & 0x4444444444444444ull;
+    const uint64_t x3 = x & 0x8888888888888888ull;
+    const uint64_t y0 = y & 0x1111111111111111ull;
+    const uint64_t y1 = y & 0x2222222222222222ull;
+    const uint64_t y2 = y & 0x4444444444444444ull;
+    const uint64_t y3 = y & 0x8888888888888888ull;
+
+    const uint64_t z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+    const uint64_t z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+    const uint64_t z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+    const uint64_t z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+
+    return (z0 & 0x1111111111111111ull) |
+           (z1 & 0x2222222222222222ull) |
+           (z2 & 0x4444444444444444ull) |
+           (z3 & 0x8888888888888888ull);
+}
+
+static inline uint64_t rev64(uint64_t x)
+{
+    x = ((x & 0x5555555555555555ull) << 1) | ((x >> 1) & 0x5555555555555555ull);
+    x = ((x & 0x3333333333333333ull) << 2) | ((x >> 2) & 0x3333333333333333ull);
+    x = ((x & 0x0f0f0f0f0f0f0f0full) << 4) | ((x >> 4) & 0x0f0f0f0f0f0f0f0full);
+    x = ((x & 0x00ff00ff00ff00ffull) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffull);
+    x = ((x & 0x0000ffff0000ffffull) << 16) | ((x >> 16) & 0x0000ffff0000ffffull);
+    return (x << 32) | (x >> 32);
+}
+
+// Portable kernels
+
+// GHASH with Karatsuba over 64-bit halves, the high halves of each product coming from
+// the bit-reversed operands, followed by reduction modulo x^128 + x^7 + x^2 + x + 1
+static void portable_ghash(const uint8_t *h, uint8_t *state, const uint8_t *msg, size_t blocks)
+{
+    const uint64_t h1 = load64_be(&h[0]);
+    const uint64_t h0 = load64_be(&h[8]);
+    const uint64_t h0r = rev64(h0);
+    const uint64_t h1r = rev64(h1);
+    const uint64_t h2 = h0 ^ h1;
+    const uint64_t h2r = h0r ^ h1r;
+
+    uint64_t y1 = load64_be(&state[0]);
+    uint64_t y0 = load64_be(&state[8]);
+    for (size_t i = 0; i < blocks; i++) {
+        y1 ^= load64_be(&msg[0]);
+        y0 ^= load64_be(&msg[8]);
+        msg += AES_BLOCK_SIZE;
+
+        const uint64_t y0r = rev64(y0);
+        const uint64_t y1r = rev64(y1);
+        const uint64_t y2 = y0 ^ y1;
+        const uint64_t y2r = y0r ^ y1r;
+
+        const uint64_t z0 = bmul64(y0, h0);
+        const uint64_t z1 = bmul64(y1, h1);
+        const uint64_t z2 = bmul64(y2, h2) ^ z0 ^ z1;
+        const uint64_t z0h = bmul64(y0r, h0r);
+        const uint64_t z1h = bmul64(y1r, h1r);
+        const uint64_t z2h = bmul64(y2r, h2r) ^ z0h ^ z1h;
+
+        // 256-bit product, shifted left once since GCM's bit order is reflected
+        uint64_t v0 = z0;
+        uint64_t v1 = (rev64(z0h) >> 1) ^ z2;
+        uint64_t v2 = z1 ^ (rev64(z2h) >> 1);
+        uint64_t v3 = rev64(z1h) >> 1;
+        v3 = (v3 << 1) | (v2 >> 63);
+        v2 = (v2 << 1) | (v1 >> 63);
+        v1 = (v1 << 1) | (v0 >> 63);
+        v0 = (v0 << 1);
+
+        v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);
+        v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);
+        v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+        v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+        y0 = v2;
+        y1 = v3;
+    }
+    store64_be(&state[0], y1);
+    store64_be(&state[8], y0);
+}
+
+// Counter blocks are encrypted 8 at a time with the bitsliced cipher
+static void portable_ctr(const uint32_t *round_key, uint8_t *counter, uint8_t *chunk, size_t blocks)
+{
+    aes128_bitsliced_t bs;
+    aes128_bs_init(&bs, round_key);
+
+    uint32_t count = load32_be(&counter[12]);
+    while (blocks) {
+        const size_t group = blocks < 8 ? blocks : 8;
+
+        uint8_t keystream[8][AES_BLOCK_SIZE];
+        uint8_t *lanes[8];
+        for (size_t i = 0; i < 8; i++) {
+            memcpy(keystream[i], counter, 12);
+            store32_be(&keystream[i][12], count + (uint32_t)i);
+            lanes[i] = keystream[i];
+        }
+        aes128_bs_encrypt(&bs, lanes);
+
+        for (size_t i = 0; i < group; i++) {
+            xor128(&chunk[AES_BLOCK_SIZE * i], keystream[i]);
+        }
+        count += (uint32_t)group;
+        chunk += AES_BLOCK_SIZE * group;
+        blocks -= group;
+    }
+    store32_be(&counter[12], count);
+}
+
+static void portable_encrypt_ctr_ghash(const uint32_t *round_key, uint8_t *counter, const uint8_t *h, uint8_t *state, uint8_t *chunk, size_t blocks)
+{
+    portable_ctr(round_key, counter, chunk, blocks);
+    portable_ghash(h, state, chunk, blocks);
+}
+
+static void portable_decrypt_ctr_ghash(const uint32_t *round_key, uint8_t *counter, const uint8_t *h, uint8_t *state, uint8_t *chunk, size_t blocks)
+{
+    portable_ghash(h, state, chunk, blocks);
+    portable_ctr(round_key, counter, chunk, blocks);
+}
+
+static const aes128_gcm_backend_t portable = {
+    .name = "portable",
+    .ghash = portable_ghash,
+    .ctr = portable_ctr,
+    .encrypt_ctr_ghash = portable_encrypt_ctr_ghash,
+    .decrypt_ctr_ghash = portable_decrypt_ctr_ghash,
+};
+
+static const aes128_gcm_backend_t *backend = &portable;
+
+// Pick the fastest backend supported by the host
+__attribute__((constructor))
+static void gcm_select_backend(void)
+{
+    const aes128_gcm_backend_t *ni = aes128_gcm_ni_backend();
+    if (ni) {
+        backend = ni;
+    }
+}
+
+bool aes128_gcm_accelerated(void)
+{
+    return backend != &portable;
+}
+
+// Absorb the partial block, zero-padded
+static void gcm_pad(aes128_gcm_t *gcm)
+{
+    if (gcm->block_bytes) {
+        memset(&gcm->block[gcm->block_bytes], 0, AES_BLOCK_SIZE - gcm->block_bytes);
+        backend->ghash(gcm->h, gcm->state, gcm->block, 1);
+        gcm->block_bytes = 0;
+    }
+}
+
+void aes128_gcm_init(aes128_gcm_t *gcm, const aes128_t *ctx, const uint8_t *j0)
+{
+    memset(gcm, 0, sizeof(*gcm));
+    gcm->ctx = ctx;
+
+    // H is the cipher output for the zero block, i.e., the keystream for counter block 0
+    uint8_t zero[AES_BLOCK_SIZE] = { 0 };
+    backend->ctr(ctx->round_key, zero, gcm->h, 1);
+
+    memcpy(gcm->j0, j0, AES_BLOCK_SIZE);
+    memcpy(gcm->counter, j0, AES_BLOCK_SIZE);
+    store32_be(&gcm->counter[12], load32_be(&j0[12]) + 1);
+}
+
+// GHASH arbitrary-length input, holding back a partial block
+static void gcm_absorb(aes128_gcm_t *gcm, const uint8_t *msg, size_t length)
+{
+    while (length) {
+        if (!gcm->block_bytes && length >= AES_BLOCK_SIZE) {
+            const size_t blocks = length / AES_BLOCK_SIZE;
+            backend->ghash(gcm->h, gcm->state, msg, blocks);
+            msg += blocks * AES_BLOCK_SIZE;
+            length -= blocks * AES_BLOCK_SIZE;
+            continue;
+        }
+
+        const size_t space = AES_BLOCK_SIZE - gcm->block_bytes;
+        const size_t bytes = length < space ? length : space;
+        memcpy(&gcm->block[gcm->block_bytes], msg, bytes);
+        gcm->block_bytes += bytes;
+        msg += bytes;
+        length -= bytes;
+        if (gcm->block_bytes == AES_BLOCK_SIZE) {
+            backend->ghash(gcm->h, gcm->state, gcm->block, 1);
+            gcm->block_bytes = 0;
+        }
+    }
+}
+
+void aes128_gcm_aad(aes128_gcm_t *gcm, const uint8_t *aad, size_t length)
+{
+    gcm->aad_bytes += length;
+    gcm_absorb(gcm, aad, length);
+    gcm_pad(gcm);
+}
+
+void aes128_gcm_append(aes128_gcm_t *gcm, const uint8_t *msg, size_t length)
+{
+    gcm->text_bytes += length;
+    gcm_absorb(gcm, msg, length);
+}
+
+void aes128_gcm_ctr(aes128_gcm_t *gcm, uint8_t *chunk, size_t length)
+{
+    const size_t blocks = length / AES_BLOCK_SIZE;
+    backend->ctr(gcm->ctx->round_key, gcm->counter, chunk, blocks);
+
+    // Trailing partial block
+    const size_t tail = length % AES_BLOCK_SIZE;
+    if (tail) {
+        uint8_t keystream[AES_BLOCK_SIZE] = { 0 };
+        backend->ctr(gcm->ctx->round_key, gcm->counter, keystream, 1);
+        for (size_t i = 0; i < tail; i++) {
+            chunk[AES_BLOCK_SIZE * blocks + i] ^= keystream[i];
+        }
+    }
+}
+
+void aes128_gcm_skip(aes128_gcm_t *gcm, size_t length)
+{
+    const uint32_t count = load32_be(&gcm->counter[12]);
+    store32_be(&gcm->counter[12], count + (uint32_t)(length / AES_BLOCK_SIZE));
+}
+
+void aes128_gcm_encrypt(aes128_gcm_t *gcm, uint8_t *chunk, size_t length)
+{
+    // Fusing requires the GHASH stream to be block-aligned
+    const size_t blocks = gcm->block_bytes ? 0 : length / AES_BLOCK_SIZE;
+    backend->encrypt_ctr_ghash(gcm->ctx->round_key, gcm->counter, gcm->h, gcm->state, chunk, blocks);
+    gcm->text_bytes += AES_BLOCK_SIZE * blocks;
+
+    chunk += AES_BLOCK_SIZE * blocks;
+    length -= AES_BLOCK_SIZE * blocks;
+    aes128_gcm_ctr(gcm, chunk, length);
+    aes128_gcm_append(gcm, chunk, length);
+}
+
+void aes128_gcm_decrypt(aes128_gcm_t *gcm, uint8_t *chunk, size_t length)
+{
+    const size_t blocks = gcm->block_bytes ? 0 : length / AES_BLOCK_SIZE;
+    backend->decrypt_ctr_ghash(gcm->ctx->round_key, gcm->counter, gcm->h, gcm->state, chunk, blocks);
+    gcm->text_bytes += AES_BLOCK_SIZE * blocks;
+
+    chunk += AES_BLOCK_SIZE * blocks;
+    length -= AES_BLOCK_SIZE * blocks;
+    aes128_gcm_append(gcm, chunk, length);
+    aes128_gcm_ctr(gcm, chunk, length);
+}
+
+void aes128_gcm_finish(aes128_gcm_t *gcm, uint8_t *tag)
+{
+    gcm_pad(gcm);
+
+    // Lengths block, in bits
+    uint8_t lengths[AES_BLOCK_SIZE];
+    store64_be(&lengths[0], 8 * gcm->aad_bytes);
+    store64_be(&lengths[8], 8 * gcm->text_bytes);
+    backend->ghash(gcm->h, gcm->state, lengths, 1);
+
+    // Mask with the keystream for J0
+    uint8_t j0[AES_BLOCK_SIZE];
+    memcpy(j0, gcm->j0, AES_BLOCK_SIZE);
+    backend->ctr(gcm->ctx->round_key, j0, gcm->state, 1);
+    memcpy(tag, gcm->state, AES_BLOCK_SIZE);
+}
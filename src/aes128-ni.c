@@ -0,0 +1,504 @@
+/**
+ * @file aes128-ni.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief AES-NI backend for aes128, selected at runtime when supported
+ * @ref https://www.intel.com/content/dam/doc/white-paper/advanced-encryption-standard-new-instructions-set-paper.pdf
+ * @version 0.9.4
+ * @date 2022-02-06
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway.
+ *
+ */
+
+#include "aes128-backend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define AESNI __attribute__((target("aes,sse2")))
+#define AESNI_GCM __attribute__((target("aes,pclmul,sse2,ssse3")))
+
+// The word-oriented schedules in aes128_t are byte-for-byte the FIPS 197 layout on x86,
+// and the equivalent inverse cipher schedule is exactly what AESDEC expects
+AESNI static inline void aesni_load_schedule(__m128i *k, const uint32_t *round_key)
+{
+    for (size_t i = 0; i <= AES_ROUNDS; i++) {
+        k[i] = _mm_loadu_si128((const __m128i *)&round_key[AES_WORD_COUNT * i]);
+    }
+}
+
+AESNI static inline __m128i aesni_encrypt(__m128i x, const __m128i *k)
+{
+    x = _mm_xor_si128(x, k[0]);
+    for (size_t i = 1; i < AES_ROUNDS; i++) {
+        x = _mm_aesenc_si128(x, k[i]);
+    }
+    return _mm_aesenclast_si128(x, k[AES_ROUNDS]);
+}
+
+AESNI static inline __m128i aesni_decrypt(__m128i x, const __m128i *k)
+{
+    x = _mm_xor_si128(x, k[0]);
+    for (size_t i = 1; i < AES_ROUNDS; i++) {
+        x = _mm_aesdec_si128(x, k[i]);
+    }
+    return _mm_aesdeclast_si128(x, k[AES_ROUNDS]);
+}
+
+// Encrypt `x` under `k` and `y` under `l`, interleaving rounds of the two independent chains
+AESNI static inline void aesni_encrypt2(__m128i *x, const __m128i *k, __m128i *y, const __m128i *l)
+{
+    __m128i a = _mm_xor_si128(*x, k[0]);
+    __m128i b = _mm_xor_si128(*y, l[0]);
+    for (size_t i = 1; i < AES_ROUNDS; i++) {
+        a = _mm_aesenc_si128(a, k[i]);
+        b = _mm_aesenc_si128(b, l[i]);
+    }
+    *x = _mm_aesenclast_si128(a, k[AES_ROUNDS]);
+    *y = _mm_aesenclast_si128(b, l[AES_ROUNDS]);
+}
+
+// Decrypt `x` under `k` while encrypting `y` under `l`
+AESNI static inline void aesni_decrypt_encrypt(__m128i *x, const __m128i *k, __m128i *y, const __m128i *l)
+{
+    __m128i a = _mm_xor_si128(*x, k[0]);
+    __m128i b = _mm_xor_si128(*y, l[0]);
+    for (size_t i = 1; i < AES_ROUNDS; i++) {
+        a = _mm_aesdec_si128(a, k[i]);
+        b = _mm_aesenc_si128(b, l[i]);
+    }
+    *x = _mm_aesdeclast_si128(a, k[AES_ROUNDS]);
+    *y = _mm_aesenclast_si128(b, l[AES_ROUNDS]);
+}
+
+AESNI static void aesni_encrypt_block(const uint32_t *round_key, uint8_t *block)
+{
+    __m128i k[AES_ROUNDS + 1];
+    aesni_load_schedule(k, round_key);
+    _mm_storeu_si128((__m128i *)block, aesni_encrypt(_mm_loadu_si128((const __m128i *)block), k));
+}
+
+AESNI static void aesni_encrypt_cbc(const uint32_t *round_key, uint8_t *iv, uint8_t *chunk, size_t blocks)
+{
+    __m128i k[AES_ROUNDS + 1];
+    aesni_load_schedule(k, round_key);
+
+    __m128i c = _mm_loadu_si128((const __m128i *)iv);
+    for (size_t i = 0; i < blocks; i++) {
+        __m128i *block = (__m128i *)&chunk[AES_BLOCK_SIZE * i];
+        c = aesni_encrypt(_mm_xor_si128(_mm_loadu_si128(block), c), k);
+        _mm_storeu_si128(block, c);
+    }
+    _mm_storeu_si128((__m128i *)iv, c);
+}
+
+// Decrypt 8 independent blocks, interleaving their rounds to keep the AESDEC pipeline full
+AESNI static inline void aesni_decrypt8(__m128i *x, const __m128i *k)
+{
+    #pragma GCC unroll 8
+    for (size_t j = 0; j < 8; j++) {
+        x[j] = _mm_xor_si128(x[j], k[0]);
+    }
+    for (size_t i = 1; i < AES_ROUNDS; i++) {
+        #pragma GCC unroll 8
+        for (size_t j = 0; j < 8; j++) {
+            x[j] = _mm_aesdec_si128(x[j], k[i]);
+        }
+    }
+    #pragma GCC unroll 8
+    for (size_t j = 0; j < 8; j++) {
+        x[j] = _mm_aesdeclast_si128(x[j], k[AES_ROUNDS]);
+    }
+}
+
+AESNI static void aesni_decrypt_cbc(const uint32_t *inv_round_key, uint8_t *iv, uint8_t *chunk, size_t blocks)
+{
+    __m128i k[AES_ROUNDS + 1];
+    aesni_load_schedule(k, inv_round_key);
+
+    __m128i prev = _mm_loadu_si128((const __m128i *)iv);
+    for (; blocks >= 8; blocks -= 8) {
+        __m128i c[8];
+        __m128i x[8];
+        #pragma GCC unroll 8
+        for (size_t j = 0; j < 8; j++) {
+            c[j] = x[j] = _mm_loadu_si128((const __m128i *)&chunk[AES_BLOCK_SIZE * j]);
+        }
+        aesni_decrypt8(x, k);
+        _mm_storeu_si128((__m128i *)chunk, _mm_xor_si128(x[0], prev));
+        #pragma GCC unroll 8
+        for (size_t j = 1; j < 8; j++) {
+            _mm_storeu_si128((__m128i *)&chunk[AES_BLOCK_SIZE * j], _mm_xor_si128(x[j], c[j - 1]));
+        }
+        prev = c[7];
+        chunk += AES_BLOCK_SIZE * 8;
+    }
+
+    for (; blocks; blocks--) {
+        const __m128i c = _mm_loadu_si128((const __m128i *)chunk);
+        _mm_storeu_si128((__m128i *)chunk, _mm_xor_si128(aesni_decrypt(c, k), prev));
+        prev = c;
+        chunk += AES_BLOCK_SIZE;
+    }
+    _mm_storeu_si128((__m128i *)iv, prev);
+}
+
+AESNI static void aesni_cbc_mac(const uint32_t *round_key, uint8_t *state, const uint8_t *msg, size_t blocks)
+{
+    __m128i k[AES_ROUNDS + 1];
+    aesni_load_schedule(k, round_key);
+
+    __m128i m = _mm_loadu_si128((const __m128i *)state);
+    for (size_t i = 0; i < blocks; i++) {
+        m = aesni_encrypt(_mm_xor_si128(m, _mm_loadu_si128((const __m128i *)&msg[AES_BLOCK_SIZE * i])), k);
+    }
+    _mm_storeu_si128((__m128i *)state, m);
+}
+
+// The MAC of ciphertext block i - 1 runs alongside the encryption of block i
+AESNI static void aesni_encrypt_cbc_mac(const uint32_t *round_key, uint8_t *iv, const uint32_t *mac_key, uint8_t *state, uint8_t *chunk, size_t blocks)
+{
+    __m128i k[AES_ROUNDS + 1];
+    __m128i l[AES_ROUNDS + 1];
+    aesni_load_schedule(k, round_key);
+    aesni_load_schedule(l, mac_key);
+
+    __m128i c = _mm_loadu_si128((const __m128i *)iv);
+    __m128i m = _mm_loadu_si128((const __m128i *)state);
+    for (size_t i = 0; i < blocks; i++) {
+        __m128i *block = (__m128i *)&chunk[AES_BLOCK_SIZE * i];
+        __m128i x = _mm_xor_si128(_mm_loadu_si128(block), c);
+        if (i) {
+            m = _mm_xor_si128(m, c);
+            aesni_encrypt2(&x, k, &m, l);
+        }
+        else {
+            x = aesni_encrypt(x, k);
+        }
+        c = x;
+        _mm_storeu_si128(block, c);
+    }
+    _mm_storeu_si128((__m128i *)iv, c);
+    _mm_storeu_si128((__m128i *)state, m);
+}
+
+AESNI static void aesni_decrypt_cbc_mac(const uint32_t *inv_round_key, uint8_t *iv, const uint32_t *mac_key, uint8_t *state, uint8_t *chunk, size_t blocks)
+{
+    __m128i k[AES_ROUNDS + 1];
+    __m128i l[AES_ROUNDS + 1];
+    aesni_load_schedule(k, inv_round_key);
+    aesni_load_schedule(l, mac_key);
+
+    __m128i prev = _mm_loadu_si128((const __m128i *)iv);
+    __m128i m = _mm_loadu_si128((const __m128i *)state);
+    for (size_t i = 0; i < blocks; i++) {
+        __m128i *block = (__m128i *)&chunk[AES_BLOCK_SIZE * i];
+        const __m128i c = _mm_loadu_si128(block);
+        __m128i x = c;
+        if (i + 1 < blocks) {
+            m = _mm_xor_si128(m, c);
+            aesni_decrypt_encrypt(&x, k, &m, l);
+        }
+        else {
+            x = aesni_decrypt(x, k);
+        }
+        _mm_storeu_si128(block, _mm_xor_si128(x, prev));
+        prev = c;
+    }
+    _mm_storeu_si128((__m128i *)iv, prev);
+    _mm_storeu_si128((__m128i *)state, m);
+}
+
+// Encrypt 8 independent blocks, each under its own key schedule
+AESNI static inline void aesni_encrypt8(__m128i *x, __m128i (*k)[AES_ROUNDS + 1])
+{
+    #pragma GCC unroll 8
+    for (size_t j = 0; j < 8; j++) {
+        x[j] = _mm_xor_si128(x[j], k[j][0]);
+    }
+    for (size_t i = 1; i < AES_ROUNDS; i++) {
+        #pragma GCC unroll 8
+        for (size_t j = 0; j < 8; j++) {
+            x[j] = _mm_aesenc_si128(x[j], k[j][i]);
+        }
+    }
+    #pragma GCC unroll 8
+    for (size_t j = 0; j < 8; j++) {
+        x[j] = _mm_aesenclast_si128(x[j], k[j][AES_ROUNDS]);
+    }
+}
+
+// Each step encrypts block i of every stream alongside the MAC of its ciphertext block i - 1,
+// keeping 2 * AES_LANES chains in flight
+AESNI static void aesni_encrypt_cbc_mac_lanes(aes128_lane_t *lanes, size_t count)
+{
+    __m128i k[2 * AES_LANES][AES_ROUNDS + 1];
+    __m128i c[AES_LANES];
+    __m128i m[AES_LANES];
+    size_t steps = 0;
+    for (size_t i = 0; i < AES_LANES; i++) {
+        const aes128_lane_t *lane = &lanes[i < count ? i : 0];
+        aesni_load_schedule(k[i], lane->round_key);
+        aesni_load_schedule(k[AES_LANES + i], lane->mac_key);
+        c[i] = _mm_loadu_si128((const __m128i *)lane->iv);
+        m[i] = _mm_loadu_si128((const __m128i *)lane->state);
+        if (i < count && lane->blocks > steps) {
+            steps = lane->blocks;
+        }
+    }
+
+    for (size_t step = 0; step < steps; step++) {
+        __m128i x[2 * AES_LANES];
+        #pragma GCC unroll 4
+        for (size_t i = 0; i < AES_LANES; i++) {
+            x[i] = c[i];
+            if (i < count && step < lanes[i].blocks) {
+                x[i] = _mm_xor_si128(x[i], _mm_loadu_si128((const __m128i *)&lanes[i].chunk[AES_BLOCK_SIZE * step]));
+            }
+            x[AES_LANES + i] = _mm_xor_si128(m[i], c[i]);
+        }
+
+        aesni_encrypt8(x, k);
+
+        #pragma GCC unroll 4
+        for (size_t i = 0; i < AES_LANES; i++) {
+            if (i < count && step < lanes[i].blocks) {
+                _mm_storeu_si128((__m128i *)&lanes[i].chunk[AES_BLOCK_SIZE * step], x[i]);
+                c[i] = x[i];
+                if (step) {
+                    m[i] = x[AES_LANES + i];
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        _mm_storeu_si128((__m128i *)lanes[i].iv, c[i]);
+        _mm_storeu_si128((__m128i *)lanes[i].state, m[i]);
+    }
+}
+
+static const aes128_backend_t aesni = {
+    .name = "aes-ni",
+    .encrypt_block = aesni_encrypt_block,
+    .encrypt_cbc = aesni_encrypt_cbc,
+    .decrypt_cbc = aesni_decrypt_cbc,
+    .cbc_mac = aesni_cbc_mac,
+    .encrypt_cbc_mac = aesni_encrypt_cbc_mac,
+    .decrypt_cbc_mac = aesni_decrypt_cbc_mac,
+    .encrypt_cbc_mac_lanes = aesni_encrypt_cbc_mac_lanes,
+};
+
+// GCM kernels work on byte-reversed blocks, making GCM's reflected bit order that of a 128-bit integer
+
+AESNI_GCM static inline __m128i gcm_bswap(__m128i x)
+{
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+// Accumulate the unreduced Karatsuba product of `a` and `b`. Reduction is linear,
+// so a sum of products needs reducing only once
+AESNI_GCM static inline void gcm_mul_acc(__m128i a, __m128i b, __m128i *lo, __m128i *mid, __m128i *hi)
+{
+    *lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+    *hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+    *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(_mm_xor_si128(a, _mm_shuffle_epi32(a, 0x4e)), _mm_xor_si128(b, _mm_shuffle_epi32(b, 0x4e)), 0x00));
+}
+
+// Shift-based reduction modulo x^128 + x^7 + x^2 + x + 1 (Intel white paper, Algorithm 5)
+AESNI_GCM static inline __m128i gcm_reduce(__m128i lo, __m128i mid, __m128i hi)
+{
+    mid = _mm_xor_si128(mid, _mm_xor_si128(lo, hi));
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    // Shift the 256-bit product left once
+    __m128i lo_carry = _mm_srli_epi32(lo, 31);
+    __m128i hi_carry = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    hi = _mm_or_si128(hi, _mm_srli_si128(lo_carry, 12));
+    hi = _mm_or_si128(hi, _mm_slli_si128(hi_carry, 4));
+    lo = _mm_or_si128(lo, _mm_slli_si128(lo_carry, 4));
+
+    __m128i t = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+    const __m128i spill = _mm_srli_si128(t, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t, 12));
+    t = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+    t = _mm_xor_si128(t, spill);
+    lo = _mm_xor_si128(lo, t);
+    return _mm_xor_si128(hi, lo);
+}
+
+// Multiply in GF(2^128)
+AESNI_GCM static inline __m128i gcm_mul(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    gcm_mul_acc(a, b, &lo, &mid, &hi);
+    return gcm_reduce(lo, mid, hi);
+}
+
+AESNI_GCM static inline __m128i gcm_load(const uint8_t *src)
+{
+    return gcm_bswap(_mm_loadu_si128((const __m128i *)src));
+}
+
+AESNI_GCM static inline void gcm_store(uint8_t *dst, __m128i x)
+{
+    _mm_storeu_si128((__m128i *)dst, gcm_bswap(x));
+}
+
+AESNI_GCM static void aesni_ghash(const uint8_t *h, uint8_t *state, const uint8_t *msg, size_t blocks)
+{
+    const __m128i hk = gcm_load(h);
+    __m128i y = gcm_load(state);
+    for (size_t i = 0; i < blocks; i++) {
+        y = gcm_mul(_mm_xor_si128(y, gcm_load(&msg[AES_BLOCK_SIZE * i])), hk);
+    }
+    gcm_store(state, y);
+}
+
+// Encrypt 8 consecutive counter blocks, `ctr` being byte-reversed so the 32-bit counter is lane 0
+AESNI_GCM static inline void aesni_keystream8(__m128i *x, __m128i ctr, const __m128i *k)
+{
+    #pragma GCC unroll 8
+    for (size_t j = 0; j < 8; j++) {
+        x[j] = _mm_xor_si128(gcm_bswap(_mm_add_epi32(ctr, _mm_set_epi32(0, 0, 0, (int)j))), k[0]);
+    }
+    for (size_t i = 1; i < AES_ROUNDS; i++) {
+        #pragma GCC unroll 8
+        for (size_t j = 0; j < 8; j++) {
+            x[j] = _mm_aesenc_si128(x[j], k[i]);
+        }
+    }
+    #pragma GCC unroll 8
+    for (size_t j = 0; j < 8; j++) {
+        x[j] = _mm_aesenclast_si128(x[j], k[AES_ROUNDS]);
+    }
+}
+
+// `mode` is 0 for the keystream alone, 1 to GHASH the output (encryption), or -1 to GHASH the input (decryption)
+AESNI_GCM static inline void aesni_ctr_ghash(const uint32_t *round_key, uint8_t *counter, const uint8_t *h, uint8_t *state, uint8_t *chunk, size_t blocks, int mode)
+{
+    __m128i k[AES_ROUNDS + 1];
+    aesni_load_schedule(k, round_key);
+
+    const __m128i hk = mode ? gcm_load(h) : _mm_setzero_si128();
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    __m128i ctr = gcm_load(counter);
+    __m128i y = mode ? gcm_load(state) : _mm_setzero_si128();
+
+    // H^1 ... H^8, so each group of 8 blocks is hashed with a single reduction:
+    // Y' = (Y ^ C0)H^8 ^ C1H^7 ^ ... ^ C7H
+    __m128i hpow[8];
+    if (mode && blocks >= 8) {
+        hpow[0] = hk;
+        for (size_t j = 1; j < 8; j++) {
+            hpow[j] = gcm_mul(hpow[j - 1], hk);
+        }
+    }
+
+    for (; blocks >= 8; blocks -= 8) {
+        __m128i x[8];
+        aesni_keystream8(x, ctr, k);
+        ctr = _mm_add_epi32(ctr, _mm_set_epi32(0, 0, 0, 8));
+
+        __m128i lo = _mm_setzero_si128();
+        __m128i mid = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        #pragma GCC unroll 8
+        for (size_t j = 0; j < 8; j++) {
+            __m128i *block = (__m128i *)&chunk[AES_BLOCK_SIZE * j];
+            const __m128i in = _mm_loadu_si128(block);
+            const __m128i out = _mm_xor_si128(in, x[j]);
+            _mm_storeu_si128(block, out);
+            if (mode) {
+                __m128i c = gcm_bswap(mode > 0 ? out : in);
+                if (!j) {
+                    c = _mm_xor_si128(c, y);
+                }
+                gcm_mul_acc(c, hpow[7 - j], &lo, &mid, &hi);
+            }
+        }
+        if (mode) {
+            y = gcm_reduce(lo, mid, hi);
+        }
+        chunk += AES_BLOCK_SIZE * 8;
+    }
+
+    for (; blocks; blocks--) {
+        const __m128i x = aesni_encrypt(gcm_bswap(ctr), k);
+        ctr = _mm_add_epi32(ctr, one);
+
+        const __m128i in = _mm_loadu_si128((const __m128i *)chunk);
+        const __m128i out = _mm_xor_si128(in, x);
+        _mm_storeu_si128((__m128i *)chunk, out);
+        if (mode) {
+            y = gcm_mul(_mm_xor_si128(y, gcm_bswap(mode > 0 ? out : in)), hk);
+        }
+        chunk += AES_BLOCK_SIZE;
+    }
+
+    gcm_store(counter, ctr);
+    if (mode) {
+        gcm_store(state, y);
+    }
+}
+
+AESNI_GCM static void aesni_ctr(const uint32_t *round_key, uint8_t *counter, uint8_t *chunk, size_t blocks)
+{
+    aesni_ctr_ghash(round_key, counter, NULL, NULL, chunk, blocks, 0);
+}
+
+// The ciphertext of each group of 8 blocks is hashed while it is still in registers
+AESNI_GCM static void aesni_encrypt_ctr_ghash(const uint32_t *round_key, uint8_t *counter, const uint8_t *h, uint8_t *state, uint8_t *chunk, size_t blocks)
+{
+    aesni_ctr_ghash(round_key, counter, h, state, chunk, blocks, 1);
+}
+
+AESNI_GCM static void aesni_decrypt_ctr_ghash(const uint32_t *round_key, uint8_t *counter, const uint8_t *h, uint8_t *state, uint8_t *chunk, size_t blocks)
+{
+    aesni_ctr_ghash(round_key, counter, h, state, chunk, blocks, -1);
+}
+
+static const aes128_gcm_backend_t aesni_gcm = {
+    .name = "aes-ni + pclmul",
+    .ghash = aesni_ghash,
+    .ctr = aesni_ctr,
+    .encrypt_ctr_ghash = aesni_encrypt_ctr_ghash,
+    .decrypt_ctr_ghash = aesni_decrypt_ctr_ghash,
+};
+
+const aes128_backend_t *aes128_ni_backend(void)
+{
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("aes") || !__builtin_cpu_supports("sse2")) {
+        return NULL;
+    }
+    return &aesni;
+}
+
+const aes128_gcm_backend_t *aes128_gcm_ni_backend(void)
+{
+    if (!aes128_ni_backend() || !__builtin_cpu_supports("pclmul") || !__builtin_cpu_supports("ssse3")) {
+        return NULL;
+    }
+    return &aesni_gcm;
+}
+
+#else
+
+const aes128_backend_t *aes128_ni_backend(void)
+{
+    return NULL;
+}
+
+const aes128_gcm_backend_t *aes128_gcm_ni_backend(void)
+{
+    return NULL;
+}
+
+#endif
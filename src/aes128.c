@@ -16,17 +16,88 @@
  */
 
 #include "aes128.h"
+#include "aes128-backend.h"
+
+// Substitution table used to perform one-to-one byte substitutions
+static const uint8_t sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+// Round tables combining SubBytes and MixColumns for a byte in row 0 of a column
+// Entries for rows 1 - 3 are the same word rotated left by 8, 16, and 24 bits
+// Columns are stored little-endian, i.e., row 0 in the least-significant byte
+static const uint32_t te[256] = {
+    0xa56363c6, 0x847c7cf8, 0x997777ee, 0x8d7b7bf6, 0x0df2f2ff, 0xbd6b6bd6, 0xb16f6fde, 0x54c5c591,
+    0x50303060, 0x03010102, 0xa96767ce, 0x7d2b2b56, 0x19fefee7, 0x62d7d7b5, 0xe6abab4d, 0x9a7676ec,
+    0x45caca8f, 0x9d82821f, 0x40c9c989, 0x877d7dfa, 0x15fafaef, 0xeb5959b2, 0xc947478e, 0x0bf0f0fb,
+    0xecadad41, 0x67d4d4b3, 0xfda2a25f, 0xeaafaf45, 0xbf9c9c23, 0xf7a4a453, 0x967272e4, 0x5bc0c09b,
+    0xc2b7b775, 0x1cfdfde1, 0xae93933d, 0x6a26264c, 0x5a36366c, 0x413f3f7e, 0x02f7f7f5, 0x4fcccc83,
+    0x5c343468, 0xf4a5a551, 0x34e5e5d1, 0x08f1f1f9, 0x937171e2, 0x73d8d8ab, 0x53313162, 0x3f15152a,
+    0x0c040408, 0x52c7c795, 0x65232346, 0x5ec3c39d, 0x28181830, 0xa1969637, 0x0f05050a, 0xb59a9a2f,
+    0x0907070e, 0x36121224, 0x9b80801b, 0x3de2e2df, 0x26ebebcd, 0x6927274e, 0xcdb2b27f, 0x9f7575ea,
+    0x1b090912, 0x9e83831d, 0x742c2c58, 0x2e1a1a34, 0x2d1b1b36, 0xb26e6edc, 0xee5a5ab4, 0xfba0a05b,
+    0xf65252a4, 0x4d3b3b76, 0x61d6d6b7, 0xceb3b37d, 0x7b292952, 0x3ee3e3dd, 0x712f2f5e, 0x97848413,
+    0xf55353a6, 0x68d1d1b9, 0x00000000, 0x2cededc1, 0x60202040, 0x1ffcfce3, 0xc8b1b179, 0xed5b5bb6,
+    0xbe6a6ad4, 0x46cbcb8d, 0xd9bebe67, 0x4b393972, 0xde4a4a94, 0xd44c4c98, 0xe85858b0, 0x4acfcf85,
+    0x6bd0d0bb, 0x2aefefc5, 0xe5aaaa4f, 0x16fbfbed, 0xc5434386, 0xd74d4d9a, 0x55333366, 0x94858511,
+    0xcf45458a, 0x10f9f9e9, 0x06020204, 0x817f7ffe, 0xf05050a0, 0x443c3c78, 0xba9f9f25, 0xe3a8a84b,
+    0xf35151a2, 0xfea3a35d, 0xc0404080, 0x8a8f8f05, 0xad92923f, 0xbc9d9d21, 0x48383870, 0x04f5f5f1,
+    0xdfbcbc63, 0xc1b6b677, 0x75dadaaf, 0x63212142, 0x30101020, 0x1affffe5, 0x0ef3f3fd, 0x6dd2d2bf,
+    0x4ccdcd81, 0x140c0c18, 0x35131326, 0x2fececc3, 0xe15f5fbe, 0xa2979735, 0xcc444488, 0x3917172e,
+    0x57c4c493, 0xf2a7a755, 0x827e7efc, 0x473d3d7a, 0xac6464c8, 0xe75d5dba, 0x2b191932, 0x957373e6,
+    0xa06060c0, 0x98818119, 0xd14f4f9e, 0x7fdcdca3, 0x66222244, 0x7e2a2a54, 0xab90903b, 0x8388880b,
+    0xca46468c, 0x29eeeec7, 0xd3b8b86b, 0x3c141428, 0x79dedea7, 0xe25e5ebc, 0x1d0b0b16, 0x76dbdbad,
+    0x3be0e0db, 0x56323264, 0x4e3a3a74, 0x1e0a0a14, 0xdb494992, 0x0a06060c, 0x6c242448, 0xe45c5cb8,
+    0x5dc2c29f, 0x6ed3d3bd, 0xefacac43, 0xa66262c4, 0xa8919139, 0xa4959531, 0x37e4e4d3, 0x8b7979f2,
+    0x32e7e7d5, 0x43c8c88b, 0x5937376e, 0xb76d6dda, 0x8c8d8d01, 0x64d5d5b1, 0xd24e4e9c, 0xe0a9a949,
+    0xb46c6cd8, 0xfa5656ac, 0x07f4f4f3, 0x25eaeacf, 0xaf6565ca, 0x8e7a7af4, 0xe9aeae47, 0x18080810,
+    0xd5baba6f, 0x887878f0, 0x6f25254a, 0x722e2e5c, 0x241c1c38, 0xf1a6a657, 0xc7b4b473, 0x51c6c697,
+    0x23e8e8cb, 0x7cdddda1, 0x9c7474e8, 0x211f1f3e, 0xdd4b4b96, 0xdcbdbd61, 0x868b8b0d, 0x858a8a0f,
+    0x907070e0, 0x423e3e7c, 0xc4b5b571, 0xaa6666cc, 0xd8484890, 0x05030306, 0x01f6f6f7, 0x120e0e1c,
+    0xa36161c2, 0x5f35356a, 0xf95757ae, 0xd0b9b969, 0x91868617, 0x58c1c199, 0x271d1d3a, 0xb99e9e27,
+    0x38e1e1d9, 0x13f8f8eb, 0xb398982b, 0x33111122, 0xbb6969d2, 0x70d9d9a9, 0x898e8e07, 0xa7949433,
+    0xb69b9b2d, 0x221e1e3c, 0x92878715, 0x20e9e9c9, 0x49cece87, 0xff5555aa, 0x78282850, 0x7adfdfa5,
+    0x8f8c8c03, 0xf8a1a159, 0x80898909, 0x170d0d1a, 0xdabfbf65, 0x31e6e6d7, 0xc6424284, 0xb86868d0,
+    0xc3414182, 0xb0999929, 0x772d2d5a, 0x110f0f1e, 0xcbb0b07b, 0xfc5454a8, 0xd6bbbb6d, 0x3a16162c
+};
+
+static inline uint32_t rotl32(uint32_t x, uint32_t n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static inline uint32_t load32(const uint8_t *src)
+{
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
 
-typedef union state_t {
-    uint8_t s[4][4];
-} state_t;
+static inline void store32(uint8_t *dst, uint32_t src)
+{
+    dst[0] = (uint8_t)(src >> 0);
+    dst[1] = (uint8_t)(src >> 8);
+    dst[2] = (uint8_t)(src >> 16);
+    dst[3] = (uint8_t)(src >> 24);
+}
 
-// Precalculated lookup table instead of recursive polynomial multiplication
-static uint8_t gfmul(uint8_t x, uint8_t y)
+// Byte `row` of column word `w`
+static inline uint8_t byte(uint32_t w, uint32_t row)
 {
-    static const uint8_t mask[8] = { 0x00, 0x1b, 0x36, 0x2d, 0x6c, 0x77, 0x5a, 0x41 };
-    uint16_t r = (x * (y & 0x1)) ^ (x * (y & 0x2)) ^ (x * (y & 0x4)) ^ (x * (y & 0x8));
-    return (uint8_t)(r ^ mask[r >> 8]);
+    return (uint8_t)(w >> (8 * row));
 }
 
 static void xor128(uint8_t *a, const uint8_t *b)
@@ -36,81 +107,59 @@ static void xor128(uint8_t *a, const uint8_t *b)
     }
 }
 
-// Performs a substitution non-linear substitution table used to perform one-to-one byte substitutions
-static uint8_t sbox_lookup(uint8_t index, bool invert)
-{
-    static const uint8_t sbox[256] = {
-        0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
-        0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
-        0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
-        0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
-        0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
-        0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
-        0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
-        0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
-        0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
-        0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
-        0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
-        0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
-        0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
-        0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
-        0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
-        0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
-    };
+static inline uint32_t sub_word(uint32_t w)
+{
+    return (uint32_t)sbox[byte(w, 0)] |
+           (uint32_t)sbox[byte(w, 1)] << 8 |
+           (uint32_t)sbox[byte(w, 2)] << 16 |
+           (uint32_t)sbox[byte(w, 3)] << 24;
+}
 
-    static const uint8_t rsbox[256] = {
-        0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
-        0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
-        0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
-        0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
-        0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
-        0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
-        0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
-        0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
-        0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
-        0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
-        0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
-        0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
-        0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
-        0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
-        0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
-        0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
-    };
+// Multiply each byte of `w` by x in GF(2^8)
+static inline uint32_t xtime32(uint32_t w)
+{
+    return ((w & 0x7f7f7f7f) << 1) ^ (((w >> 7) & 0x01010101) * 0x1b);
+}
 
-    return invert ? rsbox[index] : sbox[index];
+// InvMixColumns of a single column, as MixColumns(w ^ xtime(xtime(w ^ rotl(w, 16))))
+static inline uint32_t inv_mix_column(uint32_t w)
+{
+    w ^= xtime32(xtime32(w ^ rotl32(w, 16)));
+    const uint32_t sum = w ^ rotl32(w, 8) ^ rotl32(w, 16) ^ rotl32(w, 24);
+    return w ^ sum ^ xtime32(w ^ rotl32(w, 24));
 }
 
 // Generate a key schedule using the cipher key
-static void aes_key_expansion(uint8_t *round_key, const uint8_t *key)
+static void aes_key_expansion(uint32_t *round_key, const uint8_t *key)
 {
     static const uint8_t round_constants[11] = { 0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
 
     // First round key
-    memcpy(round_key, key, AES_KEY_LEN);
+    for (size_t i = 0; i < AES_WORD_COUNT; i++) {
+        round_key[i] = load32(&key[4 * i]);
+    }
 
-    uint8_t word[4];
     for (size_t i = AES_WORD_COUNT; i < (4 * (AES_ROUNDS + 1)); i++) {
-        for (size_t j = 0; j < 4; j++) {
-            word[j] = round_key[4 * (i - 1) + j];
-        }
+        uint32_t word = round_key[i - 1];
 
         // Rotate and substitute
         if (!(i % AES_WORD_COUNT)) {
-            const uint8_t _word = word[0];
-            word[0] = word[1];
-            word[1] = word[2];
-            word[2] = word[3];
-            word[3] = _word;
-
-            for (size_t j = 0; j < 4; j++) {
-                word[j] = sbox_lookup(word[j], false);
-            }
-
-            word[0] ^= round_constants[i / 4];
+            word = sub_word(rotl32(word, 24)) ^ round_constants[i / 4];
         }
 
-        for (size_t j = 0; j < 4; j++) {
-            round_key[(4 * i) + j] = round_key[(4 * (i - AES_WORD_COUNT)) + j] ^ word[j];
+        round_key[i] = round_key[i - AES_WORD_COUNT] ^ word;
+    }
+}
+
+// Key schedule for the equivalent inverse cipher (5.3.5): round keys in reverse order
+// with InvMixColumns applied to all but the first and last
+static void aes_inv_key_expansion(uint32_t *inv_round_key, const uint32_t *round_key)
+{
+    for (size_t round = 0; round <= AES_ROUNDS; round++) {
+        for (size_t i = 0; i < AES_WORD_COUNT; i++) {
+            const uint32_t word = round_key[AES_WORD_COUNT * (AES_ROUNDS - round) + i];
+            const bool outer = !round || round == AES_ROUNDS;
+            inv_round_key[AES_WORD_COUNT * round + i] = outer ? word : inv_mix_column(word);
         }
     }
 }
@@ -129,148 +178,300 @@ static void aes_generate_subkey(uint8_t *key)
     }
 }
 
-// XOR a Round Key into the state
-static void aes_add_round_key(state_t *ctx, uint8_t round, const uint8_t *round_key)
+// One round of SubBytes, ShiftRows, MixColumns, and AddRoundKey
+// Column j of the output takes row r from column j + r of the input
+static inline uint32_t te_column(const uint32_t *s, size_t j, uint32_t round_key)
 {
-    for (size_t i = 0; i < 4; i++) {
-        for (size_t j = 0; j < 4; j++) {
-            ctx->s[i][j] ^= round_key[(AES_BLOCK_SIZE * round) + (4 * i) + j];
-        }
+    return te[byte(s[j], 0)] ^
+           rotl32(te[byte(s[(j + 1) & 3], 1)], 8) ^
+           rotl32(te[byte(s[(j + 2) & 3], 2)], 16) ^
+           rotl32(te[byte(s[(j + 3) & 3], 3)], 24) ^
+           round_key;
+}
+
+static inline uint32_t sbox_column(const uint32_t *s, size_t j, uint32_t round_key)
+{
+    return ((uint32_t)sbox[byte(s[j], 0)] |
+            (uint32_t)sbox[byte(s[(j + 1) & 3], 1)] << 8 |
+            (uint32_t)sbox[byte(s[(j + 2) & 3], 2)] << 16 |
+            (uint32_t)sbox[byte(s[(j + 3) & 3], 3)] << 24) ^
+           round_key;
+}
+
+// Encrypt a single block in-place
+static void aes_encrypt_block(const uint32_t *round_key, uint8_t *block)
+{
+    uint32_t s[4] = {
+        load32(&block[0x0]) ^ round_key[0],
+        load32(&block[0x4]) ^ round_key[1],
+        load32(&block[0x8]) ^ round_key[2],
+        load32(&block[0xc]) ^ round_key[3],
+    };
+
+    for (size_t round = 1; round < AES_ROUNDS; round++) {
+        round_key += AES_WORD_COUNT;
+        const uint32_t t[4] = {
+            te_column(s, 0, round_key[0]),
+            te_column(s, 1, round_key[1]),
+            te_column(s, 2, round_key[2]),
+            te_column(s, 3, round_key[3]),
+        };
+        memcpy(s, t, sizeof(s));
     }
+
+    // Final round omits MixColumns
+    round_key += AES_WORD_COUNT;
+    const uint32_t t[4] = {
+        sbox_column(s, 0, round_key[0]),
+        sbox_column(s, 1, round_key[1]),
+        sbox_column(s, 2, round_key[2]),
+        sbox_column(s, 3, round_key[3]),
+    };
+    store32(&block[0x0], t[0]);
+    store32(&block[0x4], t[1]);
+    store32(&block[0x8], t[2]);
+    store32(&block[0xc], t[3]);
 }
 
-// Substitute bytes in the state using sbox / rsbox
-static void aes_substitute_bytes(state_t *ctx, bool invert)
+// Portable kernels
+
+static void portable_encrypt_cbc(const uint32_t *round_key, uint8_t *iv, uint8_t *chunk, size_t blocks)
 {
-    for (size_t i = 0; i < 4; i++) {
-        for (size_t j = 0; j < 4; j++) {
-            ctx->s[j][i] = sbox_lookup(ctx->s[j][i], invert);
-        }
+    const uint8_t *prev = iv;
+    for (size_t i = 0; i < blocks; i++) {
+        xor128(chunk, prev);
+        aes_encrypt_block(round_key, chunk);
+        prev = chunk;
+        chunk += AES_BLOCK_SIZE;
+    }
+    if (blocks) {
+        memcpy(iv, prev, AES_BLOCK_SIZE);
     }
 }
 
-// Cyclically shift the last three rows of the State with different offsets
-static void aes_shift_rows(state_t *ctx, bool invert)
+// Decrypt up to 8 blocks with the bitsliced cipher, unused lanes running on scratch blocks
+// `prev` holds the IV on entry and the last ciphertext block on return
+static void bs_decrypt_cbc(const aes128_bitsliced_t *bs, uint8_t *prev, uint8_t *chunk, size_t blocks)
 {
-    uint8_t *r1map = invert ? (uint8_t[]) { 3, 2, 1, 0 } : (uint8_t[]) { 0, 1, 2, 3 };
-    uint8_t *r3map = invert ? (uint8_t[]) { 0, 3, 2, 1 } : (uint8_t[]) { 0, 1, 2, 3 };
+    uint8_t ciphertext[AES_BLOCK_SIZE * 9];
+    uint8_t scratch[AES_BLOCK_SIZE * 8];
+    uint8_t *lanes[8];
+    for (size_t i = 0; i < 8; i++) {
+        lanes[i] = i < blocks ? &chunk[AES_BLOCK_SIZE * i] : &scratch[AES_BLOCK_SIZE * i];
+    }
 
-    // Cycle the first row 1 column to the left or right
-    uint8_t s = ctx->s[r1map[0]][1];
-    ctx->s[r1map[0]][1] = ctx->s[r1map[1]][1];
-    ctx->s[r1map[1]][1] = ctx->s[r1map[2]][1];
-    ctx->s[r1map[2]][1] = ctx->s[r1map[3]][1];
-    ctx->s[r1map[3]][1] = s;
+    memcpy(ciphertext, prev, AES_BLOCK_SIZE);
+    memcpy(&ciphertext[AES_BLOCK_SIZE], chunk, AES_BLOCK_SIZE * blocks);
+    aes128_bs_decrypt(bs, lanes);
+    for (size_t i = 0; i < blocks; i++) {
+        xor128(&chunk[AES_BLOCK_SIZE * i], &ciphertext[AES_BLOCK_SIZE * i]);
+    }
+    memcpy(prev, &ciphertext[AES_BLOCK_SIZE * blocks], AES_BLOCK_SIZE);
+}
 
-    // Cycle the second row 2 columns
-    s = ctx->s[0][2];
-    ctx->s[0][2] = ctx->s[2][2];
-    ctx->s[2][2] = s;
+// CBC decryption has no dependency between blocks, so they are decrypted 8 at a time
+// by the bitsliced cipher, which also keeps the key and plaintext off the cache lines
+static void portable_decrypt_cbc(const uint32_t *inv_round_key, uint8_t *iv, uint8_t *chunk, size_t blocks)
+{
+    aes128_bitsliced_t bs;
+    aes128_bs_init(&bs, inv_round_key);
+
+    while (blocks) {
+        const size_t group = blocks < 8 ? blocks : 8;
+        bs_decrypt_cbc(&bs, iv, chunk, group);
+        chunk += AES_BLOCK_SIZE * group;
+        blocks -= group;
+    }
+}
 
-    s = ctx->s[1][2];
-    ctx->s[1][2] = ctx->s[3][2];
-    ctx->s[3][2] = s;
+static void portable_cbc_mac(const uint32_t *round_key, uint8_t *state, const uint8_t *msg, size_t blocks)
+{
+    for (size_t i = 0; i < blocks; i++) {
+        xor128(state, msg);
+        aes_encrypt_block(round_key, state);
+        msg += AES_BLOCK_SIZE;
+    }
+}
 
-    // Cycle the third row 3 columns to the left or right
-    s = ctx->s[0][3];
-    ctx->s[r3map[0]][3] = ctx->s[r3map[3]][3];
-    ctx->s[r3map[3]][3] = ctx->s[r3map[2]][3];
-    ctx->s[r3map[2]][3] = ctx->s[r3map[1]][3];
-    ctx->s[r3map[1]][3] = s;
+static void portable_encrypt_cbc_mac(const uint32_t *round_key, uint8_t *iv, const uint32_t *mac_key, uint8_t *state, uint8_t *chunk, size_t blocks)
+{
+    const uint8_t *prev = iv;
+    for (size_t i = 0; i < blocks; i++) {
+        xor128(chunk, prev);
+        aes_encrypt_block(round_key, chunk);
+
+        // MAC the fresh ciphertext block before moving on, holding back the last one
+        if (i + 1 < blocks) {
+            portable_cbc_mac(mac_key, state, chunk, 1);
+        }
+        prev = chunk;
+        chunk += AES_BLOCK_SIZE;
+    }
+    if (blocks) {
+        memcpy(iv, prev, AES_BLOCK_SIZE);
+    }
 }
 
-// Mix the contents of the state's columns to produce new columns
-// s`(x) = a(x) ⊗ s(x)
-static void aes_mix_columns(state_t *ctx, bool invert)
+static void portable_decrypt_cbc_mac(const uint32_t *inv_round_key, uint8_t *iv, const uint32_t *mac_key, uint8_t *state, uint8_t *chunk, size_t blocks)
 {
-    if (invert) {
-        for (size_t i = 0; i < 4; i++) {
-            uint8_t s[4] = { ctx->s[i][0], ctx->s[i][1], ctx->s[i][2], ctx->s[i][3] };
+    aes128_bitsliced_t bs;
+    aes128_bs_init(&bs, inv_round_key);
+
+    while (blocks) {
+        const size_t group = blocks < 8 ? blocks : 8;
 
-            ctx->s[i][0] = gfmul(s[0], 0xe) ^ gfmul(s[1], 0xb) ^ gfmul(s[2], 0xd) ^ gfmul(s[3], 0x9);
-            ctx->s[i][1] = gfmul(s[0], 0x9) ^ gfmul(s[1], 0xe) ^ gfmul(s[2], 0xb) ^ gfmul(s[3], 0xd);
-            ctx->s[i][2] = gfmul(s[0], 0xd) ^ gfmul(s[1], 0x9) ^ gfmul(s[2], 0xe) ^ gfmul(s[3], 0xb);
-            ctx->s[i][3] = gfmul(s[0], 0xb) ^ gfmul(s[1], 0xd) ^ gfmul(s[2], 0x9) ^ gfmul(s[3], 0xe);
+        // MAC the ciphertext blocks before they get overwritten, holding back the last one
+        portable_cbc_mac(mac_key, state, chunk, group == blocks ? group - 1 : group);
+        bs_decrypt_cbc(&bs, iv, chunk, group);
+        chunk += AES_BLOCK_SIZE * group;
+        blocks -= group;
+    }
+}
+
+// Bitsliced lanes 0 - 3 encrypt block i of each stream while lanes 4 - 7 MAC its ciphertext block i - 1
+static void portable_encrypt_cbc_mac_lanes(aes128_lane_t *lanes, size_t count)
+{
+    const uint32_t *round_keys[2 * AES_LANES];
+    size_t steps = 0;
+    for (size_t i = 0; i < AES_LANES; i++) {
+        const aes128_lane_t *lane = &lanes[i < count ? i : 0];
+        round_keys[i] = lane->round_key;
+        round_keys[AES_LANES + i] = lane->mac_key;
+        if (i < count && lane->blocks > steps) {
+            steps = lane->blocks;
         }
     }
-    else {
-        for (size_t i = 0; i < 4; i++) {
-            uint8_t s = ctx->s[i][0] ^ ctx->s[i][1] ^ ctx->s[i][2] ^ ctx->s[i][3];
-            uint8_t c0 = ctx->s[i][0];
-
-            for (size_t j = 0; j < 4; j++) {
-                // XOR s[i][3] with the previous s[i][0]
-                uint8_t c = ctx->s[i][j] ^ ((j == 3) ? c0 : ctx->s[i][j + 1]);
-                c = (uint8_t)(c << 1U) ^ (((c >> 7) & 1) * 0x1b);
-                ctx->s[i][j] ^= c ^ s;
+
+    aes128_bitsliced_t bs;
+    aes128_bs_init_lanes(&bs, round_keys);
+
+    uint8_t scratch[2 * AES_LANES][AES_BLOCK_SIZE];
+    for (size_t step = 0; step < steps; step++) {
+        uint8_t *blocks[2 * AES_LANES];
+        for (size_t i = 0; i < AES_LANES; i++) {
+            blocks[i] = scratch[i];
+            blocks[AES_LANES + i] = scratch[AES_LANES + i];
+            if (i >= count || step >= lanes[i].blocks) {
+                continue;
+            }
+
+            // `iv` holds the previous ciphertext block of the stream
+            aes128_lane_t *lane = &lanes[i];
+            blocks[i] = &lane->chunk[AES_BLOCK_SIZE * step];
+            xor128(blocks[i], lane->iv);
+            if (step) {
+                xor128(lane->state, lane->iv);
+                blocks[AES_LANES + i] = lane->state;
+            }
+        }
+
+        aes128_bs_encrypt(&bs, blocks);
+        for (size_t i = 0; i < count; i++) {
+            if (step < lanes[i].blocks) {
+                memcpy(lanes[i].iv, blocks[i], AES_BLOCK_SIZE);
             }
         }
     }
 }
 
-// Main cipher function
-static void aes_xcrypt(state_t *state, const uint8_t *round_key, bool decrypt)
+static const aes128_backend_t portable = {
+    .name = "portable",
+    .encrypt_block = aes_encrypt_block,
+    .encrypt_cbc = portable_encrypt_cbc,
+    .decrypt_cbc = portable_decrypt_cbc,
+    .cbc_mac = portable_cbc_mac,
+    .encrypt_cbc_mac = portable_encrypt_cbc_mac,
+    .decrypt_cbc_mac = portable_decrypt_cbc_mac,
+    .encrypt_cbc_mac_lanes = portable_encrypt_cbc_mac_lanes,
+};
+
+static const aes128_backend_t *backend = &portable;
+
+// Pick the fastest backend supported by the host
+__attribute__((constructor))
+static void aes_select_backend(void)
 {
-    if (decrypt) {
-        aes_add_round_key(state, AES_ROUNDS, round_key);
-        for (size_t i = 0;; i++) {
-            aes_shift_rows(state, true);
-            aes_substitute_bytes(state, true);
-            aes_add_round_key(state, AES_ROUNDS - 1 - i, round_key);
-            if (i == AES_ROUNDS - 1) {
-                break;
-            }
-            aes_mix_columns(state, true);
-        }
+    const aes128_backend_t *ni = aes128_ni_backend();
+    if (ni) {
+        backend = ni;
     }
-    else {
-        aes_add_round_key(state, 0, round_key);
-        for (size_t i = 1;; i++) {
-            aes_substitute_bytes(state, false);
-            aes_shift_rows(state, false);
-            if (i == AES_ROUNDS) {
-                break;
-            }
-            aes_mix_columns(state, false);
-            aes_add_round_key(state, i, round_key);
-        }
-        aes_add_round_key(state, AES_ROUNDS, round_key);
+}
+
+// Number of blocks needed to cover `length` bytes
+static inline size_t aes_blocks(size_t length)
+{
+    return (length + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+}
+
+// Absorb the held-back block once more data is known to follow it
+static void aes_cmac_flush(aes128_cmac_t *cmac)
+{
+    if (cmac->block_bytes == AES_BLOCK_SIZE) {
+        backend->cbc_mac(cmac->ctx->round_key, cmac->state, cmac->block, 1);
+        cmac->block_bytes = 0;
     }
 }
 
-void aes128_cmac(const aes128_t *ctx, const uint8_t *msg, size_t length, uint8_t *mac)
+void aes128_cmac_init(aes128_cmac_t *cmac, const aes128_t *ctx)
 {
+    memset(cmac, 0, sizeof(*cmac));
+    cmac->ctx = ctx;
+
     // Subkey generation (pg 5 RFC 4493)
-    uint8_t L[AES_BLOCK_SIZE] = { 0 }; // Output of AES(0)
-    aes_xcrypt((state_t *)L, ctx->round_key, false);
-    aes_generate_subkey(L);
+    backend->encrypt_block(ctx->round_key, cmac->subkey);
+    aes_generate_subkey(cmac->subkey);
+}
 
-    // MAC generation (pg 7 RFC 4493)
-    uint8_t block[AES_BLOCK_SIZE] = { 0 };
-    for (; length; length -= AES_BLOCK_SIZE) {
-        if (length < AES_BLOCK_SIZE) {
-            aes_generate_subkey(L);
-            L[length] ^= AES_KEY_BITS;
-        }
-        if (length <= AES_BLOCK_SIZE) {
-            for (size_t i = 0; i < length; i++) {
-                L[i] ^= msg[i];
-            }
-            length = AES_BLOCK_SIZE;
-            msg = L;
+void aes128_cmac_append(aes128_cmac_t *cmac, const uint8_t *msg, size_t length)
+{
+    while (length) {
+        aes_cmac_flush(cmac);
+
+        // Whole blocks followed by more data skip the holding buffer
+        if (!cmac->block_bytes && length > AES_BLOCK_SIZE) {
+            const size_t blocks = (length - 1) / AES_BLOCK_SIZE;
+            backend->cbc_mac(cmac->ctx->round_key, cmac->state, msg, blocks);
+            msg += blocks * AES_BLOCK_SIZE;
+            length -= blocks * AES_BLOCK_SIZE;
+            continue;
         }
 
-        xor128(block, msg);
-        aes_xcrypt((state_t *)block, ctx->round_key, false);
-        msg += AES_BLOCK_SIZE;
+        const size_t space = AES_BLOCK_SIZE - cmac->block_bytes;
+        const size_t bytes = length < space ? length : space;
+        memcpy(&cmac->block[cmac->block_bytes], msg, bytes);
+        cmac->block_bytes += bytes;
+        msg += bytes;
+        length -= bytes;
     }
-    memcpy(mac, block, AES_BLOCK_SIZE);
+}
+
+void aes128_cmac_finish(aes128_cmac_t *cmac, uint8_t *mac)
+{
+    // MAC generation (pg 7 RFC 4493)
+    if (cmac->block_bytes < AES_BLOCK_SIZE) {
+        aes_generate_subkey(cmac->subkey);
+        memset(&cmac->block[cmac->block_bytes], 0, AES_BLOCK_SIZE - cmac->block_bytes);
+        cmac->block[cmac->block_bytes] = 0x80;
+    }
+
+    xor128(cmac->block, cmac->subkey);
+    backend->cbc_mac(cmac->ctx->round_key, cmac->state, cmac->block, 1);
+    memcpy(mac, cmac->state, AES_BLOCK_SIZE);
+}
+
+void aes128_cmac(const aes128_t *ctx, const uint8_t *msg, size_t length, uint8_t *mac)
+{
+    aes128_cmac_t cmac;
+    aes128_cmac_init(&cmac, ctx);
+    aes128_cmac_append(&cmac, msg, length);
+    aes128_cmac_finish(&cmac, mac);
 }
 
 void aes128_init(aes128_t *ctx, const uint8_t *iv, const uint8_t *key)
 {
     memset(ctx, 0, sizeof(*ctx));
     aes_key_expansion(ctx->round_key, key);
+    aes_inv_key_expansion(ctx->inv_round_key, ctx->round_key);
     memcpy(ctx->iv, iv, AES_BLOCK_SIZE);
 }
 
@@ -282,24 +483,99 @@ void aes128_init_cmac(aes128_t *ctx, const uint8_t *key)
 
 void aes128_encrypt(aes128_t *ctx, uint8_t *chunk, size_t length)
 {
-    uint8_t *iv = ctx->iv;
-    for (size_t i = 0; i < length; i += AES_BLOCK_SIZE) {
-        xor128(chunk, iv);
-        aes_xcrypt((state_t *)chunk, ctx->round_key, false);
-        iv = chunk;
-        chunk += AES_BLOCK_SIZE;
-    }
-    memcpy(ctx->iv, iv, AES_BLOCK_SIZE);
+    backend->encrypt_cbc(ctx->round_key, ctx->iv, chunk, aes_blocks(length));
 }
 
 void aes128_decrypt(aes128_t *ctx, uint8_t *chunk, size_t length)
 {
-    uint8_t iv[AES_BLOCK_SIZE];
-    for (size_t i = 0; i < length; i += AES_BLOCK_SIZE) {
-        memcpy(iv, chunk, AES_BLOCK_SIZE);
-        aes_xcrypt((state_t *)chunk, ctx->round_key, true);
-        xor128(chunk, ctx->iv);
-        memcpy(ctx->iv, iv, AES_BLOCK_SIZE);
-        chunk += AES_BLOCK_SIZE;
+    backend->decrypt_cbc(ctx->inv_round_key, ctx->iv, chunk, aes_blocks(length));
+}
+
+void aes128_encrypt_cmac(aes128_t *ctx, aes128_cmac_t *cmac, uint8_t *chunk, size_t length)
+{
+    if (!length) {
+        return;
+    }
+
+    // Fusing requires the CMAC stream to be block-aligned
+    if (cmac->block_bytes % AES_BLOCK_SIZE) {
+        aes128_encrypt(ctx, chunk, length);
+        aes128_cmac_append(cmac, chunk, length);
+        return;
+    }
+
+    aes_cmac_flush(cmac);
+    backend->encrypt_cbc_mac(ctx->round_key, ctx->iv, cmac->ctx->round_key, cmac->state, chunk, aes_blocks(length));
+
+    // The last ciphertext block is now the IV
+    memcpy(cmac->block, ctx->iv, AES_BLOCK_SIZE);
+    cmac->block_bytes = AES_BLOCK_SIZE;
+}
+
+void aes128_decrypt_cmac(aes128_t *ctx, aes128_cmac_t *cmac, uint8_t *chunk, size_t length)
+{
+    if (!length) {
+        return;
+    }
+
+    if (cmac->block_bytes % AES_BLOCK_SIZE) {
+        aes128_cmac_append(cmac, chunk, length);
+        aes128_decrypt(ctx, chunk, length);
+        return;
+    }
+
+    aes_cmac_flush(cmac);
+
+    // Hold back the last ciphertext block before it gets overwritten
+    const size_t blocks = aes_blocks(length);
+    memcpy(cmac->block, &chunk[AES_BLOCK_SIZE * (blocks - 1)], AES_BLOCK_SIZE);
+    cmac->block_bytes = AES_BLOCK_SIZE;
+
+    backend->decrypt_cbc_mac(ctx->inv_round_key, ctx->iv, cmac->ctx->round_key, cmac->state, chunk, blocks);
+}
+
+// Run the queued lanes, leaving each CMAC holding its last ciphertext block like aes128_encrypt_cmac()
+static void aes_flush_lanes(aes128_lane_t *lanes, aes128_cmac_t *const *cmacs, size_t count)
+{
+    backend->encrypt_cbc_mac_lanes(lanes, count);
+    for (size_t i = 0; i < count; i++) {
+        memcpy(cmacs[i]->block, lanes[i].iv, AES_BLOCK_SIZE);
+        cmacs[i]->block_bytes = AES_BLOCK_SIZE;
+    }
+}
+
+void aes128_encrypt_cmac_lanes(aes128_t *const *ctxs, aes128_cmac_t *const *cmacs, uint8_t *const *chunks, const size_t *lengths, size_t count)
+{
+    aes128_lane_t lanes[AES_LANES];
+    aes128_cmac_t *lane_cmacs[AES_LANES];
+    size_t lane_count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        // Streams that cannot be fused go through the single-stream path
+        if (!lengths[i] || cmacs[i]->block_bytes % AES_BLOCK_SIZE) {
+            aes128_encrypt_cmac(ctxs[i], cmacs[i], chunks[i], lengths[i]);
+            continue;
+        }
+
+        aes_cmac_flush(cmacs[i]);
+        lane_cmacs[lane_count] = cmacs[i];
+        lanes[lane_count++] = (aes128_lane_t) {
+            .round_key = ctxs[i]->round_key,
+            .mac_key = cmacs[i]->ctx->round_key,
+            .iv = ctxs[i]->iv,
+            .state = cmacs[i]->state,
+            .chunk = chunks[i],
+            .blocks = aes_blocks(lengths[i]),
+        };
+
+        if (lane_count == AES_LANES) {
+            aes_flush_lanes(lanes, lane_cmacs, lane_count);
+            lane_count = 0;
+        }
+    }
+
+    // Whatever is left over, even if the last streams took the single-stream path
+    if (lane_count) {
+        aes_flush_lanes(lanes, lane_cmacs, lane_count);
     }
 }
@@ -23,13 +23,36 @@ enum AES128 {
     AES_KEY_LEN = 16,
     CMAC_KEY_LEN = 16,
     AES_KEY_BITS = 8 * AES_KEY_LEN,
+    AES_LANES = 4, // Independent streams processed side by side
 };
 
+// Round keys are stored one column per word, row 0 in the least-significant byte
 typedef struct aes128_t {
-    uint8_t round_key[AES_BLOCK_SIZE * (AES_ROUNDS + 1)];
+    uint32_t round_key[AES_WORD_COUNT * (AES_ROUNDS + 1)];
+    uint32_t inv_round_key[AES_WORD_COUNT * (AES_ROUNDS + 1)]; // Equivalent inverse cipher, unused for CMAC
     uint8_t iv[AES_BLOCK_SIZE];
 } aes128_t;
 
+typedef struct aes128_cmac_t {
+    const aes128_t *ctx;             // CMAC-specific aes128 instance
+    uint8_t state[AES_BLOCK_SIZE];   // Running CBC-MAC value
+    uint8_t subkey[AES_BLOCK_SIZE];  // L, the cipher output for the zero block
+    uint8_t block[AES_BLOCK_SIZE];   // Last block seen, held back until more data arrives
+    size_t block_bytes;
+} aes128_cmac_t;
+
+typedef struct aes128_gcm_t {
+    const aes128_t *ctx;              // aes128 instance from aes128_init_cmac()
+    uint8_t h[AES_BLOCK_SIZE];        // Hash subkey, the cipher output for the zero block
+    uint8_t j0[AES_BLOCK_SIZE];       // Pre-counter block, masks the tag
+    uint8_t counter[AES_BLOCK_SIZE];  // Next keystream counter block
+    uint8_t state[AES_BLOCK_SIZE];    // Running GHASH value
+    uint8_t block[AES_BLOCK_SIZE];    // Partial ciphertext block, held until more data arrives
+    size_t block_bytes;
+    uint64_t aad_bytes;
+    uint64_t text_bytes;
+} aes128_gcm_t;
+
 /**
  * @brief Initiate a new aes128_t context for encryption / decryption
  *
@@ -40,7 +63,7 @@ typedef struct aes128_t {
 void aes128_init(aes128_t *ctx, const uint8_t *iv, const uint8_t *key);
 
 /**
- * @brief Initiate a new aes128_t context for CMAC
+ * @brief Initiate a new aes128_t context for CMAC or GCM, expanding only the forward key schedule
  *
  * @param[inout] ctx aes128 instance
  * @param[in] key 128-bit key
@@ -74,3 +97,137 @@ void aes128_decrypt(aes128_t *ctx, uint8_t *chunk, size_t length);
  * @param[out] mac 16-byte generated tag
  */
 void aes128_cmac(const aes128_t *ctx, const uint8_t *msg, size_t length, uint8_t *mac);
+
+/**
+ * @brief Begin an incremental CMAC computation
+ *
+ * @param[out] cmac streaming CMAC instance
+ * @param[in] ctx CMAC-specific aes128 instance, must outlive `cmac`
+ */
+void aes128_cmac_init(aes128_cmac_t *cmac, const aes128_t *ctx);
+
+/**
+ * @brief Append message bytes to an incremental CMAC
+ *
+ * @param[inout] cmac streaming CMAC instance
+ * @param[in] msg pointer to the next portion of the message
+ * @param[in] length number of bytes to process
+ */
+void aes128_cmac_append(aes128_cmac_t *cmac, const uint8_t *msg, size_t length);
+
+/**
+ * @brief Finish an incremental CMAC and output the tag
+ *
+ * @param[inout] cmac streaming CMAC instance
+ * @param[out] mac 16-byte generated tag
+ */
+void aes128_cmac_finish(aes128_cmac_t *cmac, uint8_t *mac);
+
+/**
+ * @brief Encrypt contents in-place, appending each ciphertext block to `cmac` as it is produced
+ *
+ * @param[inout] ctx aes128 instance
+ * @param[inout] cmac streaming CMAC instance
+ * @param[inout] chunk pointer to plaintext/ciphertext
+ * @param[in] length number of bytes to encrypt
+ */
+void aes128_encrypt_cmac(aes128_t *ctx, aes128_cmac_t *cmac, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Decrypt contents in-place, appending each ciphertext block to `cmac` before it is consumed
+ *
+ * @param[inout] ctx aes128 instance
+ * @param[inout] cmac streaming CMAC instance
+ * @param[inout] chunk pointer to ciphertext/plaintext
+ * @param[in] length number of bytes to decrypt
+ */
+void aes128_decrypt_cmac(aes128_t *ctx, aes128_cmac_t *cmac, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Encrypt and CMAC independent streams side by side, equivalent to calling
+ * aes128_encrypt_cmac() on each stream in turn
+ *
+ * @param[inout] ctxs aes128 instances, one per stream
+ * @param[inout] cmacs streaming CMAC instances, one per stream
+ * @param[inout] chunks pointers to plaintext/ciphertext, one per stream
+ * @param[in] lengths number of bytes to encrypt, one per stream
+ * @param[in] count number of streams
+ */
+void aes128_encrypt_cmac_lanes(aes128_t *const *ctxs, aes128_cmac_t *const *cmacs, uint8_t *const *chunks, const size_t *lengths, size_t count);
+
+/**
+ * @brief Check whether GCM runs on dedicated instructions rather than the portable kernels
+ *
+ * @return true if GCM uses AES-NI and PCLMULQDQ
+ */
+bool aes128_gcm_accelerated(void);
+
+/**
+ * @brief Begin a GCM (NIST SP 800-38D) computation
+ *
+ * @param[out] gcm GCM instance
+ * @param[in] ctx aes128 instance from aes128_init_cmac(), must outlive `gcm`
+ * @param[in] j0 16-byte pre-counter block, IV || 0x00000001 for a 96-bit IV
+ */
+void aes128_gcm_init(aes128_gcm_t *gcm, const aes128_t *ctx, const uint8_t *j0);
+
+/**
+ * @brief Authenticate additional data. All additional data must be passed in a single call before any ciphertext
+ *
+ * @param[inout] gcm GCM instance
+ * @param[in] aad additional authenticated data
+ * @param[in] length number of bytes to authenticate
+ */
+void aes128_gcm_aad(aes128_gcm_t *gcm, const uint8_t *aad, size_t length);
+
+/**
+ * @brief Authenticate ciphertext without decrypting it, e.g., as it arrives
+ *
+ * @param[inout] gcm GCM instance
+ * @param[in] msg pointer to the next portion of the ciphertext
+ * @param[in] length number of bytes to authenticate
+ */
+void aes128_gcm_append(aes128_gcm_t *gcm, const uint8_t *msg, size_t length);
+
+/**
+ * @brief Apply the keystream in-place without authenticating. Every call but the last must cover whole blocks
+ *
+ * @param[inout] gcm GCM instance
+ * @param[inout] chunk pointer to plaintext/ciphertext
+ * @param[in] length number of bytes to process
+ */
+void aes128_gcm_ctr(aes128_gcm_t *gcm, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Advance the keystream without applying it, e.g., to hand the next portion of a message to another thread
+ *
+ * @param[inout] gcm GCM instance
+ * @param[in] length number of bytes to skip, a multiple of the block size
+ */
+void aes128_gcm_skip(aes128_gcm_t *gcm, size_t length);
+
+/**
+ * @brief Encrypt contents in-place and authenticate the ciphertext in a single pass
+ *
+ * @param[inout] gcm GCM instance
+ * @param[inout] chunk pointer to plaintext/ciphertext
+ * @param[in] length number of bytes to encrypt
+ */
+void aes128_gcm_encrypt(aes128_gcm_t *gcm, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Authenticate the ciphertext and decrypt it in-place in a single pass
+ *
+ * @param[inout] gcm GCM instance
+ * @param[inout] chunk pointer to ciphertext/plaintext
+ * @param[in] length number of bytes to decrypt
+ */
+void aes128_gcm_decrypt(aes128_gcm_t *gcm, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Finish a GCM computation and output the tag
+ *
+ * @param[inout] gcm GCM instance
+ * @param[out] tag 16-byte authentication tag
+ */
+void aes128_gcm_finish(aes128_gcm_t *gcm, uint8_t *tag);
@@ -0,0 +1,39 @@
+/**
+ * @file chacha20-backend.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Block-level kernels implemented by each ChaCha20 backend
+ * @version 0.9.4
+ * @date 2022-02-06
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway.
+ *
+ */
+
+#pragma once
+
+#include "chacha20.h"
+
+/**
+ * @brief Multi-block kernels behind the chacha20_t API
+ */
+typedef struct chacha20_backend_t {
+    const char *name;
+
+    // XOR `blocks` blocks of keystream into `chunk`, starting from the block counter in `state`
+    // and leaving it to the caller to advance the counter
+    void (*xor_blocks)(const uint32_t *state, uint8_t *chunk, size_t blocks);
+} chacha20_backend_t;
+
+/**
+ * @brief SSE2 backend, four blocks at a time
+ *
+ * @return NULL if the host is not x86 or lacks SSE2
+ */
+const chacha20_backend_t *chacha20_sse2_backend(void);
+
+/**
+ * @brief AVX2 backend, eight blocks at a time
+ *
+ * @return NULL if the host is not x86 or lacks AVX2
+ */
+const chacha20_backend_t *chacha20_avx2_backend(void);
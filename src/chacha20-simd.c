@@ -0,0 +1,258 @@
+/**
+ * @file chacha20-simd.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief SSE2 and AVX2 backends for chacha20, selected at runtime when supported
+ * @ref https://eprint.iacr.org/2013/759.pdf
+ * @version 0.9.4
+ * @date 2022-02-06
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway.
+ *
+ */
+
+#include "chacha20-backend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+// Each kernel keeps word i of every block in lane j of vector i, running one block per lane
+// through the rounds before transposing back to consecutive blocks
+
+SSE2 static inline __m128i sse2_rotl(__m128i x, int n)
+{
+    return _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - n));
+}
+
+SSE2 static inline void sse2_quarter_round(__m128i *x, size_t a, size_t b, size_t c, size_t d)
+{
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = sse2_rotl(_mm_xor_si128(x[d], x[a]), 16);
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = sse2_rotl(_mm_xor_si128(x[b], x[c]), 12);
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = sse2_rotl(_mm_xor_si128(x[d], x[a]), 8);
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = sse2_rotl(_mm_xor_si128(x[b], x[c]), 7);
+}
+
+// Transpose words a..a+3 of four blocks so y[k] holds those words of block k
+SSE2 static inline void sse2_transpose(__m128i *y, const __m128i *x)
+{
+    const __m128i t0 = _mm_unpacklo_epi32(x[0], x[1]);
+    const __m128i t1 = _mm_unpacklo_epi32(x[2], x[3]);
+    const __m128i t2 = _mm_unpackhi_epi32(x[0], x[1]);
+    const __m128i t3 = _mm_unpackhi_epi32(x[2], x[3]);
+    y[0] = _mm_unpacklo_epi64(t0, t1);
+    y[1] = _mm_unpackhi_epi64(t0, t1);
+    y[2] = _mm_unpacklo_epi64(t2, t3);
+    y[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+SSE2 static inline void sse2_xor_store(uint8_t *chunk, __m128i keystream)
+{
+    const __m128i x = _mm_loadu_si128((const __m128i *)chunk);
+    _mm_storeu_si128((__m128i *)chunk, _mm_xor_si128(x, keystream));
+}
+
+// XOR four blocks of keystream into `chunk`
+SSE2 static void sse2_xor4(const uint32_t *state, uint32_t counter, uint8_t *chunk)
+{
+    __m128i s[16];
+    __m128i x[16];
+    #pragma GCC unroll 16
+    for (size_t i = 0; i < 16; i++) {
+        s[i] = _mm_set1_epi32((int)state[i]);
+    }
+    s[12] = _mm_add_epi32(_mm_set1_epi32((int)counter), _mm_setr_epi32(0, 1, 2, 3));
+    memcpy(x, s, sizeof(x));
+
+    for (size_t i = 0; i < 20; i += 2) {
+        sse2_quarter_round(x, 0, 4, 8, 12);
+        sse2_quarter_round(x, 1, 5, 9, 13);
+        sse2_quarter_round(x, 2, 6, 10, 14);
+        sse2_quarter_round(x, 3, 7, 11, 15);
+        sse2_quarter_round(x, 0, 5, 10, 15);
+        sse2_quarter_round(x, 1, 6, 11, 12);
+        sse2_quarter_round(x, 2, 7, 8, 13);
+        sse2_quarter_round(x, 3, 4, 9, 14);
+    }
+
+    #pragma GCC unroll 16
+    for (size_t i = 0; i < 16; i++) {
+        x[i] = _mm_add_epi32(x[i], s[i]);
+    }
+
+    #pragma GCC unroll 4
+    for (size_t g = 0; g < 4; g++) {
+        __m128i y[4];
+        sse2_transpose(y, &x[4 * g]);
+        #pragma GCC unroll 4
+        for (size_t k = 0; k < 4; k++) {
+            sse2_xor_store(&chunk[64 * k + 16 * g], y[k]);
+        }
+    }
+}
+
+SSE2 static void sse2_xor_blocks(const uint32_t *state, uint8_t *chunk, size_t blocks)
+{
+    uint32_t counter = state[12];
+    for (; blocks >= 4; blocks -= 4, counter += 4, chunk += 4 * CHACHA20_BLOCK_SIZE) {
+        sse2_xor4(state, counter, chunk);
+    }
+
+    // Finish the tail in a zeroed buffer
+    if (blocks) {
+        uint8_t keystream[4 * CHACHA20_BLOCK_SIZE] = { 0 };
+        sse2_xor4(state, counter, keystream);
+        for (size_t i = 0; i < blocks * CHACHA20_BLOCK_SIZE; i++) {
+            chunk[i] ^= keystream[i];
+        }
+    }
+}
+
+AVX2 static inline __m256i avx2_rotl(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+// Rotations by whole bytes are a single shuffle
+AVX2 static inline __m256i avx2_rotl16(__m256i x)
+{
+    const __m256i r16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                         2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    return _mm256_shuffle_epi8(x, r16);
+}
+
+AVX2 static inline __m256i avx2_rotl8(__m256i x)
+{
+    const __m256i r8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                        3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    return _mm256_shuffle_epi8(x, r8);
+}
+
+AVX2 static inline void avx2_quarter_round(__m256i *x, size_t a, size_t b, size_t c, size_t d)
+{
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = avx2_rotl16(_mm256_xor_si256(x[d], x[a]));
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = avx2_rotl(_mm256_xor_si256(x[b], x[c]), 12);
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = avx2_rotl8(_mm256_xor_si256(x[d], x[a]));
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = avx2_rotl(_mm256_xor_si256(x[b], x[c]), 7);
+}
+
+// Transpose within each 128-bit half, so y[k] holds words a..a+3 of block k low and block k + 4 high
+AVX2 static inline void avx2_transpose(__m256i *y, const __m256i *x)
+{
+    const __m256i t0 = _mm256_unpacklo_epi32(x[0], x[1]);
+    const __m256i t1 = _mm256_unpacklo_epi32(x[2], x[3]);
+    const __m256i t2 = _mm256_unpackhi_epi32(x[0], x[1]);
+    const __m256i t3 = _mm256_unpackhi_epi32(x[2], x[3]);
+    y[0] = _mm256_unpacklo_epi64(t0, t1);
+    y[1] = _mm256_unpackhi_epi64(t0, t1);
+    y[2] = _mm256_unpacklo_epi64(t2, t3);
+    y[3] = _mm256_unpackhi_epi64(t2, t3);
+}
+
+AVX2 static inline void avx2_xor_store(uint8_t *chunk, __m256i keystream)
+{
+    const __m256i x = _mm256_loadu_si256((const __m256i *)chunk);
+    _mm256_storeu_si256((__m256i *)chunk, _mm256_xor_si256(x, keystream));
+}
+
+// XOR eight blocks of keystream into `chunk`
+AVX2 static void avx2_xor8(const uint32_t *state, uint32_t counter, uint8_t *chunk)
+{
+    __m256i s[16];
+    __m256i x[16];
+    #pragma GCC unroll 16
+    for (size_t i = 0; i < 16; i++) {
+        s[i] = _mm256_set1_epi32((int)state[i]);
+    }
+    s[12] = _mm256_add_epi32(_mm256_set1_epi32((int)counter), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    memcpy(x, s, sizeof(x));
+
+    for (size_t i = 0; i < 20; i += 2) {
+        avx2_quarter_round(x, 0, 4, 8, 12);
+        avx2_quarter_round(x, 1, 5, 9, 13);
+        avx2_quarter_round(x, 2, 6, 10, 14);
+        avx2_quarter_round(x, 3, 7, 11, 15);
+        avx2_quarter_round(x, 0, 5, 10, 15);
+        avx2_quarter_round(x, 1, 6, 11, 12);
+        avx2_quarter_round(x, 2, 7, 8, 13);
+        avx2_quarter_round(x, 3, 4, 9, 14);
+    }
+
+    #pragma GCC unroll 16
+    for (size_t i = 0; i < 16; i++) {
+        x[i] = _mm256_add_epi32(x[i], s[i]);
+    }
+
+    __m256i y[4][4];
+    #pragma GCC unroll 4
+    for (size_t g = 0; g < 4; g++) {
+        avx2_transpose(y[g], &x[4 * g]);
+    }
+
+    // Words 0-7 and 8-15 of block k come from pairing the low (or high, for block k + 4) halves
+    #pragma GCC unroll 4
+    for (size_t k = 0; k < 4; k++) {
+        avx2_xor_store(&chunk[64 * k], _mm256_permute2x128_si256(y[0][k], y[1][k], 0x20));
+        avx2_xor_store(&chunk[64 * k + 32], _mm256_permute2x128_si256(y[2][k], y[3][k], 0x20));
+        avx2_xor_store(&chunk[64 * (k + 4)], _mm256_permute2x128_si256(y[0][k], y[1][k], 0x31));
+        avx2_xor_store(&chunk[64 * (k + 4) + 32], _mm256_permute2x128_si256(y[2][k], y[3][k], 0x31));
+    }
+}
+
+AVX2 static void avx2_xor_blocks(const uint32_t *state, uint8_t *chunk, size_t blocks)
+{
+    uint32_t counter = state[12];
+    for (; blocks >= 8; blocks -= 8, counter += 8, chunk += 8 * CHACHA20_BLOCK_SIZE) {
+        avx2_xor8(state, counter, chunk);
+    }
+
+    if (blocks) {
+        uint32_t tail[16];
+        memcpy(tail, state, sizeof(tail));
+        tail[12] = counter;
+        sse2_xor_blocks(tail, chunk, blocks);
+    }
+}
+
+static const chacha20_backend_t sse2 = {
+    .name = "sse2",
+    .xor_blocks = sse2_xor_blocks,
+};
+
+static const chacha20_backend_t avx2 = {
+    .name = "avx2",
+    .xor_blocks = avx2_xor_blocks,
+};
+
+const chacha20_backend_t *chacha20_sse2_backend(void)
+{
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sse2")) {
+        return NULL;
+    }
+    return &sse2;
+}
+
+const chacha20_backend_t *chacha20_avx2_backend(void)
+{
+    if (!chacha20_sse2_backend() || !__builtin_cpu_supports("avx2")) {
+        return NULL;
+    }
+    return &avx2;
+}
+
+#else
+
+const chacha20_backend_t *chacha20_sse2_backend(void)
+{
+    return NULL;
+}
+
+const chacha20_backend_t *chacha20_avx2_backend(void)
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,559 @@
+/**
+ * @file chacha20.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief ChaCha20, Poly1305, and their AEAD construction following RFC 8439
+ * @ref https://datatracker.ietf.org/doc/html/rfc8439
+ * @ref https://github.com/floodyberry/poly1305-donna
+ * @version 0.9.4
+ * @date 2022-02-06
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway.
+ *
+ */
+
+#include "chacha20.h"
+#include "chacha20-backend.h"
+
+enum ChaCha20Internal {
+    CHACHA20_ROUNDS = 20,
+    CHACHA20_COUNTER = 12,      // Index of the block counter in chacha20_t.state
+    AEAD_CHUNK_SIZE = 1024,     // Encrypt and authenticate in chunks small enough to stay in L1
+};
+
+static inline uint32_t load32_le(const uint8_t *src)
+{
+    return ((uint32_t)src[0] << 0x00) |
+           ((uint32_t)src[1] << 0x08) |
+           ((uint32_t)src[2] << 0x10) |
+           ((uint32_t)src[3] << 0x18);
+}
+
+static inline void store32_le(uint8_t *dst, uint32_t src)
+{
+    dst[0] = (uint8_t)(src >> 0x00);
+    dst[1] = (uint8_t)(src >> 0x08);
+    dst[2] = (uint8_t)(src >> 0x10);
+    dst[3] = (uint8_t)(src >> 0x18);
+}
+
+static inline uint64_t load64_le(const uint8_t *src)
+{
+    return (uint64_t)load32_le(src) | ((uint64_t)load32_le(&src[4]) << 32);
+}
+
+static inline void store64_le(uint8_t *dst, uint64_t src)
+{
+    store32_le(dst, (uint32_t)src);
+    store32_le(&dst[4], (uint32_t)(src >> 32));
+}
+
+static inline uint32_t rotl32(uint32_t x, unsigned int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static inline void quarter_round(uint32_t *x, size_t a, size_t b, size_t c, size_t d)
+{
+    x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 16);
+    x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 12);
+    x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 8);
+    x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 7);
+}
+
+// XOR a single block of keystream into `block`
+static void chacha20_block(const uint32_t *state, uint8_t *block)
+{
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+
+    for (size_t i = 0; i < CHACHA20_ROUNDS; i += 2) {
+        // Column round
+        quarter_round(x, 0, 4, 8, 12);
+        quarter_round(x, 1, 5, 9, 13);
+        quarter_round(x, 2, 6, 10, 14);
+        quarter_round(x, 3, 7, 11, 15);
+
+        // Diagonal round
+        quarter_round(x, 0, 5, 10, 15);
+        quarter_round(x, 1, 6, 11, 12);
+        quarter_round(x, 2, 7, 8, 13);
+        quarter_round(x, 3, 4, 9, 14);
+    }
+
+    #pragma GCC unroll 16
+    for (size_t i = 0; i < 16; i++) {
+        store32_le(&block[4 * i], load32_le(&block[4 * i]) ^ (x[i] + state[i]));
+    }
+}
+
+static void portable_xor_blocks(const uint32_t *state, uint8_t *chunk, size_t blocks)
+{
+    uint32_t s[16];
+    memcpy(s, state, sizeof(s));
+
+    for (size_t i = 0; i < blocks; i++, s[CHACHA20_COUNTER]++) {
+        chacha20_block(s, &chunk[CHACHA20_BLOCK_SIZE * i]);
+    }
+}
+
+static const chacha20_backend_t portable = {
+    .name = "portable",
+    .xor_blocks = portable_xor_blocks,
+};
+
+static const chacha20_backend_t *backend = &portable;
+
+// Pick the widest backend supported by the host
+__attribute__((constructor))
+static void chacha20_select_backend(void)
+{
+    const chacha20_backend_t *avx2 = chacha20_avx2_backend();
+    const chacha20_backend_t *sse2 = chacha20_sse2_backend();
+    if (avx2) {
+        backend = avx2;
+    }
+    else if (sse2) {
+        backend = sse2;
+    }
+}
+
+void chacha20_init(chacha20_t *ctx, const uint8_t *key, const uint8_t *nonce, uint32_t counter)
+{
+    // "expand 32-byte k"
+    ctx->state[0] = 0x61707865;
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+
+    for (size_t i = 0; i < CHACHA20_KEY_LEN / 4; i++) {
+        ctx->state[4 + i] = load32_le(&key[4 * i]);
+    }
+
+    ctx->state[CHACHA20_COUNTER] = counter;
+    for (size_t i = 0; i < CHACHA20_NONCE_LEN / 4; i++) {
+        ctx->state[13 + i] = load32_le(&nonce[4 * i]);
+    }
+
+    ctx->keystream_bytes = 0;
+}
+
+void chacha20_xor(chacha20_t *ctx, uint8_t *chunk, size_t length)
+{
+    // Use up keystream left over from the previous call
+    const size_t leftover = length < ctx->keystream_bytes ? length : ctx->keystream_bytes;
+    const uint8_t *keystream = &ctx->keystream[CHACHA20_BLOCK_SIZE - ctx->keystream_bytes];
+    for (size_t i = 0; i < leftover; i++) {
+        chunk[i] ^= keystream[i];
+    }
+    ctx->keystream_bytes -= leftover;
+    chunk += leftover;
+    length -= leftover;
+
+    const size_t blocks = length / CHACHA20_BLOCK_SIZE;
+    if (blocks) {
+        backend->xor_blocks(ctx->state, chunk, blocks);
+        ctx->state[CHACHA20_COUNTER] += (uint32_t)blocks;
+        chunk += CHACHA20_BLOCK_SIZE * blocks;
+        length -= CHACHA20_BLOCK_SIZE * blocks;
+    }
+
+    // Generate one more block for the tail, keeping what it doesn't use for the next call
+    if (length) {
+        memset(ctx->keystream, 0, CHACHA20_BLOCK_SIZE);
+        backend->xor_blocks(ctx->state, ctx->keystream, 1);
+        ctx->state[CHACHA20_COUNTER]++;
+        for (size_t i = 0; i < length; i++) {
+            chunk[i] ^= ctx->keystream[i];
+        }
+        ctx->keystream_bytes = CHACHA20_BLOCK_SIZE - length;
+    }
+}
+
+void chacha20_skip(chacha20_t *ctx, size_t length)
+{
+    const size_t leftover = length < ctx->keystream_bytes ? length : ctx->keystream_bytes;
+    ctx->keystream_bytes -= leftover;
+    length -= leftover;
+
+    ctx->state[CHACHA20_COUNTER] += (uint32_t)(length / CHACHA20_BLOCK_SIZE);
+    length %= CHACHA20_BLOCK_SIZE;
+
+    // Landing mid-block leaves the rest of that block for the next call
+    if (length) {
+        memset(ctx->keystream, 0, CHACHA20_BLOCK_SIZE);
+        backend->xor_blocks(ctx->state, ctx->keystream, 1);
+        ctx->state[CHACHA20_COUNTER]++;
+        ctx->keystream_bytes = CHACHA20_BLOCK_SIZE - length;
+    }
+}
+
+#if defined(__SIZEOF_INT128__) && !defined(POLY1305_LIMB26)
+
+// Three 44-bit limbs (44, 44, 42), multiplied with 128-bit products
+
+typedef unsigned __int128 uint128_t;
+
+static const uint64_t mask44 = ((uint64_t)1 << 44) - 1;
+static const uint64_t mask42 = ((uint64_t)1 << 42) - 1;
+
+static void poly1305_clamp(poly1305_t *ctx, const uint8_t *key)
+{
+    const uint64_t t0 = load64_le(&key[0]);
+    const uint64_t t1 = load64_le(&key[8]);
+    ctx->r[0] = t0 & 0xffc0fffffff;
+    ctx->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+    ctx->r[2] = (t1 >> 24) & 0x00ffffffc0f;
+}
+
+// Absorb whole blocks, `hibit` being the 2^128 bit appended to each
+static void poly1305_blocks(poly1305_t *ctx, const uint8_t *msg, size_t blocks, uint64_t hibit)
+{
+    const uint64_t r0 = ctx->r[0];
+    const uint64_t r1 = ctx->r[1];
+    const uint64_t r2 = ctx->r[2];
+    const uint64_t s1 = r1 * (5 << 2);
+    const uint64_t s2 = r2 * (5 << 2);
+    uint64_t h0 = ctx->h[0];
+    uint64_t h1 = ctx->h[1];
+    uint64_t h2 = ctx->h[2];
+
+    for (size_t i = 0; i < blocks; i++, msg += POLY1305_BLOCK_SIZE) {
+        const uint64_t t0 = load64_le(&msg[0]);
+        const uint64_t t1 = load64_le(&msg[8]);
+        h0 += t0 & mask44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & mask44;
+        h2 += ((t1 >> 24) & mask42) | (hibit << 40);
+
+        // h *= r (mod 2^130 - 5)
+        uint128_t d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 + (uint128_t)h2 * s1;
+        uint128_t d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 + (uint128_t)h2 * s2;
+        uint128_t d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 + (uint128_t)h2 * r0;
+
+        uint64_t c = (uint64_t)(d0 >> 44);
+        h0 = (uint64_t)d0 & mask44;
+        d1 += c;
+        c = (uint64_t)(d1 >> 44);
+        h1 = (uint64_t)d1 & mask44;
+        d2 += c;
+        c = (uint64_t)(d2 >> 42);
+        h2 = (uint64_t)d2 & mask42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= mask44;
+        h1 += c;
+    }
+
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+}
+
+static void poly1305_digest(poly1305_t *ctx, uint8_t *tag)
+{
+    uint64_t h0 = ctx->h[0];
+    uint64_t h1 = ctx->h[1];
+    uint64_t h2 = ctx->h[2];
+
+    // Fully carry h
+    uint64_t c = h1 >> 44;
+    h1 &= mask44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= mask42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= mask44;
+    h1 += c;
+    c = h1 >> 44;
+    h1 &= mask44;
+    h2 += c;
+    c = h2 >> 42;
+    h2 &= mask42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= mask44;
+    h1 += c;
+
+    // g = h - p, selected in constant time if h >= p
+    uint64_t g0 = h0 + 5;
+    c = g0 >> 44;
+    g0 &= mask44;
+    uint64_t g1 = h1 + c;
+    c = g1 >> 44;
+    g1 &= mask44;
+    uint64_t g2 = h2 + c - ((uint64_t)1 << 42);
+
+    const uint64_t select = (g2 >> 63) - 1;
+    h0 = (h0 & ~select) | (g0 & select);
+    h1 = (h1 & ~select) | (g1 & select);
+    h2 = (h2 & ~select) | (g2 & select);
+
+    // tag = h + pad (mod 2^128)
+    const uint64_t t0 = load64_le(&ctx->pad[0]);
+    const uint64_t t1 = load64_le(&ctx->pad[8]);
+    h0 += t0 & mask44;
+    c = h0 >> 44;
+    h0 &= mask44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & mask44) + c;
+    c = h1 >> 44;
+    h1 &= mask44;
+    h2 += ((t1 >> 24) & mask42) + c;
+
+    store64_le(&tag[0], h0 | (h1 << 44));
+    store64_le(&tag[8], (h1 >> 20) | (h2 << 24));
+}
+
+#else
+
+// Five 26-bit limbs, multiplied with 64-bit products
+
+static const uint32_t mask26 = (1 << 26) - 1;
+
+static void poly1305_clamp(poly1305_t *ctx, const uint8_t *key)
+{
+    ctx->r[0] = (load32_le(&key[0]) >> 0) & 0x3ffffff;
+    ctx->r[1] = (load32_le(&key[3]) >> 2) & 0x3ffff03;
+    ctx->r[2] = (load32_le(&key[6]) >> 4) & 0x3ffc0ff;
+    ctx->r[3] = (load32_le(&key[9]) >> 6) & 0x3f03fff;
+    ctx->r[4] = (load32_le(&key[12]) >> 8) & 0x00fffff;
+}
+
+// Absorb whole blocks, `hibit` being the 2^128 bit appended to each
+static void poly1305_blocks(poly1305_t *ctx, const uint8_t *msg, size_t blocks, uint64_t hibit)
+{
+    const uint32_t r0 = (uint32_t)ctx->r[0];
+    const uint32_t r1 = (uint32_t)ctx->r[1];
+    const uint32_t r2 = (uint32_t)ctx->r[2];
+    const uint32_t r3 = (uint32_t)ctx->r[3];
+    const uint32_t r4 = (uint32_t)ctx->r[4];
+    const uint32_t s1 = r1 * 5;
+    const uint32_t s2 = r2 * 5;
+    const uint32_t s3 = r3 * 5;
+    const uint32_t s4 = r4 * 5;
+    uint32_t h0 = (uint32_t)ctx->h[0];
+    uint32_t h1 = (uint32_t)ctx->h[1];
+    uint32_t h2 = (uint32_t)ctx->h[2];
+    uint32_t h3 = (uint32_t)ctx->h[3];
+    uint32_t h4 = (uint32_t)ctx->h[4];
+
+    for (size_t i = 0; i < blocks; i++, msg += POLY1305_BLOCK_SIZE) {
+        h0 += (load32_le(&msg[0]) >> 0) & mask26;
+        h1 += (load32_le(&msg[3]) >> 2) & mask26;
+        h2 += (load32_le(&msg[6]) >> 4) & mask26;
+        h3 += (load32_le(&msg[9]) >> 6) & mask26;
+        h4 += (load32_le(&msg[12]) >> 8) | ((uint32_t)hibit << 24);
+
+        // h *= r (mod 2^130 - 5)
+        const uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        uint32_t c = (uint32_t)(d0 >> 26);
+        h0 = (uint32_t)d0 & mask26;
+        d1 += c;
+        c = (uint32_t)(d1 >> 26);
+        h1 = (uint32_t)d1 & mask26;
+        d2 += c;
+        c = (uint32_t)(d2 >> 26);
+        h2 = (uint32_t)d2 & mask26;
+        d3 += c;
+        c = (uint32_t)(d3 >> 26);
+        h3 = (uint32_t)d3 & mask26;
+        d4 += c;
+        c = (uint32_t)(d4 >> 26);
+        h4 = (uint32_t)d4 & mask26;
+        h0 += c * 5;
+        c = h0 >> 26;
+        h0 &= mask26;
+        h1 += c;
+    }
+
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+    ctx->h[3] = h3;
+    ctx->h[4] = h4;
+}
+
+static void poly1305_digest(poly1305_t *ctx, uint8_t *tag)
+{
+    uint32_t h0 = (uint32_t)ctx->h[0];
+    uint32_t h1 = (uint32_t)ctx->h[1];
+    uint32_t h2 = (uint32_t)ctx->h[2];
+    uint32_t h3 = (uint32_t)ctx->h[3];
+    uint32_t h4 = (uint32_t)ctx->h[4];
+
+    // Fully carry h
+    uint32_t c = h1 >> 26;
+    h1 &= mask26;
+    h2 += c;
+    c = h2 >> 26;
+    h2 &= mask26;
+    h3 += c;
+    c = h3 >> 26;
+    h3 &= mask26;
+    h4 += c;
+    c = h4 >> 26;
+    h4 &= mask26;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= mask26;
+    h1 += c;
+
+    // g = h - p, selected in constant time if h >= p
+    uint32_t g0 = h0 + 5;
+    c = g0 >> 26;
+    g0 &= mask26;
+    uint32_t g1 = h1 + c;
+    c = g1 >> 26;
+    g1 &= mask26;
+    uint32_t g2 = h2 + c;
+    c = g2 >> 26;
+    g2 &= mask26;
+    uint32_t g3 = h3 + c;
+    c = g3 >> 26;
+    g3 &= mask26;
+    uint32_t g4 = h4 + c - (1 << 26);
+
+    const uint32_t select = (g4 >> 31) - 1;
+    h0 = (h0 & ~select) | (g0 & select);
+    h1 = (h1 & ~select) | (g1 & select);
+    h2 = (h2 & ~select) | (g2 & select);
+    h3 = (h3 & ~select) | (g3 & select);
+    h4 = (h4 & ~select) | (g4 & select);
+
+    // tag = h + pad (mod 2^128)
+    uint64_t f = (uint64_t)(h0 | (h1 << 26)) + load32_le(&ctx->pad[0]);
+    store32_le(&tag[0], (uint32_t)f);
+    f = (uint64_t)((h1 >> 6) | (h2 << 20)) + load32_le(&ctx->pad[4]) + (f >> 32);
+    store32_le(&tag[4], (uint32_t)f);
+    f = (uint64_t)((h2 >> 12) | (h3 << 14)) + load32_le(&ctx->pad[8]) + (f >> 32);
+    store32_le(&tag[8], (uint32_t)f);
+    f = (uint64_t)((h3 >> 18) | (h4 << 8)) + load32_le(&ctx->pad[12]) + (f >> 32);
+    store32_le(&tag[12], (uint32_t)f);
+}
+
+#endif
+
+void poly1305_init(poly1305_t *ctx, const uint8_t *key)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    poly1305_clamp(ctx, key);
+    memcpy(ctx->pad, &key[16], sizeof(ctx->pad));
+}
+
+void poly1305_append(poly1305_t *ctx, const uint8_t *msg, size_t length)
+{
+    // Top up a partial block first
+    if (ctx->block_bytes) {
+        const size_t needed = POLY1305_BLOCK_SIZE - ctx->block_bytes;
+        const size_t take = length < needed ? length : needed;
+        memcpy(&ctx->block[ctx->block_bytes], msg, take);
+        ctx->block_bytes += take;
+        msg += take;
+        length -= take;
+        if (ctx->block_bytes < POLY1305_BLOCK_SIZE) {
+            return;
+        }
+        poly1305_blocks(ctx, ctx->block, 1, 1);
+        ctx->block_bytes = 0;
+    }
+
+    const size_t blocks = length / POLY1305_BLOCK_SIZE;
+    poly1305_blocks(ctx, msg, blocks, 1);
+    msg += POLY1305_BLOCK_SIZE * blocks;
+    length -= POLY1305_BLOCK_SIZE * blocks;
+
+    memcpy(ctx->block, msg, length);
+    ctx->block_bytes = length;
+}
+
+void poly1305_finish(poly1305_t *ctx, uint8_t *tag)
+{
+    // A final partial block is padded with a single one bit rather than having the 2^128 bit set
+    if (ctx->block_bytes) {
+        ctx->block[ctx->block_bytes] = 1;
+        memset(&ctx->block[ctx->block_bytes + 1], 0, POLY1305_BLOCK_SIZE - ctx->block_bytes - 1);
+        poly1305_blocks(ctx, ctx->block, 1, 0);
+        ctx->block_bytes = 0;
+    }
+    poly1305_digest(ctx, tag);
+}
+
+void poly1305(const uint8_t *key, const uint8_t *msg, size_t length, uint8_t *tag)
+{
+    poly1305_t ctx;
+    poly1305_init(&ctx, key);
+    poly1305_append(&ctx, msg, length);
+    poly1305_finish(&ctx, tag);
+}
+
+// Zero-pad the additional data or ciphertext to a whole block
+static void aead_pad(chacha20_poly1305_t *ctx)
+{
+    static const uint8_t zeros[POLY1305_BLOCK_SIZE] = { 0 };
+    if (ctx->poly.block_bytes) {
+        poly1305_append(&ctx->poly, zeros, POLY1305_BLOCK_SIZE - ctx->poly.block_bytes);
+    }
+}
+
+void chacha20_poly1305_init(chacha20_poly1305_t *ctx, const uint8_t *key, const uint8_t *nonce)
+{
+    // The one-time Poly1305 key is the first half of block 0
+    uint8_t otk[CHACHA20_BLOCK_SIZE] = { 0 };
+    chacha20_init(&ctx->chacha, key, nonce, 0);
+    chacha20_xor(&ctx->chacha, otk, sizeof(otk));
+    poly1305_init(&ctx->poly, otk);
+
+    ctx->aad_bytes = 0;
+    ctx->text_bytes = 0;
+}
+
+void chacha20_poly1305_aad(chacha20_poly1305_t *ctx, const uint8_t *aad, size_t length)
+{
+    ctx->aad_bytes += length;
+    poly1305_append(&ctx->poly, aad, length);
+    aead_pad(ctx);
+}
+
+void chacha20_poly1305_append(chacha20_poly1305_t *ctx, const uint8_t *msg, size_t length)
+{
+    ctx->text_bytes += length;
+    poly1305_append(&ctx->poly, msg, length);
+}
+
+void chacha20_poly1305_xor(chacha20_poly1305_t *ctx, uint8_t *chunk, size_t length)
+{
+    chacha20_xor(&ctx->chacha, chunk, length);
+}
+
+void chacha20_poly1305_encrypt(chacha20_poly1305_t *ctx, uint8_t *chunk, size_t length)
+{
+    for (size_t i = 0; i < length; i += AEAD_CHUNK_SIZE) {
+        const size_t n = length - i < AEAD_CHUNK_SIZE ? length - i : AEAD_CHUNK_SIZE;
+        chacha20_xor(&ctx->chacha, &chunk[i], n);
+        chacha20_poly1305_append(ctx, &chunk[i], n);
+    }
+}
+
+void chacha20_poly1305_decrypt(chacha20_poly1305_t *ctx, uint8_t *chunk, size_t length)
+{
+    for (size_t i = 0; i < length; i += AEAD_CHUNK_SIZE) {
+        const size_t n = length - i < AEAD_CHUNK_SIZE ? length - i : AEAD_CHUNK_SIZE;
+        chacha20_poly1305_append(ctx, &chunk[i], n);
+        chacha20_xor(&ctx->chacha, &chunk[i], n);
+    }
+}
+
+void chacha20_poly1305_finish(chacha20_poly1305_t *ctx, uint8_t *tag)
+{
+    aead_pad(ctx);
+
+    uint8_t lengths[POLY1305_BLOCK_SIZE];
+    store64_le(&lengths[0], ctx->aad_bytes);
+    store64_le(&lengths[8], ctx->text_bytes);
+    poly1305_append(&ctx->poly, lengths, sizeof(lengths));
+    poly1305_finish(&ctx->poly, tag);
+}
@@ -0,0 +1,172 @@
+/**
+ * @file chacha20.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief ChaCha20, Poly1305, and their AEAD construction following RFC 8439
+ * @ref https://datatracker.ietf.org/doc/html/rfc8439
+ * @version 0.9.4
+ * @date 2022-02-06
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum ChaCha20 {
+    CHACHA20_KEY_LEN = 32,
+    CHACHA20_NONCE_LEN = 12,
+    CHACHA20_BLOCK_SIZE = 64,
+    POLY1305_KEY_LEN = 32,
+    POLY1305_TAG_LEN = 16,
+    POLY1305_BLOCK_SIZE = 16,
+};
+
+typedef struct chacha20_t {
+    uint32_t state[16];                       // Constants, key, counter, and nonce of the next block
+    uint8_t keystream[CHACHA20_BLOCK_SIZE];   // Last block of keystream generated
+    size_t keystream_bytes;                   // Bytes of `keystream` not yet used
+} chacha20_t;
+
+typedef struct poly1305_t {
+    uint64_t r[5];                            // Clamped multiplier, in 44-bit limbs (26-bit without 128-bit integers)
+    uint64_t h[5];                            // Accumulator, in the same limbs as `r`
+    uint8_t pad[16];                          // Added to the accumulator to form the tag
+    uint8_t block[POLY1305_BLOCK_SIZE];       // Partial block, held until more data arrives
+    size_t block_bytes;
+} poly1305_t;
+
+typedef struct chacha20_poly1305_t {
+    chacha20_t chacha;
+    poly1305_t poly;
+    uint64_t aad_bytes;
+    uint64_t text_bytes;
+} chacha20_poly1305_t;
+
+/**
+ * @brief Initiate a new chacha20_t context
+ *
+ * @param[out] ctx chacha20 instance
+ * @param[in] key 256-bit key
+ * @param[in] nonce 96-bit nonce
+ * @param[in] counter block counter of the first block of keystream
+ */
+void chacha20_init(chacha20_t *ctx, const uint8_t *key, const uint8_t *nonce, uint32_t counter);
+
+/**
+ * @brief XOR the keystream into contents in-place, encrypting or decrypting them
+ *
+ * @param[inout] ctx chacha20 instance
+ * @param[inout] chunk pointer to plaintext/ciphertext
+ * @param[in] length number of bytes to process
+ */
+void chacha20_xor(chacha20_t *ctx, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Advance the keystream without applying it, e.g., to hand the next portion of a message to another thread
+ *
+ * @param[inout] ctx chacha20 instance
+ * @param[in] length number of bytes to skip
+ */
+void chacha20_skip(chacha20_t *ctx, size_t length);
+
+/**
+ * @brief Begin a Poly1305 computation
+ *
+ * @param[out] ctx poly1305 instance
+ * @param[in] key 256-bit one-time key
+ */
+void poly1305_init(poly1305_t *ctx, const uint8_t *key);
+
+/**
+ * @brief Append message bytes to a Poly1305 computation
+ *
+ * @param[inout] ctx poly1305 instance
+ * @param[in] msg pointer to the next portion of the message
+ * @param[in] length number of bytes to process
+ */
+void poly1305_append(poly1305_t *ctx, const uint8_t *msg, size_t length);
+
+/**
+ * @brief Finish a Poly1305 computation and output the tag
+ *
+ * @param[inout] ctx poly1305 instance
+ * @param[out] tag 16-byte generated tag
+ */
+void poly1305_finish(poly1305_t *ctx, uint8_t *tag);
+
+/**
+ * @brief One-shot Poly1305
+ *
+ * @param[in] key 256-bit one-time key
+ * @param[in] msg pointer to message
+ * @param[in] length number of bytes to process
+ * @param[out] tag 16-byte generated tag
+ */
+void poly1305(const uint8_t *key, const uint8_t *msg, size_t length, uint8_t *tag);
+
+/**
+ * @brief Begin a ChaCha20-Poly1305 computation, keyed from block 0 with encryption starting at block 1
+ *
+ * @param[out] ctx AEAD instance
+ * @param[in] key 256-bit key
+ * @param[in] nonce 96-bit nonce
+ */
+void chacha20_poly1305_init(chacha20_poly1305_t *ctx, const uint8_t *key, const uint8_t *nonce);
+
+/**
+ * @brief Authenticate additional data. All additional data must be passed in a single call before any ciphertext
+ *
+ * @param[inout] ctx AEAD instance
+ * @param[in] aad additional authenticated data
+ * @param[in] length number of bytes to authenticate
+ */
+void chacha20_poly1305_aad(chacha20_poly1305_t *ctx, const uint8_t *aad, size_t length);
+
+/**
+ * @brief Authenticate ciphertext without decrypting it, e.g., as it arrives
+ *
+ * @param[inout] ctx AEAD instance
+ * @param[in] msg pointer to the next portion of the ciphertext
+ * @param[in] length number of bytes to authenticate
+ */
+void chacha20_poly1305_append(chacha20_poly1305_t *ctx, const uint8_t *msg, size_t length);
+
+/**
+ * @brief Apply the keystream in-place without authenticating
+ *
+ * @param[inout] ctx AEAD instance
+ * @param[inout] chunk pointer to plaintext/ciphertext
+ * @param[in] length number of bytes to process
+ */
+void chacha20_poly1305_xor(chacha20_poly1305_t *ctx, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Encrypt contents in-place and authenticate the ciphertext
+ *
+ * @param[inout] ctx AEAD instance
+ * @param[inout] chunk pointer to plaintext/ciphertext
+ * @param[in] length number of bytes to encrypt
+ */
+void chacha20_poly1305_encrypt(chacha20_poly1305_t *ctx, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Authenticate the ciphertext and decrypt it in-place
+ *
+ * @param[inout] ctx AEAD instance
+ * @param[inout] chunk pointer to ciphertext/plaintext
+ * @param[in] length number of bytes to decrypt
+ */
+void chacha20_poly1305_decrypt(chacha20_poly1305_t *ctx, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Finish a ChaCha20-Poly1305 computation and output the tag
+ *
+ * @param[inout] ctx AEAD instance
+ * @param[out] tag 16-byte authentication tag
+ */
+void chacha20_poly1305_finish(chacha20_poly1305_t *ctx, uint8_t *tag);
@@ -31,8 +31,7 @@ static void point_d(uint8_t *dst)
 // ECDH public key (Q = d * G)
 static void point_q(const uint8_t *secret_key, uint8_t *public_key, uint8_t *fingerprint)
 {
-	const uint8_t basepoint[KEY_LEN] = { 9 };
-	x25519(public_key, secret_key, basepoint);
+	x25519_base(public_key, secret_key);
 	if (fingerprint) {
 		uint8_t hash[KEY_LEN];
 		sha256_key_digest(public_key, hash);
@@ -46,21 +45,181 @@ static void point_kx(uint8_t *shared_key, const uint8_t *secret_key, const uint8
 	x25519(shared_key, secret_key, public_key);
 }
 
-int two_party_client(sock_t socket, uint8_t *ctrl_key)
-{
-	// Diffie-Hellman keys
+enum KeyPool {
+	KEY_POOL_SIZE = 4,
+};
+
+typedef struct key_pair_t {
 	uint8_t secret_key[KEY_LEN];
 	uint8_t public_key[KEY_LEN];
+} key_pair_t;
+
+// Ephemeral key pairs generated ahead of time by a background thread
+static struct key_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t taken;   // Signalled whenever a pair is removed
+	key_pair_t pairs[KEY_POOL_SIZE];
+	size_t count;
+	bool running;
+} key_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.taken = PTHREAD_COND_INITIALIZER,
+};
+
+static void *key_pool_thread(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&key_pool.lock);
+		while (key_pool.count == KEY_POOL_SIZE) {
+			pthread_cond_wait(&key_pool.taken, &key_pool.lock);
+		}
+		pthread_mutex_unlock(&key_pool.lock);
+
+		key_pair_t pair;
+		point_d(pair.secret_key);
+		point_q(pair.secret_key, pair.public_key, NULL);
+
+		pthread_mutex_lock(&key_pool.lock);
+		if (key_pool.count < KEY_POOL_SIZE) {
+			key_pool.pairs[key_pool.count++] = pair;
+		}
+		pthread_mutex_unlock(&key_pool.lock);
+		memset(&pair, 0, sizeof(pair));
+	}
+	return NULL;
+}
+
+#if __unix__ || __APPLE__
+// A forked child must never reuse a pair its parent may also hand out, and it inherits no refill thread
+static void key_pool_forked(void)
+{
+	pthread_mutex_init(&key_pool.lock, NULL);
+	pthread_cond_init(&key_pool.taken, NULL);
+	memset(key_pool.pairs, 0, sizeof(key_pool.pairs));
+	key_pool.count = 0;
+	key_pool.running = false;
+}
+
+static void key_pool_register_fork(void)
+{
+	(void)pthread_atfork(NULL, NULL, key_pool_forked);
+}
+#endif
+
+int key_pool_start(void)
+{
+	pthread_mutex_lock(&key_pool.lock);
+	if (key_pool.running) {
+		pthread_mutex_unlock(&key_pool.lock);
+		return 0;
+	}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, key_pool_thread, NULL)) {
+		pthread_mutex_unlock(&key_pool.lock);
+		return -1;
+	}
+	pthread_detach(thread);
+	key_pool.running = true;
+	pthread_mutex_unlock(&key_pool.lock);
+
+#if __unix__ || __APPLE__
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	(void)pthread_once(&once, key_pool_register_fork);
+#endif
+	return 0;
+}
+
+/**
+ * @brief First thing a client sends. The version and length lead so the daemon can turn away an older
+ * or garbled client straight away, rather than wait on bytes that will never arrive
+ */
+struct kx_hello {
+	uint8_t version[8];          // HELLO_VERSION
+	uint8_t length[8];           // Bytes after this header, at least up to `preferred`
+	uint8_t public_key[KEY_LEN];
+	uint8_t supported[8];        // Cipher suites, see wire_suites_t
+	uint8_t preferred[8];
+};
+
+enum KeyExchangeHello {
+	HELLO_VERSION = 0x31786b70, // "pkx1"
+	HELLO_HEADER_LEN = 16,
+	HELLO_MAX_LEN = HELLO_LEN_MAX - HELLO_HEADER_LEN, // Longest body accepted, leaving room for fields added later
+};
+
+ssize_t kx_hello_missing(const uint8_t *hello, size_t received)
+{
+	if (received < HELLO_HEADER_LEN) {
+		return HELLO_HEADER_LEN - received;
+	}
+
+	struct kx_hello header;
+	memcpy(&header, hello, HELLO_HEADER_LEN);
+	const uint64_t length = wire_get_raw(header.length);
+	if (wire_get_raw(header.version) != HELLO_VERSION || length < sizeof(header) - HELLO_HEADER_LEN || length > HELLO_MAX_LEN) {
+		return -1;
+	}
+	return HELLO_HEADER_LEN + length - received;
+}
+
+// Parse a whole client hello, returning -1 if the client is not speaking this version of the handshake
+static int parse_hello(const uint8_t *hello, uint8_t *public_key, wire_suites_t *suites)
+{
+	const ssize_t missing = kx_hello_missing(hello, HELLO_HEADER_LEN);
+	if (missing < 0) {
+		return -1;
+	}
+
+	struct kx_hello fields;
+	memcpy(&fields, hello, sizeof(fields));
+	memcpy(public_key, fields.public_key, KEY_LEN);
+	suites->supported = wire_get_raw(fields.supported);
+	suites->preferred = wire_get_raw(fields.preferred);
+	return 0;
+}
+
+// Take a pair from the pool, generating one on the spot if the pool is empty or not running
+static void key_pair(uint8_t *secret_key, uint8_t *public_key)
+{
+	pthread_mutex_lock(&key_pool.lock);
+	if (key_pool.count) {
+		key_pair_t *pair = &key_pool.pairs[--key_pool.count];
+		memcpy(secret_key, pair->secret_key, KEY_LEN);
+		memcpy(public_key, pair->public_key, KEY_LEN);
+		memset(pair, 0, sizeof(*pair));
+		pthread_cond_signal(&key_pool.taken);
+		pthread_mutex_unlock(&key_pool.lock);
+		return;
+	}
+	pthread_mutex_unlock(&key_pool.lock);
+
 	point_d(secret_key);
 	point_q(secret_key, public_key, NULL);
+}
 
-	// Send public key to begin
-	if (xsend(socket, public_key, KEY_LEN, 0) < 0) {
+int two_party_client(sock_t socket, uint8_t *ctrl_key)
+{
+	// Diffie-Hellman keys
+	uint8_t secret_key[KEY_LEN];
+	uint8_t public_key[KEY_LEN];
+	key_pair(secret_key, public_key);
+
+	// Send public key and the cipher suites we support and prefer to begin
+	const wire_suites_t suites = wire_host_suites();
+	struct kx_hello hello;
+	wire_set_raw(hello.version, HELLO_VERSION);
+	wire_set_raw(hello.length, sizeof(hello) - HELLO_HEADER_LEN);
+	memcpy(hello.public_key, public_key, KEY_LEN);
+	wire_set_raw(hello.supported, suites.supported);
+	wire_set_raw(hello.preferred, suites.preferred);
+	if (xsendall(socket, &hello, sizeof(hello)) < 0) {
 		return -1;
 	}
 
 	uint8_t server_public_key[KEY_LEN];
-	if (xrecv(socket, server_public_key, KEY_LEN, 0) != KEY_LEN) {
+	if (xrecvall(socket, server_public_key, KEY_LEN)) {
 		return -1;
 	}
 
@@ -73,13 +232,14 @@ int two_party_client(sock_t socket, uint8_t *ctrl_key)
 		return -1;
 	}
 	
-	if (xrecv(socket, wire, key_exchange_wire_length, 0) != key_exchange_wire_length) {
+	if (xrecvall(socket, wire, key_exchange_wire_length)) {
+		xfree(wire);
 		return -1;
 	}
 
 	// Shared secret gets hashed in point_kx()
 	size_t data_length = 0;
-	if (decrypt_wire(wire, &data_length, shared_secret)) {
+	if (decrypt_wire(wire, &data_length, SUITE_AES_CBC_CMAC, shared_secret)) {
 		return -1;
 	}
 
@@ -88,41 +248,119 @@ int two_party_client(sock_t socket, uint8_t *ctrl_key)
 	return 0;
 }
 
-int two_party_server(sock_t socket, uint8_t *session_key)
+int two_party_servers(const sock_t *sockets, const uint8_t (*hellos)[HELLO_LEN_MAX], size_t count, uint8_t *session_key, wire_suites_t *suites, bool *rejected)
 {
-	// Receive public key from the client
-	uint8_t public_key[KEY_LEN];
-	if (xrecv(socket, public_key, KEY_LEN, 0) != KEY_LEN) {
+	if (count > HANDSHAKE_BATCH_MAX) {
 		return -1;
 	}
 
-	// Generate a single-use secret key for the key pair
-	uint8_t secret_key[KEY_LEN];
-	point_d(secret_key);
+	uint8_t client_public_keys[HANDSHAKE_BATCH_MAX][KEY_LEN];
+	uint8_t secret_keys[HANDSHAKE_BATCH_MAX][KEY_LEN];
+	uint8_t shared_secrets[HANDSHAKE_BATCH_MAX][KEY_LEN];
+	const uint8_t *public_keys[HANDSHAKE_BATCH_MAX] = { 0 };
+	const uint8_t *secret_key_ptrs[HANDSHAKE_BATCH_MAX] = { 0 };
+	uint8_t *shared_secret_ptrs[HANDSHAKE_BATCH_MAX] = { 0 };
+	size_t ladders = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		// Public key and cipher suites from the client
+		suites[i] = (wire_suites_t) { 0 };
+		rejected[i] = parse_hello(hellos[i], client_public_keys[i], &suites[i]) < 0;
+		if (rejected[i]) {
+			debug_print("Rejecting handshake %zu\n", i);
+			continue;
+		}
 
-	// Compute a single-use public key and our shared secret with the client
-	uint8_t server_public_key[KEY_LEN];
-	point_q(secret_key, server_public_key, NULL);
+		// Take a single-use key pair
+		uint8_t server_public_key[KEY_LEN];
+		key_pair(secret_keys[i], server_public_key);
+		if (xsendall(sockets[i], server_public_key, KEY_LEN) < 0) {
+			rejected[i] = true;
+			continue;
+		}
+		public_keys[ladders] = client_public_keys[i];
+		secret_key_ptrs[ladders] = secret_keys[i];
+		shared_secret_ptrs[ladders++] = shared_secrets[i];
+	}
 
-	if (xsend(socket, server_public_key, KEY_LEN, 0) < 0) {
-		return -1;
+	// Shared secrets with every remaining client at once
+	x25519_batch(shared_secret_ptrs, secret_key_ptrs, public_keys, ladders);
+
+	for (size_t i = 0; i < count; i++) {
+		if (rejected[i]) {
+			continue;
+		}
+		size_t len = KEY_LEN;
+		wire_t *wire = init_wire(session_key, TYPE_TEXT, &len);
+		if (!wire) {
+			rejected[i] = true;
+			continue;
+		}
+		encrypt_wire(wire, SUITE_AES_CBC_CMAC, shared_secrets[i]);
+		rejected[i] = xsendall(sockets[i], wire, len) < 0;
+		xfree(wire);
 	}
+	return 0;
+}
 
-	uint8_t shared_secret[KEY_LEN];
-	point_kx(shared_secret, secret_key, public_key);
+int two_party_server(sock_t socket, uint8_t *session_key, wire_suites_t *suites)
+{
+	uint8_t hello[1][HELLO_LEN_MAX];
+	size_t received = 0;
+	for (ssize_t missing; (missing = kx_hello_missing(hello[0], received));) {
+		if (missing < 0 || xrecvall(socket, &hello[0][received], (size_t)missing)) {
+			return -1;
+		}
+		received += (size_t)missing;
+	}
 
-	size_t len = KEY_LEN;
-	wire_t *wire = init_wire(session_key, TYPE_TEXT, &len);
-	encrypt_wire(wire, shared_secret);
-	if (xsend(socket, wire, len, 0) < 0) {
-		return -1;
+	bool rejected;
+	return two_party_servers(&socket, (const uint8_t (*)[HELLO_LEN_MAX])hello, 1, session_key, suites, &rejected) || rejected ? -1 : 0;
+}
+
+// Keys go between the daemon and clients framed, so neither end mistakes a wire for one
+static int send_intermediate(sock_t socket, const uint8_t *key)
+{
+	struct {
+		wire_frame_t frame;
+		uint8_t key[KEY_LEN];
+	} framed;
+	memset(&framed.frame, 0, sizeof(framed.frame));
+	wire_set_raw(framed.frame.length, KEY_LEN);
+	wire_set_raw(framed.frame.action, FRAME_KEY);
+	memcpy(framed.key, key, KEY_LEN);
+	return xsendall(socket, &framed, sizeof(framed)) < 0 ? -1 : 0;
+}
+
+int kx_send_abort(sock_t socket)
+{
+	wire_frame_t frame;
+	memset(&frame, 0, sizeof(frame));
+	wire_set_raw(frame.action, FRAME_KEY_ABORT);
+	return xsendall(socket, &frame, sizeof(frame)) < 0 ? -1 : 0;
+}
+
+// Read the next key the daemon passes on. If the daemon calls the exchange off instead, the abort is answered
+static int recv_intermediate(sock_t socket, uint8_t *key)
+{
+	wire_frame_t frame;
+	if (xrecvall(socket, &frame, sizeof(frame))) {
+		return DHKE_ERROR;
 	}
 
-	xfree(wire);
-	return 0;
+	const uint64_t action = wire_get_raw(frame.action);
+	const uint64_t length = wire_get_raw(frame.length);
+	if (action == FRAME_KEY_ABORT && !length) {
+		return kx_send_abort(socket) ? DHKE_ERROR : DHKE_ABORTED;
+	}
+	if (action != FRAME_KEY || length != KEY_LEN || xrecvall(socket, key, KEY_LEN)) {
+		return DHKE_ERROR;
+	}
+	return DHKE_OK;
 }
 
-static int send_ctrl_key(sock_t *sockets, size_t count, uint8_t *ctrl_key)
+// Every client gets the CTRL, even past one that cannot take it, so all of them hold the renewed control key
+static int send_ctrl_key(sock_t *sockets, size_t count, uint8_t *ctrl_key, enum wire_suite suite, size_t *failed)
 {
 	struct wire_ctrl_message ctrl_message;
 	size_t len = sizeof(struct wire_ctrl_message);
@@ -130,6 +368,7 @@ static int send_ctrl_key(sock_t *sockets, size_t count, uint8_t *ctrl_key)
 	memset(&ctrl_message, 0, len);
 	wire_set_ctrl_function(&ctrl_message, CTRL_DHKE);
 	wire_set_ctrl_args(&ctrl_message, count - 1);
+	wire_set_ctrl_suite(&ctrl_message, suite);
 	
 	uint8_t renewed_key[32];
 	if (xgetrandom(renewed_key, KEY_LEN) < 0) {
@@ -138,50 +377,66 @@ static int send_ctrl_key(sock_t *sockets, size_t count, uint8_t *ctrl_key)
 	wire_set_ctrl_renewal(&ctrl_message, renewed_key);
 
 	wire_t *wire = init_wire(&ctrl_message, TYPE_CTRL, &len);
-	encrypt_wire(wire, ctrl_key);
+	if (!wire) {
+		return -1;
+	}
+	encrypt_wire(wire, SUITE_AES_CBC_CMAC, ctrl_key);
+
+	// Wires reach clients framed like the ones the daemon relays
+	wire_frame_t *frame = xcalloc(sizeof(wire_frame_t) + len);
+	if (!frame) {
+		xfree(wire);
+		return -1;
+	}
+	wire_set_raw(frame->length, len);
+	wire_set_raw(frame->action, FRAME_BROADCAST);
+	memcpy(&frame[1], wire, len);
+	xfree(wire);
 
 	// Update key
 	memcpy(ctrl_key, renewed_key, KEY_LEN);
 
 	for (size_t i = 1; i <= count; i++) {
 		debug_print("Sending CTRL key to socket %zu\n", i);
-		if (xsend(sockets[i], wire, len, 0) < 0) {
-			xfree(wire);
-			return -1;
+		if (xsendall(sockets[i], frame, sizeof(wire_frame_t) + len) < 0 && !*failed) {
+			*failed = i;
 		}
 	}
 
-	xfree(wire);
-	return 0;
+	xfree(frame);
+	return *failed ? -1 : 0;
 }
 
-static int rotate_intermediates(sock_t *sockets, size_t count)
+static int rotate_intermediates(sock_t *sockets, size_t count, kx_recv_key_t recv_key, void *ctx, size_t *failed)
 {
 	for (size_t i = 1; i <= count; i++) {
 		uint8_t intermediate_key[KEY_LEN];
 		debug_print("Receiving intermediate key from socket %zu\n", i);
-		if (xrecv(sockets[i], intermediate_key, KEY_LEN, 0) != KEY_LEN) {
+		if (recv_key(ctx, i, intermediate_key)) {
+			*failed = i;
 			return -1;
 		}
 
 		const size_t next = (i == count) ? 1 : i + 1; // Rotate right, skip server's socket
 		debug_print("Sending intermediate key to socket %zu\n", next);
-		if (xsend(sockets[next], intermediate_key, KEY_LEN, 0) < 0) {
+		if (send_intermediate(sockets[next], intermediate_key)) {
 			printf("\n> Error sending to slot %zu\n", next);
+			*failed = next;
 			return -1;
 		}
 	}
 	return 0;
 }
 
-int n_party_server(sock_t *sockets, size_t connection_count, uint8_t *ctrl_key)
+int n_party_server(sock_t *sockets, size_t connection_count, uint8_t *ctrl_key, enum wire_suite suite, kx_recv_key_t recv_key, void *ctx, size_t *failed)
 {
+	*failed = 0;
 	if (connection_count < 2) {
 		return 0;
 	}
 
 	debug_print("%s\n", "Sending CTRL to signal start of sequence");
-	if (send_ctrl_key(sockets, connection_count, ctrl_key)) {
+	if (send_ctrl_key(sockets, connection_count, ctrl_key, suite, failed)) {
 		printf("> Error sending starting control keys\n");
 		return -1;
 	}
@@ -189,7 +444,7 @@ int n_party_server(sock_t *sockets, size_t connection_count, uint8_t *ctrl_key)
 
 	for (size_t i = 0; i < connection_count - 1; i++) {
 		debug_print("Starting exchange round %zu of %zu\n", i + 1, connection_count - 1);
-		if (rotate_intermediates(sockets, connection_count)) {
+		if (rotate_intermediates(sockets, connection_count, recv_key, ctx, failed)) {
 			return -1;
 		}
 		debug_print("Finished round %zu\n", i + 1);
@@ -203,19 +458,18 @@ int n_party_client(sock_t socket, uint8_t *session_key, size_t rounds)
 {
 	uint8_t secret_key[KEY_LEN];
 	uint8_t public_key[KEY_LEN];
-	
-	point_d(secret_key);
-	point_q(secret_key, public_key, NULL);
+	key_pair(secret_key, public_key);
 
 	// Send our public key to the client on our right
-	if (xsend(socket, public_key, KEY_LEN, 0) != KEY_LEN) {
+	if (send_intermediate(socket, public_key)) {
 		return -1;
 	}
 
 	for (size_t i = 0; i < rounds; i++) {
 		uint8_t intermediate_public[KEY_LEN];
-		if (xrecv(socket, intermediate_public, KEY_LEN, 0) != KEY_LEN) {
-			return -1;
+		const int status = recv_intermediate(socket, intermediate_public);
+		if (status != DHKE_OK) {
+			return status;
 		}
 
 		uint8_t shared_secret[KEY_LEN];
@@ -226,7 +480,7 @@ int n_party_client(sock_t socket, uint8_t *session_key, size_t rounds)
 			return 0;
 		}
 
-		if (xsend(socket, shared_secret, KEY_LEN, 0) != KEY_LEN) {
+		if (send_intermediate(socket, shared_secret)) {
 			return -1;
 		}
 	}
@@ -17,10 +17,73 @@
 enum KeyExchangeStatus {
 	DHKE_ERROR = -1,
 	DHKE_OK,
+	DHKE_ABORTED, // The daemon called the exchange off, the session key is unchanged
 };
 
+enum KeyExchangeLimits {
+	HANDSHAKE_BATCH_MAX = 8, // Clients two_party_servers() can complete handshakes with at once
+	HELLO_LEN_MAX = 16 + 256, // Longest client hello accepted, header included
+};
+
+/**
+ * @brief Start refilling a small pool of ephemeral key pairs in the background, taking key
+ * generation off the critical path of joins and rekeys. Key exchanges fall back to generating
+ * their own pair whenever the pool is empty
+ *
+ * @return 0 on success, -1 if the refill thread could not be started
+ */
+int key_pool_start(void);
+
 int two_party_client(sock_t socket, uint8_t *ctrl_key);
-int two_party_server(sock_t socket, uint8_t *session_key);
+int two_party_server(sock_t socket, uint8_t *session_key, wire_suites_t *suites);
+
+/**
+ * @brief Check a client hello as it arrives, so a server can gather it over several reads without blocking
+ *
+ * @param[in] hello bytes of the hello received so far
+ * @param[in] received number of them
+ * @return bytes still to come, 0 once the hello is whole, -1 if it is not a hello of this version
+ */
+ssize_t kx_hello_missing(const uint8_t *hello, size_t received);
+
+/**
+ * @brief Complete two_party_server() with several clients at once, computing the shared
+ * secrets together so the ladders can run side by side
+ *
+ * @param[in] sockets client sockets, at most HANDSHAKE_BATCH_MAX
+ * @param[in] hellos whole hello already received from each client, see kx_hello_missing()
+ * @param[in] count number of clients
+ * @param[in] session_key key sent to every client
+ * @param[out] suites cipher suites of each client
+ * @param[out] rejected set for each client whose handshake failed, which does not hold up the others
+ * @return 0 on success, -1 if there are too many clients
+ */
+int two_party_servers(const sock_t *sockets, const uint8_t (*hellos)[HELLO_LEN_MAX], size_t count, uint8_t *session_key, wire_suites_t *suites, bool *rejected);
+
+/**
+ * @brief Read the next intermediate key a client sent in a FRAME_KEY frame. Whatever the client
+ * sent ahead of it is left to the daemon, which is still relaying wires sealed under the old key
+ *
+ * @param[in] ctx daemon context
+ * @param[in] index slot of the client in the sockets passed to n_party_server()
+ * @param[out] key KEY_LEN bytes
+ * @return 0 on success, -1 if the client disconnected
+ */
+typedef int (*kx_recv_key_t)(void *ctx, size_t index, uint8_t *key);
 
 int n_party_client(sock_t socket, uint8_t *session_key, size_t rounds);
-int n_party_server(sock_t *sockets, size_t connections, uint8_t *ctrl_key);
\ No newline at end of file
+
+/**
+ * @brief Rekey the group of clients in `sockets`[1..connections]
+ *
+ * @param[out] failed slot of the client the exchange failed on, 0 if it did not fail on a client
+ * @return 0 on success, -1 on failure. Clients still in the exchange then have to be sent kx_send_abort()
+ */
+int n_party_server(sock_t *sockets, size_t connections, uint8_t *ctrl_key, enum wire_suite suite, kx_recv_key_t recv_key, void *ctx, size_t *failed);
+
+/**
+ * @brief Send a FRAME_KEY_ABORT, calling off a key exchange or answering the daemon calling it off
+ *
+ * @return 0 on success, -1 on error
+ */
+int kx_send_abort(sock_t socket);
\ No newline at end of file
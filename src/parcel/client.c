@@ -25,19 +25,727 @@ void disp_username(struct username *username)
 	fflush(stdout);
 }
 
+// Held while a framed wire is written out, since the receive and disk writer threads send too
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
+ * @brief Encrypt and frame a message, telling the daemon to relay it as `action` on `route`
+ *
+ * @param shctx Shared client context, whose session key the message is sealed under once the send lock is held.
+ * A rekey holds the lock throughout, so nothing sealed under the old key goes out behind it
  * @return returns number of bytes sent on success, otherwise a negative value is returned
  */
-static ssize_t send_encrypted_message(sock_t socket, uint64_t type, void *data, size_t length, const uint8_t *key)
+ssize_t send_routed_message(sock_t socket, uint64_t type, void *data, size_t length, client_t *shctx, enum frame_action action, const uint8_t *route)
 {
 	wire_t *wire = init_wire(data, type, &length);
-	encrypt_wire(wire, key);
-	if (xsendall(socket, wire, length) < 0) {
+	if (!wire) {
+		return -1;
+	}
+
+	// Frame and wire go out in a single send
+	wire_frame_t *frame = xcalloc(sizeof(wire_frame_t) + length);
+	if (!frame) {
 		xfree(wire);
 		return -1;
 	}
+	wire_set_raw(frame->length, length);
+	wire_set_raw(frame->action, action);
+	if (route) {
+		memcpy(frame->route, route, FILE_ROUTE_LEN);
+	}
+
+	pthread_mutex_lock(&send_lock);
+	struct keys keys;
+	xmemcpy_locked(&shctx->mutex_lock, &keys, &shctx->keys, sizeof(struct keys));
+	encrypt_wire(wire, keys.suite, keys.session);
+	memcpy(&frame[1], wire, length);
+	const ssize_t status = xsendall(socket, frame, sizeof(wire_frame_t) + length);
+	pthread_mutex_unlock(&send_lock);
 	xfree(wire);
-	return length;
+	xfree(frame);
+	return status < 0 ? -1 : (ssize_t)length;
+}
+
+/**
+ * @return returns number of bytes sent on success, otherwise a negative value is returned
+ */
+ssize_t send_encrypted_message(sock_t socket, uint64_t type, void *data, size_t length, client_t *shctx)
+{
+	return send_routed_message(socket, type, data, length, shctx, FRAME_BROADCAST, NULL);
+}
+
+enum file_send_state {
+	FILE_SEND_IDLE,
+	FILE_SEND_RUNNING,
+	FILE_SEND_EXITED, // Finished, waiting to be joined
+};
+
+// A file being offered, with the chunks its receivers still want
+typedef struct file_send_t {
+	enum file_send_state state;
+	pthread_t thread;
+	client_t *shctx;
+	char *file_path;
+	uint8_t file_id[FILE_ID_LEN];
+	uint8_t *missing; // One bit per chunk, the union of every FILE_WANT
+	size_t chunks;
+} file_send_t;
+
+static struct file_sends {
+	pthread_mutex_t lock;
+	pthread_cond_t changed; // Broadcast whenever a receiver answers an offer, or the sends are cancelled
+	file_send_t sends[FILE_SENDS_MAX];
+	bool cancelled;
+	bool rekeying;    // No more chunks are handed to the pipelines while set
+	size_t in_flight; // Chunks handed to a pipeline and not yet written out
+} file_sends = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.changed = PTHREAD_COND_INITIALIZER,
+};
+
+// Fold a receiver's FILE_WANT into the chunks still to send, `length` being the bytes after the message header
+void merge_file_want(const struct wire_file_message *want, size_t length)
+{
+	const size_t bitmap_length = wire_get_raw((uint8_t *)want->length);
+	pthread_mutex_lock(&file_sends.lock);
+	for (size_t i = 0; i < FILE_SENDS_MAX; i++) {
+		file_send_t *send = &file_sends.sends[i];
+		if (send->missing && !memcmp(want->file_id, send->file_id, FILE_ID_LEN) &&
+			bitmap_length == (send->chunks + 7) / 8 && bitmap_length <= length) {
+			for (size_t j = 0; j < bitmap_length; j++) {
+				send->missing[j] |= want->filedata[j];
+			}
+			pthread_cond_broadcast(&file_sends.changed);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&file_sends.lock);
+}
+
+// Take chunk `index` off the wanted list, returning whether anyone wanted it
+static bool take_file_want(file_send_t *send, size_t index)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	const bool wanted = send->missing[index / 8] & (1 << (index % 8));
+	send->missing[index / 8] &= ~(1 << (index % 8));
+	pthread_mutex_unlock(&file_sends.lock);
+	return wanted;
+}
+
+// Must hold file_sends.lock
+static bool file_wants_pending(const file_send_t *send)
+{
+	bool pending = false;
+	for (size_t i = 0; i < (send->chunks + 7) / 8; i++) {
+		pending |= send->missing[i];
+	}
+	return pending;
+}
+
+// Wait for a receiver to want something, returning false once the offer expires or the sends are cancelled
+static bool await_file_wants(const file_send_t *send, const struct timespec *deadline)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	while (!file_sends.cancelled && !file_wants_pending(send)) {
+		if (pthread_cond_timedwait(&file_sends.changed, &file_sends.lock, deadline)) {
+			break;
+		}
+	}
+	const bool pending = !file_sends.cancelled && file_wants_pending(send);
+	pthread_mutex_unlock(&file_sends.lock);
+	return pending;
+}
+
+static bool file_sends_cancelled(void)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	const bool cancelled = file_sends.cancelled;
+	pthread_mutex_unlock(&file_sends.lock);
+	return cancelled;
+}
+
+// Start collecting wants for a file, failing if the same file is already on offer
+static int set_file_wants(file_send_t *send, const uint8_t *file_id, uint8_t *missing, size_t chunks)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	for (size_t i = 0; i < FILE_SENDS_MAX; i++) {
+		if (file_sends.sends[i].missing && !memcmp(file_sends.sends[i].file_id, file_id, FILE_ID_LEN)) {
+			pthread_mutex_unlock(&file_sends.lock);
+			return -1;
+		}
+	}
+	memcpy(send->file_id, file_id, FILE_ID_LEN);
+	send->missing = missing;
+	send->chunks = chunks;
+	pthread_mutex_unlock(&file_sends.lock);
+	return 0;
+}
+
+static void clear_file_wants(file_send_t *send)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	xfree(send->missing);
+	send->missing = NULL;
+	send->chunks = 0;
+	pthread_mutex_unlock(&file_sends.lock);
+}
+
+// Read `length` bytes at the current position
+static int read_file_chunk(FILE *file, uint8_t *data, size_t length)
+{
+	for (size_t i = 0; i < length; i += FILE_IO_CHUNK) {
+		const size_t step = length - i < FILE_IO_CHUNK ? length - i : FILE_IO_CHUNK;
+		if (fread(&data[i], 1, step, file) != step) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// File digest from the start of `file`: SHA-256 over the digests of its chunks in order, so whole
+// chunks can be hashed side by side here and one at a time, in any order, by receivers
+static int hash_file(FILE *file, uint64_t file_size, uint8_t *digest)
+{
+	uint8_t *buffer = xmalloc(SHA256_LANES_MAX * FILE_CHUNK_LEN);
+	if (!buffer) {
+		return -1;
+	}
+
+	sha256_t sha;
+	sha256_init(&sha);
+	for (uint64_t offset = 0; offset < file_size;) {
+		// Whole chunks a batch at a time, then the short one at the end on its own
+		size_t count = (file_size - offset) / FILE_CHUNK_LEN;
+		size_t length = FILE_CHUNK_LEN;
+		if (!count) {
+			count = 1;
+			length = file_size - offset;
+		}
+		else if (count > SHA256_LANES_MAX) {
+			count = SHA256_LANES_MAX;
+		}
+		if (read_file_chunk(file, buffer, count * length)) {
+			xfree(buffer);
+			return -1;
+		}
+
+		const void *chunks[SHA256_LANES_MAX];
+		uint8_t digests[SHA256_LANES_MAX][SHA256_DIGEST_LEN];
+		uint8_t *digest_ptrs[SHA256_LANES_MAX];
+		for (size_t i = 0; i < count; i++) {
+			chunks[i] = &buffer[i * FILE_CHUNK_LEN];
+			digest_ptrs[i] = digests[i];
+		}
+		sha256_chunks(chunks, length, digest_ptrs, count);
+		sha256_append(&sha, digests, count * SHA256_DIGEST_LEN);
+		offset += count * length;
+	}
+	sha256_finish(&sha, digest);
+	xfree(buffer);
+	return 0;
+}
+
+// Count chunks that have left the pipelines, for sends_pause()
+static void file_chunks_out(size_t count)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	file_sends.in_flight -= count;
+	pthread_cond_broadcast(&file_sends.changed);
+	pthread_mutex_unlock(&file_sends.lock);
+}
+
+enum FilePipeline {
+	FILE_PIPELINE_DEPTH = 8,   // Chunks between the reader and the socket at once
+	FILE_SEAL_WORKERS_MAX = 4, // Threads encrypting chunks
+};
+
+enum slot_state {
+	SLOT_FREE,
+	SLOT_READ,    // Filled by the reader, waiting to be encrypted
+	SLOT_SEALING,
+	SLOT_SEALED,  // Encrypted and framed, waiting for its turn on the socket
+};
+
+// One chunk on its way out. The frame, wire, and file message share a buffer so the reader fills the wire directly
+typedef struct file_slot_t {
+	enum slot_state state;
+	struct keys keys;
+	size_t length; // File message and data while read, the framed wire once sealed (0 if sealing failed)
+	wire_frame_t *frame;
+} file_slot_t;
+
+/**
+ * @brief Reader, encryptor, and socket writer stages of a file send. The reader hands chunks over in order
+ * through a ring of slots, the encryptors seal them side by side, and the writer sends them in order
+ */
+typedef struct file_pipeline_t {
+	pthread_mutex_t lock;
+	pthread_cond_t changed; // Broadcast whenever a slot changes state
+	file_slot_t slots[FILE_PIPELINE_DEPTH];
+	size_t read;    // Chunks handed over by the reader
+	size_t claimed; // Chunks taken up by an encryptor
+	size_t sent;    // Chunks written to the socket
+	sock_t socket;
+	bool finished;  // The reader has nothing more to hand over
+	bool failed;    // A chunk could not be sealed or sent
+	pthread_t writer;
+	pthread_t workers[FILE_SEAL_WORKERS_MAX];
+	size_t worker_count;
+} file_pipeline_t;
+
+static struct wire_file_message *slot_message(file_slot_t *slot)
+{
+	return (struct wire_file_message *)((wire_t *)&slot->frame[1])->data;
+}
+
+static void *seal_worker(void *arg)
+{
+	file_pipeline_t *pipeline = arg;
+	pthread_mutex_lock(&pipeline->lock);
+	for (;;) {
+		if (pipeline->claimed < pipeline->read) {
+			// CBC-CMAC chunks under the same key are claimed together so they share the AES lanes.
+			// The other suites already run in parallel within a wire, and are left to the other workers
+			file_slot_t *batch[AES_LANES];
+			size_t count = 0;
+			while (count < AES_LANES && pipeline->claimed < pipeline->read) {
+				file_slot_t *slot = &pipeline->slots[pipeline->claimed % FILE_PIPELINE_DEPTH];
+				if (count && (slot->keys.suite != SUITE_AES_CBC_CMAC || memcmp(&slot->keys, &batch[0]->keys, sizeof(struct keys)))) {
+					break;
+				}
+				slot->state = SLOT_SEALING;
+				pipeline->claimed++;
+				batch[count++] = slot;
+				if (slot->keys.suite != SUITE_AES_CBC_CMAC) {
+					break;
+				}
+			}
+			pthread_mutex_unlock(&pipeline->lock);
+
+			wire_t *wires[AES_LANES];
+			size_t sealing = 0;
+			for (size_t i = 0; i < count; i++) {
+				wire_t *wire = (wire_t *)&batch[i]->frame[1];
+				const size_t length = init_wire_header(wire, TYPE_FILE, batch[i]->length);
+				if (length) {
+					wire_set_raw(batch[i]->frame->length, length);
+					wires[sealing++] = wire;
+				}
+				batch[i]->length = length ? sizeof(wire_frame_t) + length : 0;
+			}
+			encrypt_wires(wires, sealing, batch[0]->keys.suite, batch[0]->keys.session);
+
+			pthread_mutex_lock(&pipeline->lock);
+			for (size_t i = 0; i < count; i++) {
+				batch[i]->state = SLOT_SEALED;
+			}
+			pthread_cond_broadcast(&pipeline->changed);
+			continue;
+		}
+		if (pipeline->finished) {
+			break;
+		}
+		pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	return NULL;
+}
+
+static void *send_worker(void *arg)
+{
+	file_pipeline_t *pipeline = arg;
+	pthread_mutex_lock(&pipeline->lock);
+	for (;;) {
+		file_slot_t *slot = &pipeline->slots[pipeline->sent % FILE_PIPELINE_DEPTH];
+		if (pipeline->sent < pipeline->read && slot->state == SLOT_SEALED) {
+			pthread_mutex_unlock(&pipeline->lock);
+
+			pthread_mutex_lock(&send_lock);
+			const bool sent = slot->length && xsendall(pipeline->socket, slot->frame, slot->length) >= 0;
+			pthread_mutex_unlock(&send_lock);
+			file_chunks_out(1);
+
+			pthread_mutex_lock(&pipeline->lock);
+			slot->state = SLOT_FREE;
+			pipeline->sent++;
+			pipeline->failed |= !sent;
+			pthread_cond_broadcast(&pipeline->changed);
+			if (!sent) {
+				break;
+			}
+			continue;
+		}
+		if (pipeline->finished && pipeline->sent == pipeline->read) {
+			break;
+		}
+		pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	return NULL;
+}
+
+static void pipeline_release(file_pipeline_t *pipeline)
+{
+	for (size_t i = 0; i < FILE_PIPELINE_DEPTH; i++) {
+		xfree(pipeline->slots[i].frame);
+	}
+	memset(pipeline->slots, 0, sizeof(pipeline->slots));
+}
+
+// Chunks go out on `route`, reaching only the members who accepted the file
+static int pipeline_start(file_pipeline_t *pipeline, sock_t socket, const uint8_t *route)
+{
+	memset(pipeline, 0, sizeof(file_pipeline_t));
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->changed, NULL);
+	pipeline->socket = socket;
+
+	const size_t data_length = BLOCK_LEN * ((sizeof(struct wire_file_message) + FILE_CHUNK_LEN + 15) / BLOCK_LEN);
+	for (size_t i = 0; i < FILE_PIPELINE_DEPTH; i++) {
+		if (!(pipeline->slots[i].frame = xmalloc(sizeof(wire_frame_t) + sizeof(wire_t) + data_length))) {
+			pipeline_release(pipeline);
+			return -1;
+		}
+		wire_set_raw(pipeline->slots[i].frame->action, FRAME_ROUTE_DATA);
+		memcpy(pipeline->slots[i].frame->route, route, FILE_ROUTE_LEN);
+	}
+
+	// The reader and writer spend most of their time blocked, leaving the remaining cores to the encryptors
+	const size_t procs = xnprocs();
+	const size_t workers = procs > 1 ? procs - 1 : 1;
+	const size_t worker_max = workers < FILE_SEAL_WORKERS_MAX ? workers : FILE_SEAL_WORKERS_MAX;
+	while (pipeline->worker_count < worker_max &&
+		!pthread_create(&pipeline->workers[pipeline->worker_count], NULL, seal_worker, pipeline)) {
+		pipeline->worker_count++;
+	}
+	if (!pipeline->worker_count || pthread_create(&pipeline->writer, NULL, send_worker, pipeline)) {
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->finished = true;
+		pthread_cond_broadcast(&pipeline->changed);
+		pthread_mutex_unlock(&pipeline->lock);
+		for (size_t i = 0; i < pipeline->worker_count; i++) {
+			pthread_join(pipeline->workers[i], NULL);
+		}
+		pipeline_release(pipeline);
+		return -1;
+	}
+	return 0;
+}
+
+// Wait for the next slot in the ring to come free, NULL if the pipeline has failed
+static file_slot_t *pipeline_slot(file_pipeline_t *pipeline)
+{
+	pthread_mutex_lock(&pipeline->lock);
+	file_slot_t *slot = &pipeline->slots[pipeline->read % FILE_PIPELINE_DEPTH];
+	while (slot->state != SLOT_FREE && !pipeline->failed) {
+		pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+	}
+	if (pipeline->failed) {
+		slot = NULL;
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	return slot;
+}
+
+// Hand the slot from pipeline_slot() over to the encryptors, to be sealed under the current session key.
+// Waits out a rekey, so no chunk sealed under the old key is written out after the exchange
+static void pipeline_push(file_pipeline_t *pipeline, client_t *shctx)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	while (file_sends.rekeying && !file_sends.cancelled) {
+		pthread_cond_wait(&file_sends.changed, &file_sends.lock);
+	}
+	file_sends.in_flight++;
+	pthread_mutex_unlock(&file_sends.lock);
+
+	file_slot_t *slot = &pipeline->slots[pipeline->read % FILE_PIPELINE_DEPTH];
+	xmemcpy_locked(&shctx->mutex_lock, &slot->keys, &shctx->keys, sizeof(struct keys));
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->slots[pipeline->read++ % FILE_PIPELINE_DEPTH].state = SLOT_READ;
+	pthread_cond_broadcast(&pipeline->changed);
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+// Let every chunk handed over drain out to the socket, then stop the pipeline
+static int pipeline_finish(file_pipeline_t *pipeline)
+{
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->finished = true;
+	pthread_cond_broadcast(&pipeline->changed);
+	pthread_mutex_unlock(&pipeline->lock);
+
+	for (size_t i = 0; i < pipeline->worker_count; i++) {
+		pthread_join(pipeline->workers[i], NULL);
+	}
+	pthread_join(pipeline->writer, NULL);
+	file_chunks_out(pipeline->read - pipeline->sent); // Left behind by a failed send
+	pipeline_release(pipeline);
+	pthread_cond_destroy(&pipeline->changed);
+	pthread_mutex_destroy(&pipeline->lock);
+	return pipeline->failed ? -1 : 0;
+}
+
+/**
+ * @brief Offer a file to the group and send the chunks wanted by the members who accept it, one per wire.
+ * The whole file is hashed up front so the offer carries its digest. Wants are served in passes over the file
+ * until the offer expires. Reading, encryption, and sending overlap through a file_pipeline_t
+ */
+static int send_file(file_send_t *send, client_t *client)
+{
+	client_t *shctx = send->shctx;
+	const size_t file_size = xfilesize(send->file_path);
+	const size_t chunks = (file_size + FILE_CHUNK_LEN - 1) / FILE_CHUNK_LEN;
+	if (chunks > 8 * (size_t)FILE_CHUNK_LEN) {
+		xwarn("> File \"%s\" is too large to send\n", send->file_path);
+		return 0;
+	}
+
+	FILE *file = fopen(send->file_path, "rb");
+	if (!file) {
+		xwarn("> Could not open file \"%s\" for reading\n", send->file_path);
+		return 0;
+	}
+
+	struct wire_file_message *chunk = xcalloc(sizeof(struct wire_file_message) + FILE_CHUNK_LEN);
+	uint8_t *missing = xcalloc((chunks + 7) / 8);
+	if (!chunk || !missing) {
+		(void)fclose(file);
+		xfree(chunk);
+		xfree(missing);
+		return -1;
+	}
+
+	char filename[FILENAME_MAX + 1];
+	memset(filename, 0, sizeof(filename));
+	const size_t filename_length = xbasename(send->file_path, filename) + 1;
+	memcpy(chunk->filename, filename, filename_length < sizeof(chunk->filename) ? filename_length : sizeof(chunk->filename) - 1);
+	wire_set_raw(chunk->filesize, file_size);
+
+	if (hash_file(file, file_size, chunk->digest)) {
+		xwarn("> Error reading contents of file\n");
+		(void)fclose(file);
+		xfree(chunk);
+		xfree(missing);
+		return 0;
+	}
+	size_t position = file_size;
+
+	// The same file sent again gets the same ID, which is what lets receivers resume it
+	uint8_t id_digest[SHA256_DIGEST_LEN];
+	sha256_t sha;
+	sha256_init(&sha);
+	sha256_append(&sha, chunk->filename, sizeof(chunk->filename));
+	sha256_append(&sha, chunk->filesize, sizeof(chunk->filesize));
+	sha256_append(&sha, chunk->digest, sizeof(chunk->digest));
+	sha256_finish(&sha, id_digest);
+	memcpy(chunk->file_id, id_digest, FILE_ID_LEN);
+	if (set_file_wants(send, chunk->file_id, missing, chunks)) {
+		xwarn("> File \"%s\" is already on offer\n", chunk->filename);
+		(void)fclose(file);
+		xfree(chunk);
+		xfree(missing);
+		return 0;
+	}
+
+	int status = 0;
+	if (xgetrandom(chunk->route, FILE_ROUTE_LEN) < 0) {
+		status = -1;
+		goto out;
+	}
+
+	wire_set_raw(chunk->function, FILE_OFFER);
+	if (send_routed_message(client->socket, TYPE_FILE, chunk, sizeof(struct wire_file_message), shctx, FRAME_ROUTE_OPEN, chunk->route) < 0) {
+		status = -1;
+		goto out;
+	}
+
+	struct timespec deadline;
+	(void)clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += FILE_OFFER_TIMEOUT;
+
+	file_pipeline_t pipeline;
+	if (pipeline_start(&pipeline, client->socket, chunk->route)) {
+		status = -1;
+		goto out;
+	}
+
+	size_t passes = 0;
+	for (; await_file_wants(send, &deadline); passes++) {
+		for (size_t index = 0; index < chunks; index++) {
+			const size_t offset = index * FILE_CHUNK_LEN;
+			const size_t length = file_size - offset < FILE_CHUNK_LEN ? file_size - offset : FILE_CHUNK_LEN;
+			if (!take_file_want(send, index)) {
+				continue;
+			}
+
+			// Wanted chunks are read straight into the wire they go out in
+			file_slot_t *slot = pipeline_slot(&pipeline);
+			if (!slot) {
+				status = -1;
+				goto finish;
+			}
+			struct wire_file_message *message = slot_message(slot);
+			if ((offset != position && xfseek(file, offset)) || read_file_chunk(file, message->filedata, length)) {
+				xwarn("> Error reading contents of file\n");
+				goto finish;
+			}
+			position = offset + length;
+
+			memcpy(message, chunk, sizeof(struct wire_file_message));
+			wire_set_raw(message->function, FILE_CHUNK);
+			wire_set_raw(message->offset, offset);
+			wire_set_raw(message->length, length);
+
+			xmemcpy_locked(&shctx->mutex_lock, &client->internal, &shctx->internal, sizeof(struct client_internal));
+			if (client->internal.kill_threads) {
+				goto finish;
+			}
+
+			slot->length = sizeof(struct wire_file_message) + length;
+			pipeline_push(&pipeline, shctx);
+		}
+	}
+
+finish:
+	if (pipeline_finish(&pipeline)) {
+		status = -1;
+	}
+	if (status || file_sends_cancelled()) {
+		goto out;
+	}
+	if (!passes) {
+		xwarn("> No one accepted \"%s\"\n", chunk->filename);
+	}
+
+	// Closes the route, and tells anyone still missing chunks to keep what they have
+	wire_set_raw(chunk->function, FILE_DONE);
+	if (send_routed_message(client->socket, TYPE_FILE, chunk, sizeof(struct wire_file_message), shctx, FRAME_ROUTE_CLOSE, chunk->route) < 0) {
+		status = -1;
+	}
+
+out:
+	clear_file_wants(send);
+	(void)fclose(file);
+	xfree(chunk);
+	return status;
+}
+
+static void *file_send_thread(void *arg)
+{
+	file_send_t *send = arg;
+	client_t client;
+	xmemcpy_locked(&send->shctx->mutex_lock, &client, send->shctx, sizeof(client_t));
+	if (send_file(send, &client) < 0) {
+		xalert("Error sending encrypted file\n");
+	}
+
+	pthread_mutex_lock(&file_sends.lock);
+	send->state = FILE_SEND_EXITED;
+	pthread_mutex_unlock(&file_sends.lock);
+	return NULL;
+}
+
+// Must hold file_sends.lock
+static void reap_file_send(file_send_t *send)
+{
+	pthread_join(send->thread, NULL);
+	xfree(send->file_path);
+	send->file_path = NULL;
+	send->state = FILE_SEND_IDLE;
+}
+
+/**
+ * @brief Offer a file in the background, so the prompt stays free while members decide whether to accept it
+ *
+ * @return 0 if the file is on its way or could not be offered, -1 on error
+ */
+static int start_file_send(client_t *shctx, const char *file_path)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	file_send_t *send = NULL;
+	for (size_t i = 0; i < FILE_SENDS_MAX; i++) {
+		if (file_sends.sends[i].state == FILE_SEND_EXITED) {
+			reap_file_send(&file_sends.sends[i]);
+		}
+		if (!send && file_sends.sends[i].state == FILE_SEND_IDLE) {
+			send = &file_sends.sends[i];
+		}
+	}
+
+	int status = 0;
+	if (file_sends.cancelled) {
+		goto out;
+	}
+	if (!send) {
+		xwarn("> Already offering %d files, try again once one is done\n", FILE_SENDS_MAX);
+		goto out;
+	}
+	if (!(send->file_path = xstrdup(file_path))) {
+		status = -1;
+		goto out;
+	}
+	send->shctx = shctx;
+	if (pthread_create(&send->thread, NULL, file_send_thread, send)) {
+		send->file_path = xfree(send->file_path);
+		status = -1;
+		goto out;
+	}
+	send->state = FILE_SEND_RUNNING;
+
+out:
+	pthread_mutex_unlock(&file_sends.lock);
+	return status;
+}
+
+// Withdraw every offer and wait for the file sends to wind down
+void file_sender_stop(void)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	file_sends.cancelled = true;
+	pthread_cond_broadcast(&file_sends.changed);
+	pthread_mutex_unlock(&file_sends.lock);
+
+	// Joined without the lock held, since each send takes it on its way out
+	for (size_t i = 0; i < FILE_SENDS_MAX; i++) {
+		file_send_t *send = &file_sends.sends[i];
+		pthread_mutex_lock(&file_sends.lock);
+		const bool started = send->state != FILE_SEND_IDLE;
+		pthread_mutex_unlock(&file_sends.lock);
+		if (!started) {
+			continue;
+		}
+		pthread_join(send->thread, NULL);
+		pthread_mutex_lock(&file_sends.lock);
+		send->file_path = xfree(send->file_path);
+		send->state = FILE_SEND_IDLE;
+		pthread_mutex_unlock(&file_sends.lock);
+	}
+}
+
+/**
+ * @brief Quiet the socket for a rekey: stop handing chunks to the pipelines, let those already handed over
+ * go out under the old session key, then take the send lock so nothing else is written until sends_resume()
+ */
+void sends_pause(void)
+{
+	pthread_mutex_lock(&file_sends.lock);
+	file_sends.rekeying = true;
+	while (file_sends.in_flight) {
+		pthread_cond_wait(&file_sends.changed, &file_sends.lock);
+	}
+	pthread_mutex_unlock(&file_sends.lock);
+	pthread_mutex_lock(&send_lock);
+}
+
+// Undo sends_pause() once the new session key is in place
+void sends_resume(void)
+{
+	pthread_mutex_unlock(&send_lock);
+	pthread_mutex_lock(&file_sends.lock);
+	file_sends.rekeying = false;
+	pthread_cond_broadcast(&file_sends.changed);
+	pthread_mutex_unlock(&file_sends.lock);
 }
 
 int announce_connection(client_t *ctx)
@@ -47,7 +755,7 @@ int announce_connection(client_t *ctx)
 		return -1;
 	}
 
-	if (send_encrypted_message(ctx->socket, TYPE_TEXT, msg, strlen(msg) + 1, ctx->keys.session) < 0) {
+	if (send_encrypted_message(ctx->socket, TYPE_TEXT, msg, strlen(msg) + 1, ctx->shctx) < 0) {
 		xfree(msg);
 		return -1;
 	}
@@ -84,13 +792,13 @@ int send_thread(void *ctx)
 			case SEND_NONE:
 				break;
 			case SEND_TEXT:
-				if (send_encrypted_message(client.socket, TYPE_TEXT, plaintext, length, client.keys.session) < 0) {
+				if (send_encrypted_message(client.socket, TYPE_TEXT, plaintext, length, client_ctx) < 0) {
 					xalert("Error sending encrypted text\n");
 					status = -1;
 				}
 				break;
 			case SEND_FILE:
-				if (send_encrypted_message(client.socket, TYPE_FILE, plaintext, length, client.keys.session) < 0) {
+				if (start_file_send(client_ctx, plaintext) < 0) {
 					xalert("Error sending encrypted file\n");
 					status = -1;
 				}
@@ -121,79 +829,151 @@ int send_thread(void *ctx)
 		return shutdown(client.socket, SHUT_RDWR) || status;
 }
 
-static int recv_remaining(client_t *ctx, wire_t **wire, size_t bytes_recv, size_t bytes_remaining)
+// Receive and verify the rest of a wire, returning WIRE_OK, WIRE_CMAC_ERROR, or -1 if it could not be received
+static int recv_remaining(client_t *ctx, wire_t **wire, size_t *len, size_t bytes_recv, size_t bytes_remaining, enum wire_suite suite, const uint8_t *key)
 {
 	size_t wire_size = bytes_recv + bytes_remaining;
+	if (wire_size > RECV_MAX_BYTES) {
+		return -1;
+	}
+
+	// Start verifying what has already arrived so the CMAC finishes with the last byte
+	wire_stream_t stream;
+	if (wire_stream_init(&stream, *wire, bytes_recv, suite, key)) {
+		return -1;
+	}
+
 	*wire = xrealloc(*wire, wire_size);
 	if (!*wire) {
 		return -1;
 	}
 
-	wire_t *dst = *wire;
+	uint8_t *dst = (uint8_t *)*wire + bytes_recv;
 	for (size_t i = 0; i < bytes_remaining;) {
-		ssize_t received = xrecv(ctx->socket, &dst->data[bytes_recv - sizeof(wire_t)] + i, bytes_remaining - i, 0);
-		switch (received) {
-			case -1:
-				return -1;
-			default:
-				i += received;
+		ssize_t received = xrecv(ctx->socket, &dst[i], bytes_remaining - i, 0);
+		if (received <= 0) {
+			return -1;
 		}
+		wire_stream_append(&stream, &dst[i], received);
+		i += received;
 	}
 
-	return decrypt_wire(*wire, &wire_size, ctx->keys.session) ? -1 : 0;
+	return wire_stream_decrypt(&stream, *wire, len);
 }
 
-wire_t *recv_new_wire(client_t *ctx, size_t *wire_size)
+// Receive just the header of the next wire, leaving the rest of it (and any wires behind it) on the socket.
+// `frame_length` is the length of the whole wire, as framed by the daemon
+wire_t *recv_new_wire(client_t *ctx, size_t *wire_size, size_t *frame_length)
 {
-	wire_t *wire = new_wire();
+	// The daemon frames what it relays. An abort left over from a key exchange that finished here before a member
+	// dropped out of it is answered like any other
+	wire_frame_t frame;
+	uint64_t length;
+	for (;;) {
+		if (xrecvall(ctx->socket, &frame, sizeof(frame))) {
+			return NULL;
+		}
+		length = wire_get_raw(frame.length);
+		if (wire_get_raw(frame.action) != FRAME_KEY_ABORT || length) {
+			break;
+		}
+		pthread_mutex_lock(&send_lock);
+		const int aborted = kx_send_abort(ctx->socket);
+		pthread_mutex_unlock(&send_lock);
+		if (aborted) {
+			return NULL;
+		}
+	}
+	if (length < sizeof(wire_t) || length > RECV_MAX_BYTES) {
+		xalert("> Received a malformed frame from the daemon\n");
+		return NULL;
+	}
+
+	wire_t *wire = xcalloc(sizeof(wire_t));
 	if (!wire) {
 		return NULL;
 	}
 
-	const ssize_t bytes_recv = xrecv(ctx->socket, wire, DATA_LEN_MAX, 0);
+	const ssize_t status = xrecvall(ctx->socket, wire, sizeof(wire_t));
 
 	// Refresh any changes to shared context that may have occured while blocking on recv
 	xmemcpy_locked(&ctx->shctx->mutex_lock, ctx, ctx->shctx, sizeof(client_t));
 
-	if (bytes_recv <= 0) {
+	if (status) {
 		return xfree(wire);
 	}
 
-	*wire_size = bytes_recv;
+	*wire_size = sizeof(wire_t);
+	*frame_length = length;
 	return wire;
 }
 
+// Read past the rest of a wire that cannot be opened, so the ones behind it still can
+static int skip_remaining(client_t *ctx, size_t remaining)
+{
+	uint8_t scratch[4096];
+	while (remaining) {
+		const size_t len = remaining < sizeof(scratch) ? remaining : sizeof(scratch);
+		if (xrecvall(ctx->socket, scratch, len)) {
+			return -1;
+		}
+		remaining -= len;
+	}
+	return 0;
+}
+
 /**
  * @brief Decrypts an encrypted wire
  *
  * @param ctx Client context
- * @param wire Wire received
+ * @param wire Wire received, reallocated if more of it has yet to arrive
  * @param bytes_recv Number of bytes received
- * @return Returns length of the wire data section, negative on error
+ * @param frame_length Length of the whole wire
+ * @return Returns length of the wire data section, negative on error. A wire that is dropped is freed and 0 returned
  */
-static ssize_t decrypt_received_message(client_t *ctx, wire_t *wire, size_t bytes_recv)
+static ssize_t decrypt_received_message(client_t *ctx, wire_t **wire, size_t bytes_recv, size_t frame_length)
 {
+	// Wires sealed just before a rekey are relayed after it, still under the previous session key
+	const struct {
+		enum wire_suite suite;
+		const uint8_t *key;
+	} candidates[] = {
+		{ ctx->keys.suite, ctx->keys.session },
+		{ ctx->keys.previous_suite, ctx->keys.previous },
+		{ SUITE_AES_CBC_CMAC, ctx->keys.ctrl }, // Control wires are always CBC
+	};
+
+	enum wire_suite suite = SUITE_AES_CBC_CMAC;
+	const uint8_t *key = NULL;
 	size_t length = bytes_recv;
-	switch (decrypt_wire(wire, &length, ctx->keys.session)) {
-		case WIRE_INVALID_KEY:
-			if (decrypt_wire(wire, &length, ctx->keys.ctrl)) {
-				xalert("> Recveived corrupted control key from server\n");
-				return -1;
-			}
-			break;
-		case WIRE_PARTIAL:
-			debug_print("> Received %zu bytes but header specifies %zu bytes total\n", bytes_recv, length + bytes_recv);
-			if (recv_remaining(ctx, &wire, bytes_recv, length)) {
-				xalert("recv_remaining()\n");
-				return -1;
-			}
-			debug_print("%s\n", "> received remainder of wire");
-			break;
-		case WIRE_CMAC_ERROR:
-			debug_print("%s\n", "> CMAC error");
+	int status = WIRE_INVALID_KEY;
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(*candidates) && status == WIRE_INVALID_KEY; i++) {
+		suite = candidates[i].suite;
+		key = candidates[i].key;
+		length = bytes_recv;
+		status = decrypt_wire(*wire, &length, suite, key);
+	}
+	// Sealed under a key this client never held, as one sent just before it joined can be
+	if (status == WIRE_INVALID_KEY) {
+		xwarn("> Dropped a message sealed under an unknown key\n");
+		*wire = xfree(*wire);
+		return skip_remaining(ctx, frame_length - bytes_recv) ? -1 : 0;
+	}
+
+	if (status == WIRE_PARTIAL) {
+		debug_print("> Received %zu bytes but header specifies %zu bytes total\n", bytes_recv, length + bytes_recv);
+		if ((status = recv_remaining(ctx, wire, &length, bytes_recv, length, suite, key)) < 0) {
+			xalert("recv_remaining()\n");
 			return -1;
-		case WIRE_OK:
-			break;
+		}
+		debug_print("%s\n", "> received remainder of wire");
+	}
+
+	// The whole wire has been taken off the socket, so one that fails its MAC costs only itself
+	if (status == WIRE_CMAC_ERROR) {
+		xwarn("> Dropped a message that failed authentication\n");
+		*wire = xfree(*wire);
+		return 0;
 	}
 	return length; // All good
 }
@@ -206,7 +986,8 @@ void *recv_thread(void *ctx)
 
 	for (;;) {
 		size_t bytes_recv = 0;
-		wire_t *wire = recv_new_wire(&client, &bytes_recv);
+		size_t frame_length = 0;
+		wire_t *wire = recv_new_wire(&client, &bytes_recv, &frame_length);
 		if (!wire) {
 			// TODO: cleanly exit without user interaction
 			if (!client.internal.kill_threads) {
@@ -220,12 +1001,16 @@ void *recv_thread(void *ctx)
 			break;
 		}
 
-		if (decrypt_received_message(&client, wire, bytes_recv) < 0) {
+		const ssize_t length = decrypt_received_message(&client, &wire, bytes_recv, frame_length);
+		if (length < 0) {
 			xfree(wire);
 			break;
 		}
+		if (!wire) {
+			continue;
+		}
 
-		if (proc_type(&client, wire) < 0) {
+		if (proc_type(&client, wire, length) < 0) {
 			xfree(wire);
 			break;
 		}
@@ -234,6 +1019,8 @@ void *recv_thread(void *ctx)
 		(void)nanosleep(&ts, NULL);
 	}
 
+	file_sender_stop();
+	file_writer_stop();
 	xclose(client.socket);
 	return xfree(client_ctx);
 }
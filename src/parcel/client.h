@@ -21,7 +21,9 @@
 enum ParcelConstants {
 	USERNAME_MAX_LENGTH = 32,
 	PORT_MAX_LENGTH = 6,
-	ADDRESS_MAX_LENGTH = 32
+	ADDRESS_MAX_LENGTH = 32,
+	FILE_OFFER_TIMEOUT = 60, // Seconds a file offer stays open for members to accept
+	FILE_SENDS_MAX = 4,      // Files on offer at once
 };
 
 enum command_id {
@@ -35,6 +37,7 @@ enum command_id {
 	CMD_CLEAR,
 	CMD_VERSION,
 	CMD_AMBIGUOUS_WIDTH,
+	CMD_ACCEPT,
 };
 
 enum SendType {
@@ -56,6 +59,9 @@ struct username {
 struct keys {
 	uint8_t session[KEY_LEN]; // Group-derived symmetric key
 	uint8_t ctrl[KEY_LEN];    // Ephemeral daemon control key
+	enum wire_suite suite;    // Cipher suite chosen for the group by the daemon
+	uint8_t previous[KEY_LEN]; // Session key before the last rekey, for wires sealed just before it
+	enum wire_suite previous_suite;
 };
 
 struct client_internal {
@@ -81,7 +87,15 @@ int parse_input(client_t *ctx, enum command_id *cmd, char **message, size_t *mes
 
 void prompt_args(char *address, struct username *username);
 
-int proc_type(client_t *ctx, wire_t *wire);
+int proc_type(client_t *ctx, wire_t *wire, size_t length);
+ssize_t send_routed_message(sock_t socket, uint64_t type, void *data, size_t length, client_t *shctx, enum frame_action action, const uint8_t *route);
+ssize_t send_encrypted_message(sock_t socket, uint64_t type, void *data, size_t length, client_t *shctx);
+void merge_file_want(const struct wire_file_message *want, size_t length);
+void file_sender_stop(void);
+void sends_pause(void);
+void sends_resume(void);
+int accept_file_offer(client_t *shctx);
+void file_writer_stop(void);
 
 void disp_username(struct username *username);
 int cmd_exit(client_t *ctx, char **message, size_t *message_length);
@@ -47,7 +47,7 @@ static int cmd_username(client_t *ctx, char **message, size_t *message_length)
 	return 0;
 }
 
-// TODO: This should not be fatal
+// Check the file can be sent and hand its path to send_thread(), which offers it to the group
 static int cmd_send_file(char **message, size_t *message_length)
 {
 	size_t path_length = FILE_PATH_MAX_LENGTH;
@@ -55,69 +55,31 @@ static int cmd_send_file(char **message, size_t *message_length)
 
 	if (!xfexists(file_path)) {
 		xwarn("> File \"%s\" not found\n", file_path);
-		goto free_path;
+		xfree(file_path);
+		return -1;
 	}
 
-	size_t file_size = xfilesize(file_path);
-	if (!file_size) {
+	if (!xfilesize(file_path)) {
 		xwarn("> Unable to determine size of file \"%s\"\n", file_path);
-		goto free_path;
-	}
-
-	if (file_size > FILE_DATA_MAX_SIZE) {
-		const size_t overage = file_size - FILE_DATA_MAX_SIZE;
-		xwarn("> File \"%s\" is %zu bytes over the maximum size of %d bytes\n", file_path, overage, FILE_DATA_MAX_SIZE);
-		goto free_path;
-	}
-
-	*message_length = file_size + sizeof(struct wire_file_message); // To hold file name and data
-	struct wire_file_message *file_contents = xcalloc(*message_length);
-	if (!file_contents) {
-		goto free_all;
-	}
-	
-	wire_set_raw(file_contents->filesize, file_size);
-	
-	FILE *file = fopen(file_path, "rb");
-	if (!file) {
-		xwarn("> Could not open file \"%s\" for reading\n", file_path);
-		goto free_all;
-	}
-
-	char filename[FILE_NAME_LEN];
-	memset(filename, 0, sizeof(filename));
-
-	const size_t filename_length = xbasename(file_path, filename) + 1;
-	memcpy(file_contents->filename, filename, filename_length);
-	
-	// Now read in the file contents
-	if (fread(file_contents->filedata, 1, file_size, file) != file_size) {
-		xwarn("> Error reading contents of file\n");
-		(void)fclose(file);
-		goto free_all;
+		xfree(file_path);
+		return -1;
 	}
 
-	(void)fclose(file);
-
 	xfree(*message);
-	*message = (char *)file_contents;
+	*message = file_path;
+	*message_length = path_length;
 	return 0;
-
-free_all:
-	xfree(file_contents);
-free_path:
-	xfree(file_path);
-	return -1;
 }
 
-static void cmd_print_enc_info(uint8_t *session, uint8_t *control)
+static void cmd_print_enc_info(struct keys *keys)
 {
 	printf("Session Key: ");
 	fflush(stdout);
-	xmemprint(session, KEY_LEN);
+	xmemprint(keys->session, KEY_LEN);
 	printf("Control Key: ");
 	fflush(stdout);
-	xmemprint(control, KEY_LEN);
+	xmemprint(keys->ctrl, KEY_LEN);
+	printf("Cipher Suite: %s\n", wire_suite_name(keys->suite));
 }
 
 static void cmd_clear(void)
@@ -171,10 +133,11 @@ static int cmd_list(void)
 		"  /x            exit the server and close parcel\n"
 		"  /username     change username\n"
 		"  /encinfo      display current encryption parameters\n"
-		"  /file         send a file\n"
+		"  /file         offer a file to the group\n"
 		"  /clear        clear the screen\n"
 		"  /version      print build version\n"
-		"  /ambwidth     set ambiguous character width\n";
+		"  /ambwidth     set ambiguous character width\n"
+		"  /accept       receive the most recently offered file\n";
 	return !printf("%s", list);
 }
 
@@ -192,7 +155,7 @@ static int cmd_ambiguous(void)
 static enum command_id parse_command(char *command)
 {
 	static const char *command_strings[] = {
-		"/list", "/x", "/username", "/encinfo", "/file", "/clear", "/version", "/ambwidth"
+		"/list", "/x", "/username", "/encinfo", "/file", "/clear", "/version", "/ambwidth", "/accept"
 	};
 
 	const size_t commands = sizeof(command_strings) / sizeof(*command_strings);
@@ -232,7 +195,7 @@ int parse_input(client_t *ctx, enum command_id *cmd, char **message, size_t *mes
 			case CMD_USERNAME:
 				return cmd_username(ctx, message, message_length) ? -1 : SEND_TEXT;
 			case CMD_ENC_INFO:
-				cmd_print_enc_info(ctx->keys.session, ctx->keys.ctrl);
+				cmd_print_enc_info(&ctx->keys);
 				return SEND_NONE;
 			case CMD_FILE:
 				return cmd_send_file(message, message_length) ? SEND_NONE : SEND_FILE;
@@ -244,6 +207,8 @@ int parse_input(client_t *ctx, enum command_id *cmd, char **message, size_t *mes
 				return SEND_NONE;
 			case CMD_AMBIGUOUS_WIDTH:
 				return cmd_set_ambiguous_width() ? -1 : SEND_NONE;
+			case CMD_ACCEPT:
+				return accept_file_offer(ctx->shctx) ? -1 : SEND_NONE;
 			default:
 				return cmd_not_found(*message) ? -1 : SEND_NONE;
 		}
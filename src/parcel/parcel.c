@@ -95,6 +95,11 @@ int main(int argc, char **argv)
 		}
 	}
 	
+	// Key pairs are generated while the user fills in the prompts
+	if (key_pool_start()) {
+		xwarn("Unable to start key generation thread\n");
+	}
+
 	if (argc < 5) {
 		prompt_args(address, &client->username);
 	}
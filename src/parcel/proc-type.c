@@ -11,34 +11,559 @@
 
 #include "client.h"
 
-static int proc_file(void *data)
+enum FileTransfers {
+	FILE_TRANSFERS_MAX = 8, // Files being received at once
+	FILE_QUEUE_LEN = 16,    // Chunks waiting on the disk writer
+	FILE_OFFERS_MAX = 8,    // Offers remembered until they are accepted or expire
+};
+
+enum FileJob {
+	FILE_JOB_WIRE,   // A file wire from the daemon
+	FILE_JOB_ACCEPT, // The user accepted the latest offer
+	FILE_JOB_STOP,   // Finish up
+};
+
+// A file being received, written out and hashed chunk by chunk. Which chunks have arrived is kept in a
+// sidecar file next to it, so a transfer cut short can be resumed when the file is offered again
+typedef struct file_transfer_t {
+	uint8_t file_id[FILE_ID_LEN];
+	char filename[64];
+	char *save_path;
+	char *sidecar_path;
+	FILE *file;
+	FILE *sidecar;
+	uint64_t filesize;
+	size_t chunks;
+	uint8_t *have;    // One bit per chunk written out
+	size_t missing;   // Chunks not yet written out
+	uint8_t *hashed;  // One bit per chunk hashed on arrival, chunks from an earlier offer are read back
+	uint8_t *digests; // SHA-256 of each hashed chunk
+	uint8_t digest[FILE_DIGEST_LEN]; // From the offer
+} file_transfer_t;
+
+// Sidecar layout, followed by the `have` bitmap
+struct file_sidecar {
+	uint8_t file_id[FILE_ID_LEN];
+	uint8_t filesize[16];
+};
+
+enum TransferEnd {
+	TRANSFER_COMPLETE, // Keep the file, drop the sidecar
+	TRANSFER_PAUSED,   // Keep both so the file can be resumed
+	TRANSFER_FAILED,   // Remove both
+};
+
+// An offer waiting on /accept
+typedef struct file_offer_t {
+	struct wire_file_message message;
+	time_t received; // 0 if the slot is free
+} file_offer_t;
+
+// Only the disk writer thread touches these
+static file_transfer_t transfers[FILE_TRANSFERS_MAX];
+static file_offer_t offers[FILE_OFFERS_MAX];
+
+// File wires handed from the receive thread to the disk writer
+static struct file_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t pushed; // Signalled whenever a wire is queued
+	pthread_cond_t popped; // Signalled whenever a wire is taken
+	struct {
+		enum FileJob job;
+		client_t *shctx;
+		wire_t *wire;
+		size_t length;
+	} entries[FILE_QUEUE_LEN];
+	size_t head;
+	size_t count;
+	pthread_t thread;
+	bool running;
+} file_queue = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.pushed = PTHREAD_COND_INITIALIZER,
+	.popped = PTHREAD_COND_INITIALIZER,
+};
+
+static file_transfer_t *find_transfer(const uint8_t *file_id)
 {
-	struct wire_file_message *wire_file = (struct wire_file_message *)data;
-	printf("\n\033[1mReceived file \"%s\"\033[0m\n", wire_file->filename);
-	char *save_path = xget_dir(wire_file->filename);
-	if (!save_path) {
-		return -1;
+	for (size_t i = 0; i < FILE_TRANSFERS_MAX; i++) {
+		if (transfers[i].file && !memcmp(transfers[i].file_id, file_id, sizeof(transfers[i].file_id))) {
+			return &transfers[i];
+		}
 	}
-	FILE *file = fopen(save_path, "wb");
-	if (!file) {
-		xwarn("> Could not open file \"%s\" for writing\n", wire_file->filename);
-		return -1;
+	return NULL;
+}
+
+static bool have_chunk(const file_transfer_t *transfer, size_t index)
+{
+	return transfer->have[index / 8] & (1 << (index % 8));
+}
+
+static bool hashed_chunk(const file_transfer_t *transfer, size_t index)
+{
+	return transfer->hashed[index / 8] & (1 << (index % 8));
+}
+
+static size_t chunk_size(const file_transfer_t *transfer, size_t index)
+{
+	const uint64_t offset = (uint64_t)index * FILE_CHUNK_LEN;
+	return transfer->filesize - offset < FILE_CHUNK_LEN ? transfer->filesize - offset : FILE_CHUNK_LEN;
+}
+
+// Also tidies up after a transfer that was only partly set up
+static void end_transfer(file_transfer_t *transfer, enum TransferEnd end)
+{
+	if (transfer->file) {
+		(void)fclose(transfer->file);
+	}
+	if (transfer->sidecar) {
+		(void)fclose(transfer->sidecar);
+	}
+	if (end != TRANSFER_PAUSED) {
+		(void)remove(transfer->sidecar_path);
+	}
+	if (end == TRANSFER_FAILED) {
+		(void)remove(transfer->save_path);
+	}
+	xfree(transfer->save_path);
+	xfree(transfer->sidecar_path);
+	xfree(transfer->have);
+	xfree(transfer->hashed);
+	xfree(transfer->digests);
+	memset(transfer, 0, sizeof(file_transfer_t));
+}
+
+// Pick up a partial file left by an earlier offer of the same file
+static bool resume_transfer(file_transfer_t *transfer)
+{
+	transfer->sidecar = fopen(transfer->sidecar_path, "r+b");
+	if (!transfer->sidecar) {
+		return false;
 	}
-	xfree(save_path);
 
-	const size_t file_data_size = wire_pack64(wire_file->filesize);
-	if (fwrite(wire_file->filedata, 1, file_data_size, file) != file_data_size) {
-		xwarn("> Error writing to file \"%s\"\n", wire_file->filename);
-		(void)fclose(file);
-		xfree(wire_file->filename);
+	struct file_sidecar header;
+	const size_t bitmap_length = (transfer->chunks + 7) / 8;
+	if (fread(&header, 1, sizeof(header), transfer->sidecar) != sizeof(header) ||
+		memcmp(header.file_id, transfer->file_id, FILE_ID_LEN) || wire_get_raw(header.filesize) != transfer->filesize ||
+		fread(transfer->have, 1, bitmap_length, transfer->sidecar) != bitmap_length ||
+		!(transfer->file = fopen(transfer->save_path, "r+b"))) {
+		(void)fclose(transfer->sidecar);
+		transfer->sidecar = NULL;
+		memset(transfer->have, 0, bitmap_length);
+		return false;
+	}
+	for (size_t i = 0; i < transfer->chunks; i++) {
+		transfer->missing -= have_chunk(transfer, i);
+	}
+	return true;
+}
+
+static bool create_transfer(file_transfer_t *transfer)
+{
+	transfer->file = fopen(transfer->save_path, "w+b");
+	transfer->sidecar = fopen(transfer->sidecar_path, "w+b");
+	if (!transfer->file || !transfer->sidecar) {
+		return false;
+	}
+
+	struct file_sidecar header;
+	memcpy(header.file_id, transfer->file_id, FILE_ID_LEN);
+	wire_set_raw(header.filesize, transfer->filesize);
+	const size_t bitmap_length = (transfer->chunks + 7) / 8;
+	return fwrite(&header, 1, sizeof(header), transfer->sidecar) == sizeof(header) &&
+		fwrite(transfer->have, 1, bitmap_length, transfer->sidecar) == bitmap_length &&
+		!fflush(transfer->sidecar);
+}
+
+static file_transfer_t *begin_transfer(const struct wire_file_message *wire_file)
+{
+	file_transfer_t *transfer = NULL;
+	for (size_t i = 0; i < FILE_TRANSFERS_MAX; i++) {
+		if (!transfers[i].file) {
+			transfer = &transfers[i];
+			break;
+		}
+	}
+	if (!transfer) {
+		xwarn("> Too many files being received, dropping \"%.*s\"\n", (int)sizeof(wire_file->filename), wire_file->filename);
+		return NULL;
+	}
+
+	memcpy(transfer->filename, wire_file->filename, sizeof(transfer->filename));
+	transfer->filename[sizeof(transfer->filename) - 1] = 0;
+	memcpy(transfer->file_id, wire_file->file_id, sizeof(transfer->file_id));
+	transfer->filesize = wire_get_raw((uint8_t *)wire_file->filesize);
+	transfer->chunks = (transfer->filesize + FILE_CHUNK_LEN - 1) / FILE_CHUNK_LEN;
+	transfer->missing = transfer->chunks;
+	memcpy(transfer->digest, wire_file->digest, sizeof(transfer->digest));
+
+	transfer->save_path = xget_dir(transfer->filename);
+	transfer->sidecar_path = transfer->save_path ? xstrcat(2, transfer->save_path, ".parcel") : NULL;
+	transfer->have = xcalloc((transfer->chunks + 7) / 8);
+	transfer->hashed = xcalloc((transfer->chunks + 7) / 8);
+	transfer->digests = xmalloc(transfer->chunks * SHA256_DIGEST_LEN);
+	if (!transfer->sidecar_path || !transfer->have || !transfer->hashed || !transfer->digests) {
+		end_transfer(transfer, TRANSFER_PAUSED);
+		return NULL;
+	}
+
+	if (resume_transfer(transfer)) {
+		return transfer;
+	}
+	if (!create_transfer(transfer)) {
+		xwarn("> Could not open file \"%s\" for writing\n", transfer->filename);
+		end_transfer(transfer, TRANSFER_FAILED);
+		return NULL;
+	}
+
+	// Claim the whole file now so chunks land in place
+	if (xfallocate(transfer->file, transfer->filesize)) {
+		xwarn("> Not enough space to receive file \"%s\"\n", transfer->filename);
+		end_transfer(transfer, TRANSFER_FAILED);
+		return NULL;
+	}
+	return transfer;
+}
+
+// Hash the whole chunks not hashed on arrival side by side, reading them back from disk
+static int hash_written_chunks(file_transfer_t *transfer)
+{
+	uint8_t *buffer = xmalloc(SHA256_LANES_MAX * FILE_CHUNK_LEN);
+	if (!buffer) {
 		return -1;
 	}
 
-	if (fflush(file) || fclose(file)) {
-		xwarn("> Error closing file \"%s\"\n", wire_file->filename);
+	const void *chunks[SHA256_LANES_MAX];
+	uint8_t *digests[SHA256_LANES_MAX];
+	size_t count = 0;
+	for (size_t i = 0; i < transfer->chunks; i++) {
+		if (hashed_chunk(transfer, i) || chunk_size(transfer, i) != FILE_CHUNK_LEN) {
+			continue;
+		}
+		if (xfseek(transfer->file, (uint64_t)i * FILE_CHUNK_LEN) ||
+			fread(&buffer[count * FILE_CHUNK_LEN], 1, FILE_CHUNK_LEN, transfer->file) != FILE_CHUNK_LEN) {
+			xfree(buffer);
+			return -1;
+		}
+		chunks[count] = &buffer[count * FILE_CHUNK_LEN];
+		digests[count++] = &transfer->digests[i * SHA256_DIGEST_LEN];
+		transfer->hashed[i / 8] |= 1 << (i % 8);
+
+		if (count == SHA256_LANES_MAX) {
+			sha256_chunks(chunks, FILE_CHUNK_LEN, digests, count);
+			count = 0;
+		}
+	}
+	sha256_chunks(chunks, FILE_CHUNK_LEN, digests, count);
+	xfree(buffer);
+	return 0;
+}
+
+// SHA-256 over the digests of every chunk, hashing those that were not hashed on arrival
+static int finish_hash(file_transfer_t *transfer, uint8_t *digest)
+{
+	if (hash_written_chunks(transfer)) {
 		return -1;
 	}
 
+	// A short last chunk is all that can be left
+	const size_t last = transfer->chunks - 1;
+	if (transfer->chunks && !hashed_chunk(transfer, last)) {
+		const size_t length = chunk_size(transfer, last);
+		uint8_t *buffer = xmalloc(length);
+		if (!buffer || xfseek(transfer->file, (uint64_t)last * FILE_CHUNK_LEN) || fread(buffer, 1, length, transfer->file) != length) {
+			xfree(buffer);
+			return -1;
+		}
+		sha256_t sha;
+		sha256_init(&sha);
+		sha256_append(&sha, buffer, length);
+		sha256_finish(&sha, &transfer->digests[last * SHA256_DIGEST_LEN]);
+		xfree(buffer);
+	}
+
+	sha256_t sha;
+	sha256_init(&sha);
+	sha256_append(&sha, transfer->digests, transfer->chunks * SHA256_DIGEST_LEN);
+	sha256_finish(&sha, digest);
+	return 0;
+}
+
+// Check the whole file against the digest from the offer once every chunk is in
+static void finish_file(file_transfer_t *transfer)
+{
+	uint8_t digest[FILE_DIGEST_LEN];
+	if (finish_hash(transfer, digest)) {
+		xwarn("> Error reading back file \"%s\"\n", transfer->filename);
+		end_transfer(transfer, TRANSFER_PAUSED);
+		return;
+	}
+	if (memcmp(digest, transfer->digest, FILE_DIGEST_LEN)) {
+		xwarn("> File \"%s\" does not match what was sent, discarding it\n", transfer->filename);
+		end_transfer(transfer, TRANSFER_FAILED);
+		return;
+	}
+
+	printf("\n\033[1mReceived file \"%s\"\033[0m\n", transfer->filename);
+	end_transfer(transfer, TRANSFER_COMPLETE);
+}
+
+// Write out a chunk at its offset and record it in the sidecar
+static void write_chunk(file_transfer_t *transfer, const struct wire_file_message *wire_file, size_t length)
+{
+	const uint64_t offset = wire_get_raw((uint8_t *)wire_file->offset);
+	const uint64_t chunk_length = wire_get_raw((uint8_t *)wire_file->length);
+	const size_t index = offset / FILE_CHUNK_LEN;
+	if (offset % FILE_CHUNK_LEN || index >= transfer->chunks || chunk_length > length ||
+		chunk_length != (transfer->filesize - offset < FILE_CHUNK_LEN ? transfer->filesize - offset : FILE_CHUNK_LEN)) {
+		return;
+	}
+
+	// Another receiver may have asked for a chunk already here
+	if (have_chunk(transfer, index)) {
+		return;
+	}
+
+	// Chunks are hashed on their own, so the order they arrive in does not matter
+	sha256_t sha;
+	sha256_init(&sha);
+	sha256_append(&sha, wire_file->filedata, chunk_length);
+	sha256_finish(&sha, &transfer->digests[index * SHA256_DIGEST_LEN]);
+	transfer->hashed[index / 8] |= 1 << (index % 8);
+
+	for (size_t i = 0; i < chunk_length; i += FILE_IO_CHUNK) {
+		const size_t step = chunk_length - i < FILE_IO_CHUNK ? chunk_length - i : FILE_IO_CHUNK;
+		if (xpwrite(transfer->file, &wire_file->filedata[i], step, offset + i) != (ssize_t)step) {
+			xwarn("> Error writing to file \"%s\"\n", transfer->filename);
+			end_transfer(transfer, TRANSFER_PAUSED);
+			return;
+		}
+	}
+	transfer->have[index / 8] |= 1 << (index % 8);
+	if (xpwrite(transfer->sidecar, &transfer->have[index / 8], 1, sizeof(struct file_sidecar) + index / 8) != 1) {
+		xwarn("> Error writing to file \"%s\"\n", transfer->filename);
+		end_transfer(transfer, TRANSFER_PAUSED);
+		return;
+	}
+	if (!--transfer->missing) {
+		finish_file(transfer);
+	}
+}
+
+// Join an offer's route with the chunks still missing, which is every chunk unless a partial copy was found
+static void want_file(client_t *shctx, const struct wire_file_message *offer)
+{
+	file_transfer_t *transfer = find_transfer(offer->file_id);
+	if (!transfer && !(transfer = begin_transfer(offer))) {
+		return;
+	}
+
+	// Cut short after the last chunk was written but before it was checked
+	if (!transfer->missing) {
+		finish_file(transfer);
+		return;
+	}
+
+	const size_t bitmap_length = (transfer->chunks + 7) / 8;
+	struct wire_file_message *want = xcalloc(sizeof(struct wire_file_message) + bitmap_length);
+	if (!want) {
+		return;
+	}
+	memcpy(want, offer, sizeof(struct wire_file_message));
+	wire_set_raw(want->function, FILE_WANT);
+	wire_set_raw(want->length, bitmap_length);
+	for (size_t i = 0; i < transfer->chunks; i++) {
+		if (!have_chunk(transfer, i)) {
+			want->filedata[i / 8] |= 1 << (i % 8);
+		}
+	}
+
+	client_t client;
+	xmemcpy_locked(&shctx->mutex_lock, &client, shctx, sizeof(client_t));
+	if (send_routed_message(client.socket, TYPE_FILE, want, sizeof(struct wire_file_message) + bitmap_length, shctx, FRAME_ROUTE_JOIN, offer->route) < 0) {
+		xwarn("> Unable to request file \"%s\"\n", transfer->filename);
+	}
+	xfree(want);
+}
+
+// Remember an offer until the user accepts it, replacing the oldest one if there is no room
+static void remember_offer(const struct wire_file_message *offer)
+{
+	file_offer_t *slot = &offers[0];
+	for (size_t i = 0; i < FILE_OFFERS_MAX; i++) {
+		if (offers[i].received && !memcmp(offers[i].message.file_id, offer->file_id, FILE_ID_LEN)) {
+			slot = &offers[i];
+			break;
+		}
+		if (offers[i].received < slot->received) {
+			slot = &offers[i];
+		}
+	}
+	memcpy(&slot->message, offer, sizeof(struct wire_file_message));
+	slot->message.filename[sizeof(slot->message.filename) - 1] = 0;
+	slot->received = time(NULL);
+
+	printf("\n\033[1mFile \"%s\" (%llu bytes) offered, enter /accept to receive it\033[0m\n",
+		slot->message.filename, (unsigned long long)wire_get_raw(slot->message.filesize));
+}
+
+static void forget_offer(const uint8_t *file_id)
+{
+	for (size_t i = 0; i < FILE_OFFERS_MAX; i++) {
+		if (offers[i].received && !memcmp(offers[i].message.file_id, file_id, FILE_ID_LEN)) {
+			memset(&offers[i], 0, sizeof(file_offer_t));
+		}
+	}
+}
+
+// Receive the most recent offer that is still open
+static void accept_offer(client_t *shctx)
+{
+	const time_t now = time(NULL);
+	file_offer_t *latest = NULL;
+	for (size_t i = 0; i < FILE_OFFERS_MAX; i++) {
+		if (offers[i].received && now - offers[i].received < FILE_OFFER_TIMEOUT &&
+			(!latest || offers[i].received >= latest->received)) {
+			latest = &offers[i];
+		}
+	}
+	if (!latest) {
+		xwarn("> No file offers to accept\n");
+		return;
+	}
+
+	const struct wire_file_message offer = latest->message;
+	memset(latest, 0, sizeof(file_offer_t));
+	printf("\033[1mReceiving file \"%s\"\033[0m\n", offer.filename);
+	want_file(shctx, &offer);
+}
+
+// Handle one file wire on the disk writer thread. Problems with a file only end its transfer
+static void proc_file(void *data, size_t length)
+{
+	struct wire_file_message *wire_file = (struct wire_file_message *)data;
+	if (length < sizeof(struct wire_file_message)) {
+		return;
+	}
+	length -= sizeof(struct wire_file_message);
+
+	file_transfer_t *transfer = NULL;
+	switch (wire_get_raw(wire_file->function)) {
+		case FILE_OFFER:
+			remember_offer(wire_file);
+			break;
+		case FILE_WANT:
+			merge_file_want(wire_file, length);
+			break;
+		case FILE_CHUNK:
+			if ((transfer = find_transfer(wire_file->file_id))) {
+				write_chunk(transfer, wire_file, length);
+			}
+			break;
+		case FILE_DONE:
+			// Complete transfers have already been checked and closed
+			forget_offer(wire_file->file_id);
+			if ((transfer = find_transfer(wire_file->file_id))) {
+				xwarn("> File \"%s\" is incomplete, it will resume if sent again\n", transfer->filename);
+				end_transfer(transfer, TRANSFER_PAUSED);
+			}
+			break;
+	}
+}
+
+// Wait for room in the queue, then add a job to the back of it
+static void file_queue_push(enum FileJob job, client_t *shctx, wire_t *wire, size_t length)
+{
+	pthread_mutex_lock(&file_queue.lock);
+	while (file_queue.count == FILE_QUEUE_LEN) {
+		pthread_cond_wait(&file_queue.popped, &file_queue.lock);
+	}
+	const size_t tail = (file_queue.head + file_queue.count++) % FILE_QUEUE_LEN;
+	file_queue.entries[tail].job = job;
+	file_queue.entries[tail].shctx = shctx;
+	file_queue.entries[tail].wire = wire;
+	file_queue.entries[tail].length = length;
+	pthread_cond_signal(&file_queue.pushed);
+	pthread_mutex_unlock(&file_queue.lock);
+}
+
+static void *file_writer_thread(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&file_queue.lock);
+		while (!file_queue.count) {
+			pthread_cond_wait(&file_queue.pushed, &file_queue.lock);
+		}
+		const enum FileJob job = file_queue.entries[file_queue.head].job;
+		client_t *shctx = file_queue.entries[file_queue.head].shctx;
+		wire_t *wire = file_queue.entries[file_queue.head].wire;
+		const size_t length = file_queue.entries[file_queue.head].length;
+		file_queue.head = (file_queue.head + 1) % FILE_QUEUE_LEN;
+		file_queue.count--;
+		pthread_cond_signal(&file_queue.popped);
+		pthread_mutex_unlock(&file_queue.lock);
+
+		if (job == FILE_JOB_STOP) {
+			break;
+		}
+		if (job == FILE_JOB_ACCEPT) {
+			accept_offer(shctx);
+			continue;
+		}
+		proc_file(wire->data, length);
+		xfree(wire);
+	}
+
+	// Whatever is still incomplete can be resumed later
+	for (size_t i = 0; i < FILE_TRANSFERS_MAX; i++) {
+		if (transfers[i].file) {
+			end_transfer(&transfers[i], TRANSFER_PAUSED);
+		}
+	}
+	return NULL;
+}
+
+static int file_writer_start(void)
+{
+	pthread_mutex_lock(&file_queue.lock);
+	if (!file_queue.running) {
+		if (pthread_create(&file_queue.thread, NULL, file_writer_thread, NULL)) {
+			pthread_mutex_unlock(&file_queue.lock);
+			return -1;
+		}
+		file_queue.running = true;
+	}
+	pthread_mutex_unlock(&file_queue.lock);
+	return 0;
+}
+
+void file_writer_stop(void)
+{
+	pthread_mutex_lock(&file_queue.lock);
+	const bool running = file_queue.running;
+	file_queue.running = false;
+	pthread_mutex_unlock(&file_queue.lock);
+	if (!running) {
+		return;
+	}
+
+	// Let the writer drain everything queued ahead of the stop request
+	file_queue_push(FILE_JOB_STOP, NULL, NULL, 0);
+	pthread_join(file_queue.thread, NULL);
+}
+
+/**
+ * @brief Accept the most recent file offer. The disk writer takes it from here, since it owns the transfers
+ *
+ * @return 0 on success, -1 if the disk writer could not be started
+ */
+int accept_file_offer(client_t *shctx)
+{
+	if (file_writer_start()) {
+		return -1;
+	}
+	file_queue_push(FILE_JOB_ACCEPT, shctx, NULL, 0);
 	return 0;
 }
 
@@ -55,8 +580,21 @@ static int proc_ctrl(client_t *ctx, void *data)
 	switch (wire_get_ctrl_function(wire_ctrl)) {
 		case CTRL_EXIT:
 			return CTRL_EXIT;
-		case CTRL_DHKE:
-			switch (n_party_client(ctx->socket, ctx->keys.session, wire_get_ctrl_args(wire_ctrl))) {
+		case CTRL_DHKE: {
+			// Chunks already sealed go out ahead of the exchange, and nothing else is sent until the new key is in place
+			sends_pause();
+			uint8_t session_key[KEY_LEN];
+			const int status = n_party_client(ctx->socket, session_key, wire_get_ctrl_args(wire_ctrl));
+			if (status == DHKE_OK) {
+				memcpy(ctx->keys.previous, ctx->keys.session, KEY_LEN);
+				ctx->keys.previous_suite = ctx->keys.suite;
+				memcpy(ctx->keys.session, session_key, KEY_LEN);
+				ctx->keys.suite = wire_get_ctrl_suite(wire_ctrl);
+				xmemcpy_locked(&ctx->shctx->mutex_lock, &ctx->shctx->keys, &ctx->keys, sizeof(struct keys));
+			}
+			sends_resume();
+
+			switch (status) {
 				case DHKE_OK:
 					if (!ctx->internal.conn_announced) {
 						if (announce_connection(ctx)) {
@@ -64,9 +602,13 @@ static int proc_ctrl(client_t *ctx, void *data)
 						}
 					}
 					return CTRL_DHKE;
+				case DHKE_ABORTED:
+					// A member dropped out, the daemon starts over without it under the renewed control key
+					return CTRL_DHKE;
 				case DHKE_ERROR:
 					return DHKE_ERROR;
 			}
+		}
 	}
 	return -1;
 }
@@ -75,10 +617,11 @@ static int proc_ctrl(client_t *ctx, void *data)
  * @brief Process a received and (successfully) decrypted wire
  * 
  * @param ctx Client context
- * @param wire Wire to process
+ * @param wire Wire to process, freed here (or by the disk writer) on success
+ * @param length Length of the wire data section
  * @return Returns a wire_type enum on success, otherwise -1
  */
-int proc_type(client_t *ctx, wire_t *wire)
+int proc_type(client_t *ctx, wire_t *wire, size_t length)
 {
 	enum wire_type type = wire_get_type(wire);
 	switch (type) {
@@ -94,15 +637,18 @@ int proc_type(client_t *ctx, wire_t *wire)
 			}
 			break;
 		case TYPE_FILE:
-			if (proc_file(wire->data)) {
-				xalert("proc_file()\n");
+			// Disk writes happen off the receive thread so they never hold up the wires behind them
+			if (file_writer_start()) {
+				xalert("file_writer_start()\n");
 				return -1;
 			}
-			break;
+			file_queue_push(FILE_JOB_WIRE, ctx->shctx, wire, length);
+			return type;
 		case TYPE_TEXT:
 			proc_text(wire->data);
 			disp_username(&ctx->username);
 			break;
 	}
+	xfree(wire);
 	return type;
 }
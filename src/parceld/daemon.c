@@ -31,6 +31,33 @@ int init_daemon(server_t *ctx)
 		return -1;
 	}
 
+	if (!(ctx->sockets.suites = xcalloc(sizeof(wire_suites_t) * ctx->sockets.max_nsfds))) {
+		xalert("xcalloc()");
+		return -1;
+	}
+
+	if (!(ctx->sockets.frames = xcalloc(sizeof(frame_buffer_t) * ctx->sockets.max_nsfds))) {
+		xalert("xcalloc()");
+		return -1;
+	}
+
+	if (!(ctx->sockets.outputs = xcalloc(sizeof(output_queue_t) * ctx->sockets.max_nsfds))) {
+		xalert("xcalloc()");
+		return -1;
+	}
+
+	if (!(ctx->sockets.joining = xcalloc(sizeof(bool) * ctx->sockets.max_nsfds))) {
+		xalert("xcalloc()");
+		return -1;
+	}
+
+	for (size_t i = 0; i < ROUTES_MAX; i++) {
+		if (!(ctx->routes[i].members = xcalloc(sizeof(sock_t) * ctx->sockets.max_nsfds))) {
+			xalert("xcalloc()");
+			return -1;
+		}
+	}
+
 	struct addrinfo hints = {
 		.ai_family = AF_INET,
 		.ai_socktype = SOCK_STREAM,
@@ -86,7 +113,7 @@ int init_daemon(server_t *ctx)
 // Return `i` such that `srv`->sockets[i] == `socket`
 static size_t socket_index(server_t *srv, sock_t socket)
 {
-	for (size_t i = 1; i <= srv->sockets.max_nsfds; i++) {
+	for (size_t i = 1; i <= srv->sockets.nsfds; i++) {
 		if (srv->sockets.sfds[i] == socket) {
 			debug_print("Got socket index %zu\n", i);
 			return i;
@@ -95,128 +122,739 @@ static size_t socket_index(server_t *srv, sock_t socket)
 	return 0;
 }
 
-static int add_client(server_t *srv)
+// Accept a pending connection and hold it until its hello arrives, returning 1 if it was turned away
+static int accept_client(server_t *srv)
 {
 	struct sockaddr_storage client_sockaddr;
 	socklen_t len[] = { sizeof(struct sockaddr_storage) };
 	sock_t new_client;
 	if (xaccept(&new_client, srv->sockets.sfds[0], (struct sockaddr *)&client_sockaddr, len) < 0) {
 		debug_print("%s\n", "Could not accept new client");
-		return -1;
+		return 1;
 	}
 
-	if (srv->sockets.nsfds + 1 == srv->sockets.max_nsfds) {
+	if (srv->sockets.nsfds + srv->handshakes.count + 1 >= srv->sockets.max_nsfds || srv->handshakes.count == HANDSHAKES_PENDING_MAX) {
 		xwarn("Daemon at full capacity... rejecting new connection\n");
+		(void)xclose(new_client);
+		return 1;
+	}
+
+	// Key exchanges still block on each client in turn, so none may hold the daemon up for long
+	if (xsettimeout(new_client, CLIENT_TIMEOUT)) {
+		debug_print("%s\n", "Could not set a timeout on new client");
+		(void)xclose(new_client);
 		return 1;
 	}
 
 	FD_SET(new_client, &srv->descriptors.fds); // Add descriptor to set and update max
 	srv->descriptors.nfds = xfd_count(new_client, srv->descriptors.nfds);
-	srv->sockets.nsfds++;
 
-	char address[INET_ADDRSTRLEN];
-	in_port_t port;
-	if (xgetpeeraddr(new_client, address, &port) < 0) {
-		debug_print("%s\n", "Could not get human-readable IP for new client");
+	srv->handshakes.sfds[srv->handshakes.count] = new_client;
+	srv->handshakes.deadlines[srv->handshakes.count] = time(NULL) + HANDSHAKE_TIMEOUT;
+	srv->handshakes.received[srv->handshakes.count] = 0;
+	srv->handshakes.count++;
+	return 0;
+}
+
+// Whether another connection is waiting to be accepted
+static bool connection_pending(server_t *srv)
+{
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(srv->sockets.sfds[0], &fds);
+	struct timeval timeout = { 0 };
+	return select(srv->sockets.sfds[0] + 1, &fds, NULL, NULL, &timeout) > 0;
+}
+
+// Accept every pending connection there is room for
+static void accept_clients(server_t *srv)
+{
+	do {
+		if (accept_client(srv) && srv->handshakes.count == HANDSHAKES_PENDING_MAX) {
+			break;
+		}
+	} while (connection_pending(srv));
+}
+
+// Forget the pending handshake at `index`, closing its socket if it did not make it into a slot
+static void drop_handshake(server_t *srv, size_t index, bool close)
+{
+	const sock_t socket = srv->handshakes.sfds[index];
+	if (close) {
+		FD_CLR(socket, &srv->descriptors.fds);
+		(void)xclose(socket);
+	}
+	srv->handshakes.count--;
+	srv->handshakes.sfds[index] = srv->handshakes.sfds[srv->handshakes.count];
+	srv->handshakes.deadlines[index] = srv->handshakes.deadlines[srv->handshakes.count];
+	srv->handshakes.received[index] = srv->handshakes.received[srv->handshakes.count];
+	memcpy(srv->handshakes.hellos[index], srv->handshakes.hellos[srv->handshakes.count], HELLO_LEN_MAX);
+}
+
+// Read whatever has arrived of a pending hello, without waiting on the rest. Returns -1 if the connection
+// closed or is not sending a hello
+static int recv_hello(server_t *srv, size_t index)
+{
+	uint8_t *hello = srv->handshakes.hellos[index];
+	size_t *received = &srv->handshakes.received[index];
+	const ssize_t missing = kx_hello_missing(hello, *received);
+	if (missing <= 0) {
+		return missing;
+	}
+
+	const ssize_t bytes_recv = xrecv(srv->handshakes.sfds[index], &hello[*received], (size_t)missing, 0);
+	if (bytes_recv <= 0) {
 		return -1;
 	}
+	*received += (size_t)bytes_recv;
+	return kx_hello_missing(hello, *received) < 0 ? -1 : 0;
+}
+
+// Whether the pending handshake at `index` has its whole hello
+static bool hello_ready(server_t *srv, size_t index)
+{
+	return !kx_hello_missing(srv->handshakes.hellos[index], srv->handshakes.received[index]);
+}
+
+// Whether some pending handshake is only waiting on its turn in a batch
+static bool hellos_ready(server_t *srv)
+{
+	for (size_t i = 0; i < srv->handshakes.count; i++) {
+		if (hello_ready(srv, i)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Close connections that have not sent a hello in time
+static void expire_handshakes(server_t *srv)
+{
+	const time_t now = time(NULL);
+	for (size_t i = srv->handshakes.count; i--;) {
+		if (now >= srv->handshakes.deadlines[i]) {
+			xwarn("New connection never sent a hello, dropping it\n");
+			drop_handshake(srv, i, true);
+		}
+	}
+}
+
+// Copy a connection's socket to the next free slot
+static void add_client(server_t *srv, sock_t socket, wire_suites_t suites)
+{
+	char address[INET_ADDRSTRLEN] = { 0 };
+	in_port_t port = 0;
+	if (xgetpeeraddr(socket, address, &port) < 0) {
+		debug_print("%s\n", "Could not get human-readable IP for new client");
+	}
 
-	// Copy new connection's socket to the next free slot
 	debug_print("%s\n", "Add socket to empty slot");
 	for (size_t i = 1; i < srv->sockets.max_nsfds; i++) {
 		debug_print("Slot %zu %s\n", i, !srv->sockets.sfds[i] ? "free" : "in use");
 		if (!srv->sockets.sfds[i]) {
-			srv->sockets.sfds[i] = new_client;
+			srv->sockets.sfds[i] = socket;
+			srv->sockets.suites[i] = suites;
+			srv->sockets.frames[i] = (frame_buffer_t) { 0 };
+			srv->sockets.outputs[i] = (output_queue_t) { 0 };
+			srv->sockets.joining[i] = true;
+			srv->sockets.nsfds++;
 			debug_print("Connection from %s port %u added to slot %zu\n", address, port, i);
 			break;
 		}
 	}
+}
+
+// Read on the pending hellos that are readable, taking them out of `read_fds`, then complete the handshakes
+// of those now whole, up to a batch, together. Returns 1 if no connection made it through
+static int add_clients(server_t *srv, fd_set *read_fds)
+{
+	for (size_t i = srv->handshakes.count; i--;) {
+		const sock_t socket = srv->handshakes.sfds[i];
+		if (!FD_ISSET(socket, read_fds)) {
+			continue;
+		}
+		FD_CLR(socket, read_fds);
+		if (recv_hello(srv, i)) {
+			xwarn("Handshake with a new connection failed, dropping it\n");
+			drop_handshake(srv, i, true);
+		}
+	}
 
-	if (two_party_server(new_client, srv->server_key)) {
+	sock_t sockets[HANDSHAKE_BATCH_MAX];
+	uint8_t hellos[HANDSHAKE_BATCH_MAX][HELLO_LEN_MAX];
+	size_t count = 0;
+	for (size_t i = srv->handshakes.count; i-- && count < HANDSHAKE_BATCH_MAX;) {
+		if (hello_ready(srv, i)) {
+			sockets[count] = srv->handshakes.sfds[i];
+			memcpy(hellos[count++], srv->handshakes.hellos[i], HELLO_LEN_MAX);
+			drop_handshake(srv, i, false);
+		}
+	}
+
+	if (!count) {
+		return 1;
+	}
+	debug_print("Completing %zu handshakes\n", count);
+
+	wire_suites_t suites[HANDSHAKE_BATCH_MAX];
+	bool rejected[HANDSHAKE_BATCH_MAX];
+	if (two_party_servers(sockets, (const uint8_t (*)[HELLO_LEN_MAX])hellos, count, srv->server_key, suites, rejected)) {
 		return -1;
 	}
 
-	return 0;
+	size_t added = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (rejected[i]) {
+			xwarn("Handshake with a new connection failed, dropping it\n");
+			FD_CLR(sockets[i], &srv->descriptors.fds);
+			(void)xclose(sockets[i]);
+			continue;
+		}
+		add_client(srv, sockets[i], suites[i]);
+		added++;
+	}
+	return added ? 0 : 1;
 }
 
-static int transfer_message(server_t *srv, size_t sender_index, msg_t *msg)
+// Cipher suite for the next group key, chosen from those every connected client supports
+static enum wire_suite group_suite(server_t *srv)
 {
+	wire_suites_t group = {
+		.supported = wire_host_suites().supported,
+		.preferred = UINT64_MAX,
+	};
 	for (size_t i = 1; i <= srv->sockets.nsfds; i++) {
-		if (i == sender_index) {
-			continue;
+		group.supported &= srv->sockets.suites[i].supported;
+		group.preferred &= srv->sockets.suites[i].preferred;
+	}
+	return wire_select_suite(group);
+}
+
+// Route named `id`, or NULL if none is open
+static route_t *find_route(server_t *srv, const uint8_t *id)
+{
+	for (size_t i = 0; i < ROUTES_MAX; i++) {
+		if (srv->routes[i].owner && !memcmp(srv->routes[i].id, id, FILE_ROUTE_LEN)) {
+			return &srv->routes[i];
 		}
-		debug_print("Sending to socket %zu\n", i);
-		if (xsendall(srv->sockets.sfds[i], msg->data, msg->length) < 0) {
+	}
+	return NULL;
+}
+
+// Open a route owned by `owner`. When every route is in use, the file is broadcast instead
+static void open_route(server_t *srv, sock_t owner, const uint8_t *id)
+{
+	if (find_route(srv, id)) {
+		return;
+	}
+	for (size_t i = 0; i < ROUTES_MAX; i++) {
+		route_t *route = &srv->routes[i];
+		if (!route->owner) {
+			memcpy(route->id, id, FILE_ROUTE_LEN);
+			route->owner = owner;
+			route->nmembers = 0;
+			debug_print("Opened route %zu\n", i);
+			return;
+		}
+	}
+	debug_print("%s\n", "No free routes, broadcasting instead");
+}
+
+static void join_route(route_t *route, sock_t member)
+{
+	for (size_t i = 0; i < route->nmembers; i++) {
+		if (route->members[i] == member) {
+			return;
+		}
+	}
+	route->members[route->nmembers++] = member;
+}
+
+static void leave_route(route_t *route, sock_t member)
+{
+	for (size_t i = 0; i < route->nmembers; i++) {
+		if (route->members[i] == member) {
+			route->members[i] = route->members[--route->nmembers];
+			return;
+		}
+	}
+}
+
+// Drop a reference to a relay, freeing it with the last
+static void release_relay(relay_t *relay)
+{
+	if (relay && !--relay->refs) {
+		xfree(relay);
+	}
+}
+
+static const wire_frame_t *relay_frame(const relay_t *relay)
+{
+	return (const wire_frame_t *)relay->data;
+}
+
+static uint64_t relay_action(const relay_t *relay)
+{
+	return wire_get_raw((uint8_t *)relay_frame(relay)->action);
+}
+
+// Queue a relay for a client, to go out once its socket can take it
+static void queue_relay(server_t *srv, size_t index, relay_t *relay)
+{
+	queued_t *node = xmalloc(sizeof(queued_t));
+	if (!node) {
+		debug_print("Could not queue a relay for slot %zu\n", index);
+		return;
+	}
+	*node = (queued_t) { .relay = relay };
+	relay->refs++;
+
+	output_queue_t *output = &srv->sockets.outputs[index];
+	if (output->tail) {
+		output->tail->next = node;
+	}
+	else {
+		output->head = node;
+		output->progress = time(NULL);
+	}
+	output->tail = node;
+	output->length += relay->length;
+}
+
+// Take the relay at the head of a queue off, whether or not all of it went out
+static void pop_output(output_queue_t *output)
+{
+	queued_t *node = output->head;
+	output->length -= node->relay->length - output->sent;
+	output->sent = 0;
+	if (!(output->head = node->next)) {
+		output->tail = NULL;
+	}
+	release_relay(node->relay);
+	xfree(node);
+}
+
+static void clear_output(output_queue_t *output)
+{
+	while (output->head) {
+		pop_output(output);
+	}
+}
+
+// Write out as much of a client's queue as its socket takes without blocking. Returns -1 if the client is gone
+static int flush_output(server_t *srv, size_t index)
+{
+	output_queue_t *output = &srv->sockets.outputs[index];
+	while (output->head) {
+		const relay_t *relay = output->head->relay;
+		const ssize_t sent = xsend_nowait(srv->sockets.sfds[index], &relay->data[output->sent], relay->length - output->sent);
+		if (sent < 0) {
+			return -1;
+		}
+		if (!sent) {
+			return 0;
+		}
+		output->progress = time(NULL);
+		output->sent += sent;
+		output->length -= sent;
+		if (output->sent == relay->length) {
+			pop_output(output);
+		}
+	}
+	return 0;
+}
+
+// Write out a client's whole queue, blocking for as long as it keeps taking it
+static int drain_output(server_t *srv, size_t index)
+{
+	output_queue_t *output = &srv->sockets.outputs[index];
+	while (output->head) {
+		const relay_t *relay = output->head->relay;
+		if (xsendall(srv->sockets.sfds[index], &relay->data[output->sent], relay->length - output->sent) < 0) {
 			return -1;
 		}
+		output->sent = relay->length;
+		pop_output(output);
 	}
 	return 0;
 }
 
+// Queue a relay for the client on `socket`, if it is still connected
+static void relay_message(server_t *srv, sock_t socket, relay_t *relay)
+{
+	const size_t index = socket_index(srv, socket);
+	if (index) {
+		queue_relay(srv, index, relay);
+	}
+}
+
+// Relay to every client but the sender. A wire `held` over a key exchange skips the clients that joined in it,
+// since they never had the key it was sealed under
+static void broadcast_message(server_t *srv, size_t sender_index, relay_t *relay, bool held)
+{
+	for (size_t i = 1; i <= srv->sockets.nsfds; i++) {
+		if (i == sender_index || (held && srv->sockets.joining[i])) {
+			continue;
+		}
+		debug_print("Sending to socket %zu\n", i);
+		queue_relay(srv, i, relay);
+	}
+}
+
+static void transfer_message(server_t *srv, relay_t *relay, bool held)
+{
+	const sock_t sender = relay->sender;
+	const size_t sender_index = socket_index(srv, sender);
+	const uint64_t action = relay_action(relay);
+	const uint8_t *route_id = relay_frame(relay)->route;
+	if (action == FRAME_BROADCAST) {
+		broadcast_message(srv, sender_index, relay, held);
+		return;
+	}
+	if (action == FRAME_ROUTE_OPEN) {
+		open_route(srv, sender, route_id);
+		broadcast_message(srv, sender_index, relay, held);
+		return;
+	}
+
+	route_t *route = find_route(srv, route_id);
+	if (!route || (action != FRAME_ROUTE_JOIN && route->owner != sender)) {
+		broadcast_message(srv, sender_index, relay, held);
+		return;
+	}
+
+	switch (action) {
+		case FRAME_ROUTE_JOIN:
+			join_route(route, sender);
+			relay_message(srv, route->owner, relay);
+			break;
+		case FRAME_ROUTE_DATA:
+		case FRAME_ROUTE_CLOSE:
+			for (size_t i = 0; i < route->nmembers; i++) {
+				relay_message(srv, route->members[i], relay);
+			}
+			if (action == FRAME_ROUTE_CLOSE) {
+				route->owner = 0;
+			}
+			break;
+		default:
+			broadcast_message(srv, sender_index, relay, held);
+			break;
+	}
+}
+
 static int disconnect_client(server_t *ctx, size_t client_index)
 {
+	// Drop the client from the routes it joined, and close those it owns
+	for (size_t i = 0; i < ROUTES_MAX; i++) {
+		route_t *route = &ctx->routes[i];
+		if (route->owner == ctx->sockets.sfds[client_index]) {
+			route->owner = 0;
+		}
+		else if (route->owner) {
+			leave_route(route, ctx->sockets.sfds[client_index]);
+		}
+	}
+
 	FD_CLR(ctx->sockets.sfds[client_index], &ctx->descriptors.fds);
 	const int closed = xclose(ctx->sockets.sfds[client_index]);
+	release_relay(ctx->sockets.frames[client_index].relay);
+	clear_output(&ctx->sockets.outputs[client_index]);
 
 	// Replace this slot with the ending slot
 	if (ctx->sockets.nsfds == 1) {
 		ctx->sockets.sfds[client_index] = 0;
+		ctx->sockets.suites[client_index] = (wire_suites_t) { 0 };
+		ctx->sockets.frames[client_index] = (frame_buffer_t) { 0 };
+		ctx->sockets.joining[client_index] = false;
 	}
 	else {
 		ctx->sockets.sfds[client_index] = ctx->sockets.sfds[ctx->sockets.nsfds];
+		ctx->sockets.suites[client_index] = ctx->sockets.suites[ctx->sockets.nsfds];
+		ctx->sockets.frames[client_index] = ctx->sockets.frames[ctx->sockets.nsfds];
+		ctx->sockets.outputs[client_index] = ctx->sockets.outputs[ctx->sockets.nsfds];
+		ctx->sockets.joining[client_index] = ctx->sockets.joining[ctx->sockets.nsfds];
 		ctx->sockets.sfds[ctx->sockets.nsfds] = 0;
+		ctx->sockets.suites[ctx->sockets.nsfds] = (wire_suites_t) { 0 };
+		ctx->sockets.frames[ctx->sockets.nsfds] = (frame_buffer_t) { 0 };
+		ctx->sockets.outputs[ctx->sockets.nsfds] = (output_queue_t) { 0 };
+		ctx->sockets.joining[ctx->sockets.nsfds] = false;
 	}
 	ctx->sockets.nsfds--;
 	return closed;
 }
 
-static int recv_client(server_t *srv, size_t sender_index)
+// Take in whatever a client has sent of its current frame, with a single read so one slow client cannot hold up the rest.
+// Returns 1 once the whole frame is in, 0 if more is to come, or -1 if the client disconnected or sent something that is not a frame
+static int recv_frame(sock_t socket, frame_buffer_t *buffer)
 {
-	msg_t *msg = xcalloc(sizeof(msg_t));
-	if (!msg) {
-		xalert("xcalloc()\n");
+	if (buffer->received < sizeof(wire_frame_t)) {
+		const ssize_t received = xrecv(socket, (uint8_t *)&buffer->frame + buffer->received, sizeof(wire_frame_t) - buffer->received, 0);
+		if (received <= 0) {
+			return -1;
+		}
+		buffer->received += received;
+		if (buffer->received < sizeof(wire_frame_t)) {
+			return 0;
+		}
+
+		const uint64_t length = wire_get_raw(buffer->frame.length);
+		bool valid = length >= sizeof(wire_t) && length <= RECV_MAX_BYTES;
+		switch (wire_get_raw(buffer->frame.action)) {
+			case FRAME_KEY:
+				valid = length == KEY_LEN;
+				break;
+			case FRAME_KEY_ABORT:
+				valid = !length;
+				break;
+		}
+		if (!valid) {
+			debug_print("Frame of %llu bytes is not a wire\n", (unsigned long long)length);
+			return -1;
+		}
+
+		if (!(buffer->relay = xmalloc(sizeof(relay_t) + sizeof(wire_frame_t) + length))) {
+			return -1;
+		}
+		*buffer->relay = (relay_t) {
+			.refs = 1,
+			.sender = socket,
+			.length = sizeof(wire_frame_t) + length,
+		};
+		memcpy(buffer->relay->data, &buffer->frame, sizeof(wire_frame_t));
+		return buffer->received == buffer->relay->length;
+	}
+
+	relay_t *relay = buffer->relay;
+	const ssize_t received = xrecv(socket, &relay->data[buffer->received], relay->length - buffer->received, 0);
+	if (received <= 0) {
 		return -1;
 	}
+	buffer->received += received;
+	return buffer->received == relay->length;
+}
 
-	if ((msg->length = xrecv(srv->sockets.sfds[sender_index], msg->data, sizeof(msg->data), 0)) <= 0) {
-		if (msg->length) {
-			xwarn("Client %zu disconnected improperly\n", sender_index);
+// Hold on to a wire until the key exchange in progress is over, taking over the reference to it
+static int defer_relay(server_t *srv, relay_t *relay)
+{
+	struct deferred_set_t *deferred = &srv->deferred;
+	if (deferred->count == deferred->capacity) {
+		const size_t capacity = deferred->capacity ? 2 * deferred->capacity : DEFERRED_FRAMES_MIN;
+		relay_t **relays = xmalloc(capacity * sizeof(relay_t *));
+		if (!relays) {
+			return -1;
 		}
-		else {
-			char address[INET_ADDRSTRLEN];
-			in_port_t port;
-			if (xgetpeeraddr(srv->sockets.sfds[sender_index], address, &port) < 0) {
-				xwarn("Unable to determine IP and port of client %zu, despite proper disconnect\n", sender_index);
-			}
-			debug_print("Connection from %s port %d ended\n", address, port);
+		if (deferred->count) {
+			memcpy(relays, deferred->relays, deferred->count * sizeof(relay_t *));
 		}
+		xfree(deferred->relays);
+		deferred->relays = relays;
+		deferred->capacity = capacity;
+	}
+	deferred->relays[deferred->count++] = relay;
+	return 0;
+}
 
-		if (disconnect_client(srv, sender_index)) {
-			xalert("Error closing socket\n");
-			xfree(msg);
+// Read frames from a client until the key exchange frame `action` arrives, copying out the key of a FRAME_KEY.
+// Wires ahead of it were sealed before the client saw the exchange start, and are set aside rather than
+// interleaved with the keys the others are waiting on. Key exchange frames left over from a called-off exchange are dropped
+static int recv_exchange_frame(server_t *srv, size_t index, uint64_t action, uint8_t *key)
+{
+	frame_buffer_t *buffer = &srv->sockets.frames[index];
+	for (;;) {
+		const int status = recv_frame(srv->sockets.sfds[index], buffer);
+		if (status < 0) {
 			return -1;
 		}
+		if (!status) {
+			continue;
+		}
 
-		debug_print("Active connections: %zu\n", srv->sockets.nsfds);
+		relay_t *relay = buffer->relay;
+		*buffer = (frame_buffer_t) { 0 };
+		const uint64_t received = relay_action(relay);
+		if (received == action) {
+			if (key) {
+				memcpy(key, &relay->data[sizeof(wire_frame_t)], KEY_LEN);
+			}
+			release_relay(relay);
+			return 0;
+		}
+		if (received == FRAME_KEY || received == FRAME_KEY_ABORT) {
+			release_relay(relay);
+		}
+		else if (defer_relay(srv, relay)) {
+			release_relay(relay);
+			return -1;
+		}
+	}
+}
+
+static int recv_key(void *ctx, size_t index, uint8_t *key)
+{
+	return recv_exchange_frame(ctx, index, FRAME_KEY, key);
+}
 
-		if (n_party_server(srv->sockets.sfds, srv->sockets.nsfds, srv->server_key)) {
-			xalert("Catastrophic key exchange failure\n");
-			xfree(msg);
+// Call off the key exchange under way once a client has dropped out of it. The others answer in kind after letting go
+// of it, so nothing left of it is taken for part of the next. Clients that fail to are disconnected too
+static int abort_exchange(server_t *srv)
+{
+	for (size_t i = srv->sockets.nsfds; i; i--) {
+		if (kx_send_abort(srv->sockets.sfds[i]) && disconnect_client(srv, i)) {
 			return -1;
 		}
 	}
-	else {
-		if (transfer_message(srv, sender_index, msg) < 0) {
-			xalert("Error broadcasting message from slot %zu\n", sender_index);
-			xfree(msg);
+	for (size_t i = srv->sockets.nsfds; i; i--) {
+		if (recv_exchange_frame(srv, i, FRAME_KEY_ABORT, NULL) && disconnect_client(srv, i)) {
 			return -1;
 		}
-		debug_print("Fanout of slot %zu's message complete\n", sender_index);
 	}
-	xfree(msg);
 	return 0;
 }
 
+// Rekey the group, disconnecting any client that fails to take part, then relay the wires set aside during the exchange.
+// Clients keep the previous session key for these, which those joining in the exchange never had
+static int rekey(server_t *srv)
+{
+	struct deferred_set_t *deferred = &srv->deferred;
+	int status = 0;
+	for (;;) {
+		// What was relayed before the exchange has to reach clients before its CTRL does
+		size_t failed = 0;
+		for (size_t i = 1; i <= srv->sockets.nsfds && !failed; i++) {
+			if (drain_output(srv, i)) {
+				failed = i;
+			}
+		}
+
+		bool started = false;
+		if (!failed) {
+			if (!n_party_server(srv->sockets.sfds, srv->sockets.nsfds, srv->server_key, group_suite(srv), recv_key, srv, &failed)) {
+				break;
+			}
+			if (!failed) {
+				status = -1;
+				break;
+			}
+			started = true;
+		}
+
+		xwarn("Client %zu dropped out of a key exchange, disconnecting it\n", failed);
+		if (disconnect_client(srv, failed) || (started && abort_exchange(srv))) {
+			status = -1;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < deferred->count; i++) {
+		// Wires from clients that have since gone are dropped with them
+		if (!status && socket_index(srv, deferred->relays[i]->sender)) {
+			transfer_message(srv, deferred->relays[i], true);
+		}
+		release_relay(deferred->relays[i]);
+	}
+	deferred->count = 0;
+
+	for (size_t i = 1; i <= srv->sockets.nsfds; i++) {
+		srv->sockets.joining[i] = false;
+	}
+	return status;
+}
+
+// Disconnect a client and rekey the rest of the group
+static int drop_client(server_t *srv, size_t index)
+{
+	if (disconnect_client(srv, index)) {
+		xalert("Error closing socket\n");
+		return -1;
+	}
+
+	debug_print("Active connections: %zu\n", srv->sockets.nsfds);
+
+	if (rekey(srv)) {
+		xalert("Catastrophic key exchange failure\n");
+		return -1;
+	}
+	return 0;
+}
+
+// Returns 1 when the client left and the rest of the group was rekeyed
+static int recv_client(server_t *srv, size_t sender_index)
+{
+	frame_buffer_t *buffer = &srv->sockets.frames[sender_index];
+	switch (recv_frame(srv->sockets.sfds[sender_index], buffer)) {
+		case 0:
+			return 0;
+		case 1: {
+			relay_t *relay = buffer->relay;
+			*buffer = (frame_buffer_t) { 0 };
+			const uint64_t action = relay_action(relay);
+			if (action == FRAME_KEY || action == FRAME_KEY_ABORT) {
+				debug_print("Dropping key exchange frame from slot %zu sent outside a key exchange\n", sender_index);
+			}
+			else {
+				transfer_message(srv, relay, false);
+				debug_print("Fanout of slot %zu's message complete\n", sender_index);
+			}
+			release_relay(relay);
+			return 0;
+		}
+	}
+
+	if (buffer->received) {
+		xwarn("Client %zu disconnected improperly\n", sender_index);
+	}
+	else {
+		char address[INET_ADDRSTRLEN];
+		in_port_t port;
+		if (xgetpeeraddr(srv->sockets.sfds[sender_index], address, &port) < 0) {
+			xwarn("Unable to determine IP and port of client %zu, despite proper disconnect\n", sender_index);
+		}
+		debug_print("Connection from %s port %d ended\n", address, port);
+	}
+
+	return drop_client(srv, sender_index) ? -1 : 1;
+}
+
+// Watch the sockets of clients with relays queued for writing. A client that has fallen too far behind stops the
+// clients feeding it from being read, until it catches up. Returns whether any relays are queued
+static bool watch_outputs(server_t *srv, fd_set *read_fds, fd_set *write_fds)
+{
+	bool queued = false;
+	for (size_t i = 1; i <= srv->sockets.nsfds; i++) {
+		const output_queue_t *output = &srv->sockets.outputs[i];
+		if (!output->head) {
+			continue;
+		}
+		queued = true;
+		FD_SET(srv->sockets.sfds[i], write_fds);
+		if (output->length > OUTPUT_QUEUE_HIGH) {
+			for (const queued_t *node = output->head; node; node = node->next) {
+				FD_CLR(node->relay->sender, read_fds);
+			}
+		}
+	}
+	return queued;
+}
+
+// Write to the clients whose sockets are writable, and drop those that have stopped taking anything.
+// Returns 1 once a client has been dropped and the group rekeyed
+static int flush_outputs(server_t *srv, fd_set *write_fds)
+{
+	const time_t now = time(NULL);
+	for (size_t i = 1; i <= srv->sockets.nsfds; i++) {
+		const output_queue_t *output = &srv->sockets.outputs[i];
+		if (FD_ISSET(srv->sockets.sfds[i], write_fds) && flush_output(srv, i)) {
+			debug_print("Could not relay to slot %zu\n", i);
+			return drop_client(srv, i) ? -1 : 1;
+		}
+		if (output->head && now - output->progress >= OUTPUT_STALL_TIMEOUT) {
+			xwarn("Client %zu stopped reading, disconnecting it\n", i);
+			return drop_client(srv, i) ? -1 : 1;
+		}
+	}
+	return 0;
+}
 int display_daemon_info(server_t *ctx)
 {
 	const char header[] = {
@@ -243,47 +881,69 @@ int display_daemon_info(server_t *ctx)
 int main_thread(void *ctx)
 {
 	signal(SIGINT, catch_sigint);
+#ifdef SIGPIPE
+	signal(SIGPIPE, SIG_IGN); // Writes to a client that has gone away fail instead
+#endif
 
 	server_t *server = (server_t *)ctx;
 	fd_set read_fds;
+	fd_set write_fds;
 	FD_ZERO(&read_fds);
 
 	for (;;) {
 		read_fds = server->descriptors.fds;
-		if (select(server->descriptors.nfds + 1, &read_fds, NULL, NULL, NULL) < 0) {
+		FD_ZERO(&write_fds);
+		const bool queued = watch_outputs(server, &read_fds, &write_fds);
+
+		// Hellos left over from a full batch go through without waiting on select. Stalled outputs are checked on
+		// as often as handshakes expire
+		struct timeval timeout = { .tv_sec = hellos_ready(server) ? 0 : HANDSHAKE_TIMEOUT };
+		const bool timed = server->handshakes.count || queued;
+		if (select(server->descriptors.nfds + 1, &read_fds, &write_fds, NULL, timed ? &timeout : NULL) < 0) {
 			xalert("n_party_server()\n");
 			return -1;
 		}
 
-		for (size_t i = 0; i <= server->descriptors.nfds; i++) {
+		// The key exchange read on from the clients' sockets, so what select reported for them is stale once the
+		// group has been rekeyed
+		int rekeyed = flush_outputs(server, &write_fds);
+		if (rekeyed < 0) {
+			xalert("flush_outputs()\n");
+			return -1;
+		}
+
+		// New connections whose hellos have arrived join together, so the group is rekeyed once
+		switch (rekeyed ? 1 : add_clients(server, &read_fds)) {
+			case -1:
+				xalert("n_party_server()\n");
+				return -1;
+			case 0:
+				if (rekey(server)) {
+					xalert("n_party_server()\n");
+					return -1;
+				}
+				debug_print("%s\n", "Connection added successfully");
+				rekeyed = 1;
+				break;
+		}
+		expire_handshakes(server);
+
+		for (size_t i = 0; !rekeyed && i <= server->descriptors.nfds; i++) {
 			sock_t fd;
 			if ((fd = xfd_isset(&server->descriptors.fds, &read_fds, i))) {
 				if (fd == server->sockets.sfds[0]) {
 					debug_print("%s\n", "Pending connection from unknown client");
-					switch (add_client(server)) {
-						case -1:
-							xalert("n_party_server()\n");
-							return -1;
-						case 1:
-							debug_print("%s\n", "Incoming connection was rejected");
-							goto jmpout;
-						case 0:
-							if (n_party_server(server->sockets.sfds, server->sockets.nsfds, server->server_key)) {
-								xalert("n_party_server()\n");
-								return -1;
-							}
-							debug_print("%s\n", "Connection added successfully");
-							break;
-					}
+					accept_clients(server);
 				}
 				else {
 					const size_t sender_index = socket_index(server, fd);
-					if (recv_client(server, sender_index)) {
+					const int status = recv_client(server, sender_index);
+					if (status < 0) {
 						xalert("recv_client()\n");
 						return -1;
 					}
+					rekeyed = status;
 				}
-				jmpout:;
 			}
 		}
 	}
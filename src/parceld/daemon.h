@@ -23,13 +23,59 @@ enum ParceldConstants {
 	SUPPORTED_CONNECTIONS = FD_SETSIZE,
 	MAX_QUEUE = 32,
 	DEFAULT_PORT = 2315,
-	PORT_MAX_LENGTH = 6
+	PORT_MAX_LENGTH = 6,
+	ROUTES_MAX = 64, // File transfers relayed only to the members who accepted them
+	HANDSHAKES_PENDING_MAX = MAX_QUEUE, // Connections accepted but still to send their hello
+	HANDSHAKE_TIMEOUT = 10, // Seconds a new connection has to send its hello
+	CLIENT_TIMEOUT = 10, // Seconds a blocking send or receive, as in a key exchange, may go without progress
+	OUTPUT_QUEUE_HIGH = 1 << 22, // Bytes queued for a client past which the clients feeding it are no longer read
+	OUTPUT_STALL_TIMEOUT = 30, // Seconds a client may leave its queue untouched before it is dropped
+	DEFERRED_FRAMES_MIN = 8, // Wires set aside during a key exchange, before the list grows
 };
 
 enum SocketIndices {
 	DAEMON_SOCKET = 0,
 };
 
+/**
+ * @brief Members that accepted a file offer, so its chunks skip everyone else
+ */
+typedef struct route_t {
+	uint8_t id[FILE_ROUTE_LEN];
+	sock_t owner; // Client offering the file, 0 if the route is free
+	sock_t *members; // Clients that accepted
+	size_t nmembers;
+} route_t;
+
+// A frame and its wire, shared by every client it is relayed to and freed once the last of them has it
+typedef struct relay_t {
+	size_t refs;
+	sock_t sender;  // Client it came from
+	size_t length;  // Of `data`
+	uint8_t data[]; // The frame header, then the wire
+} relay_t;
+
+// A client's frame as it trickles in, relayed once the whole wire is here
+typedef struct frame_buffer_t {
+	wire_frame_t frame; // Header, read before the relay is allocated
+	relay_t *relay;     // Allocated once the frame header is in
+	size_t received;    // Bytes of frame header and wire received so far
+} frame_buffer_t;
+
+typedef struct queued_t {
+	relay_t *relay;
+	struct queued_t *next;
+} queued_t;
+
+// Relays waiting on a client, written out whenever select reports its socket writable
+typedef struct output_queue_t {
+	queued_t *head;
+	queued_t *tail;
+	size_t sent;     // Bytes of the head already written
+	size_t length;   // Bytes left to write
+	time_t progress; // Last time the client took anything, or its queue was started
+} output_queue_t;
+
 typedef struct server_t {
 	char server_port[PORT_MAX_LENGTH];
 	size_t max_queue;
@@ -40,16 +86,28 @@ typedef struct server_t {
 	} descriptors;
 	struct sfd_set_t {
 		sock_t *sfds; // Socket file descriptors
+		wire_suites_t *suites; // Cipher suites of each socket's client
+		frame_buffer_t *frames; // Partly received frame of each socket's client
+		output_queue_t *outputs; // Relays each socket's client has yet to take
+		bool *joining; // Set for clients joining in the coming key exchange, which never had the group's previous key
 		size_t nsfds; // Number of socket file descriptors
 		size_t max_nsfds; // Maximum number of socket file descriptors
 	} sockets;
+	struct handshake_set_t {
+		sock_t sfds[HANDSHAKES_PENDING_MAX]; // Kept out of `sockets` until the handshake completes
+		time_t deadlines[HANDSHAKES_PENDING_MAX];
+		uint8_t hellos[HANDSHAKES_PENDING_MAX][HELLO_LEN_MAX]; // Gathered as it trickles in, see kx_hello_missing()
+		size_t received[HANDSHAKES_PENDING_MAX]; // Bytes of each hello so far
+		size_t count;
+	} handshakes;
+	route_t routes[ROUTES_MAX];
+	struct deferred_set_t {
+		relay_t **relays; // Whole wires that arrived during a key exchange, relayed once it is over
+		size_t count;
+		size_t capacity;
+	} deferred;
 } server_t;
 
-typedef struct msg_t {
-	uint8_t data[RECV_MAX_BYTES];
-	ssize_t length;
-} msg_t;
-
 int init_daemon(server_t *ctx);
 int display_daemon_info(server_t *ctx);
 int main_thread(void *ctx);
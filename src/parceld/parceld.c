@@ -74,6 +74,10 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (key_pool_start()) {
+		xwarn("Unable to start key generation thread\n");
+	}
+
 	if (init_daemon(&server)) {
 		return 1;
 	}
@@ -0,0 +1,66 @@
+/**
+ * @file sha256-backend.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Block-level kernels implemented by each SHA-256 backend
+ * @version 2022.11
+ * @date 2021-12-15
+ *
+ * @copyright Copyright (c) 2021-2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "sha256.h"
+
+// Round constants K (4.2.2)
+extern const uint32_t sha256_round_constants[64];
+
+/**
+ * @brief Multi-block kernel behind the sha256_t API
+ */
+typedef struct sha256_backend_t {
+    const char *name;
+
+    // Run the compression function over `blocks` consecutive 64-byte blocks, updating `state`
+    void (*compress)(uint32_t *state, const uint8_t *data, size_t blocks);
+} sha256_backend_t;
+
+/**
+ * @brief Kernel hashing several independent messages side by side
+ */
+typedef struct sha256_lanes_backend_t {
+    const char *name;
+    size_t lanes; // Messages advanced by each call, at most SHA256_LANES_MAX
+
+    // Run the compression function over `blocks` blocks of each of `lanes` messages, updating `states`
+    void (*compress_lanes)(uint32_t *const *states, const uint8_t *const *data, size_t blocks);
+} sha256_lanes_backend_t;
+
+/**
+ * @brief SHA-NI backend
+ *
+ * @return NULL if the host is not x86 or lacks the SHA extensions
+ */
+const sha256_backend_t *sha256_ni_backend(void);
+
+/**
+ * @brief ARMv8 Cryptography Extensions backend
+ *
+ * @return NULL if the host is not AArch64 or lacks the SHA2 instructions
+ */
+const sha256_backend_t *sha256_armv8_backend(void);
+
+/**
+ * @brief SHA-NI backend interleaving two messages to hide the latency of SHA256RNDS2
+ *
+ * @return NULL if the host is not x86 or lacks the SHA extensions
+ */
+const sha256_lanes_backend_t *sha256_ni_lanes_backend(void);
+
+/**
+ * @brief AVX2 backend, one message per 32-bit lane
+ *
+ * @return NULL if the host is not x86 or lacks AVX2
+ */
+const sha256_lanes_backend_t *sha256_avx2_lanes_backend(void);
@@ -0,0 +1,342 @@
+/**
+ * @file sha256-simd.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief SHA-NI and ARMv8 backends for sha256, selected at runtime when supported
+ * @ref https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sha-extensions.html
+ * @version 2022.11
+ * @date 2021-12-15
+ *
+ * @copyright Copyright (c) 2021-2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "sha256-backend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SHANI __attribute__((target("sha,sse4.1,ssse3")))
+#define AVX2 __attribute__((target("avx2")))
+
+enum SHANILanes {
+    SHANI_LANES = 2,
+};
+
+// SHA256RNDS2 works on the state split as ABEF / CDGH and runs two rounds per call,
+// with the next four message words computed four groups ahead. Each round depends on the last,
+// so up to SHANI_LANES messages are interleaved to keep the unit busy
+SHANI __attribute__((always_inline)) static inline void shani_compress_n(uint32_t *const *states, const uint8_t *const *data, size_t blocks, size_t n)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i abef[SHANI_LANES];
+    __m128i cdgh[SHANI_LANES];
+    #pragma GCC unroll 2
+    for (size_t j = 0; j < n; j++) {
+        // DCBA / HGFE -> ABEF / CDGH
+        const __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&states[j][0]), 0xb1);
+        cdgh[j] = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&states[j][4]), 0x1b);
+        abef[j] = _mm_alignr_epi8(tmp, cdgh[j], 8);
+        cdgh[j] = _mm_blend_epi16(cdgh[j], tmp, 0xf0);
+    }
+
+    for (size_t block = 0; block < blocks; block++) {
+        __m128i abef_save[SHANI_LANES];
+        __m128i cdgh_save[SHANI_LANES];
+        __m128i w[SHANI_LANES][4];
+        #pragma GCC unroll 2
+        for (size_t j = 0; j < n; j++) {
+            abef_save[j] = abef[j];
+            cdgh_save[j] = cdgh[j];
+            #pragma GCC unroll 4
+            for (size_t i = 0; i < 4; i++) {
+                w[j][i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&data[j][64 * block + 16 * i]), bswap);
+            }
+        }
+
+        #pragma GCC unroll 16
+        for (size_t i = 0; i < 16; i++) {
+            const __m128i k = _mm_loadu_si128((const __m128i *)&sha256_round_constants[4 * i]);
+            #pragma GCC unroll 2
+            for (size_t j = 0; j < n; j++) {
+                __m128i wk = _mm_add_epi32(w[j][i % 4], k);
+                cdgh[j] = _mm_sha256rnds2_epu32(cdgh[j], abef[j], wk);
+                wk = _mm_shuffle_epi32(wk, 0x0e);
+                abef[j] = _mm_sha256rnds2_epu32(abef[j], cdgh[j], wk);
+
+                // W[4i + 16 ... 4i + 19] (6.2.2.1)
+                if (i < 12) {
+                    __m128i next = _mm_sha256msg1_epu32(w[j][i % 4], w[j][(i + 1) % 4]);
+                    next = _mm_add_epi32(next, _mm_alignr_epi8(w[j][(i + 3) % 4], w[j][(i + 2) % 4], 4));
+                    w[j][i % 4] = _mm_sha256msg2_epu32(next, w[j][(i + 3) % 4]);
+                }
+            }
+        }
+
+        #pragma GCC unroll 2
+        for (size_t j = 0; j < n; j++) {
+            abef[j] = _mm_add_epi32(abef[j], abef_save[j]);
+            cdgh[j] = _mm_add_epi32(cdgh[j], cdgh_save[j]);
+        }
+    }
+
+    #pragma GCC unroll 2
+    for (size_t j = 0; j < n; j++) {
+        // ABEF / CDGH -> DCBA / HGFE
+        const __m128i tmp = _mm_shuffle_epi32(abef[j], 0x1b);
+        cdgh[j] = _mm_shuffle_epi32(cdgh[j], 0xb1);
+        _mm_storeu_si128((__m128i *)&states[j][0], _mm_blend_epi16(tmp, cdgh[j], 0xf0));
+        _mm_storeu_si128((__m128i *)&states[j][4], _mm_alignr_epi8(cdgh[j], tmp, 8));
+    }
+}
+
+SHANI static void shani_compress(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+    shani_compress_n(&state, &data, blocks, 1);
+}
+
+SHANI static void shani_compress_lanes(uint32_t *const *states, const uint8_t *const *data, size_t blocks)
+{
+    shani_compress_n(states, data, blocks, SHANI_LANES);
+}
+
+// The AVX2 kernel keeps word i of every message in lane j of vector i
+
+AVX2 static inline __m256i avx2_rotr(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+// Transpose an 8x8 matrix of words, so y[i] holds word i of each row of x
+AVX2 static inline void avx2_transpose(__m256i *y, const __m256i *x)
+{
+    __m256i t[8];
+    __m256i u[8];
+    #pragma GCC unroll 4
+    for (size_t i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(x[i], x[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(x[i], x[i + 1]);
+    }
+    #pragma GCC unroll 2
+    for (size_t i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    #pragma GCC unroll 4
+    for (size_t i = 0; i < 4; i++) {
+        y[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        y[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+AVX2 static void avx2_compress_lanes(uint32_t *const *states, const uint8_t *const *data, size_t blocks)
+{
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    __m256i s[8];
+    #pragma GCC unroll 8
+    for (size_t i = 0; i < 8; i++) {
+        s[i] = _mm256_loadu_si256((const __m256i *)states[i]);
+    }
+    avx2_transpose(s, s);
+
+    for (size_t block = 0; block < blocks; block++) {
+        __m256i w[16];
+        #pragma GCC unroll 2
+        for (size_t half = 0; half < 2; half++) {
+            __m256i rows[8];
+            #pragma GCC unroll 8
+            for (size_t j = 0; j < 8; j++) {
+                rows[j] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)&data[j][64 * block + 32 * half]), bswap);
+            }
+            avx2_transpose(&w[8 * half], rows);
+        }
+
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+        __m256i e = s[4], f = s[5], g = s[6], h = s[7];
+
+        #pragma GCC unroll 64
+        for (size_t i = 0; i < 64; i++) {
+            if (i >= 16) {
+                const __m256i w2 = w[(i - 0x02) & 0x0f];
+                const __m256i w15 = w[(i - 0x0f) & 0x0f];
+                const __m256i sig1 = _mm256_xor_si256(_mm256_xor_si256(avx2_rotr(w2, 0x11), avx2_rotr(w2, 0x13)), _mm256_srli_epi32(w2, 0x0a));
+                const __m256i sig0 = _mm256_xor_si256(_mm256_xor_si256(avx2_rotr(w15, 0x07), avx2_rotr(w15, 0x12)), _mm256_srli_epi32(w15, 0x03));
+                w[i & 0x0f] = _mm256_add_epi32(_mm256_add_epi32(w[i & 0x0f], w[(i - 0x07) & 0x0f]), _mm256_add_epi32(sig0, sig1));
+            }
+
+            // (6.2.2.3)
+            const __m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(avx2_rotr(e, 0x06), avx2_rotr(e, 0x0b)), avx2_rotr(e, 0x19));
+            const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            const __m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(avx2_rotr(a, 0x02), avx2_rotr(a, 0x0d)), avx2_rotr(a, 0x16));
+            const __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+            const __m256i k = _mm256_set1_epi32((int)sha256_round_constants[i]);
+
+            const __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(h, sum1), _mm256_add_epi32(ch, k)), w[i & 0x0f]);
+            const __m256i t2 = _mm256_add_epi32(sum0, maj);
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, t2);
+        }
+
+        // (6.2.2.4)
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+        s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g);
+        s[7] = _mm256_add_epi32(s[7], h);
+    }
+
+    avx2_transpose(s, s);
+    #pragma GCC unroll 8
+    for (size_t i = 0; i < 8; i++) {
+        _mm256_storeu_si256((__m256i *)states[i], s[i]);
+    }
+}
+
+static const sha256_backend_t shani = {
+    .name = "sha-ni",
+    .compress = shani_compress,
+};
+
+static const sha256_lanes_backend_t shani_lanes = {
+    .name = "sha-ni x2",
+    .lanes = SHANI_LANES,
+    .compress_lanes = shani_compress_lanes,
+};
+
+static const sha256_lanes_backend_t avx2_lanes = {
+    .name = "avx2",
+    .lanes = 8,
+    .compress_lanes = avx2_compress_lanes,
+};
+
+const sha256_backend_t *sha256_ni_backend(void)
+{
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sha") || !__builtin_cpu_supports("sse4.1") || !__builtin_cpu_supports("ssse3")) {
+        return NULL;
+    }
+    return &shani;
+}
+
+const sha256_lanes_backend_t *sha256_ni_lanes_backend(void)
+{
+    if (!sha256_ni_backend()) {
+        return NULL;
+    }
+    return &shani_lanes;
+}
+
+const sha256_lanes_backend_t *sha256_avx2_lanes_backend(void)
+{
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2")) {
+        return NULL;
+    }
+    return &avx2_lanes;
+}
+
+#else
+
+const sha256_backend_t *sha256_ni_backend(void)
+{
+    return NULL;
+}
+
+const sha256_lanes_backend_t *sha256_ni_lanes_backend(void)
+{
+    return NULL;
+}
+
+const sha256_lanes_backend_t *sha256_avx2_lanes_backend(void)
+{
+    return NULL;
+}
+
+#endif
+
+#if defined(__aarch64__) && (defined(__linux__) || defined(__APPLE__))
+
+#include <arm_neon.h>
+
+#if defined(__linux__)
+    #include <sys/auxv.h>
+    #include <asm/hwcap.h>
+#endif
+
+#define ARMV8_SHA2 __attribute__((target("arch=armv8-a+crypto")))
+
+// SHA256H / SHA256H2 run four rounds per pair on the state split as ABCD / EFGH
+ARMV8_SHA2 static void armv8_compress(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+    uint32x4_t abcd = vld1q_u32(&state[0]);
+    uint32x4_t efgh = vld1q_u32(&state[4]);
+
+    for (; blocks; blocks--, data += 64) {
+        const uint32x4_t abcd_save = abcd;
+        const uint32x4_t efgh_save = efgh;
+
+        uint32x4_t w[4];
+        #pragma GCC unroll 4
+        for (size_t i = 0; i < 4; i++) {
+            w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(&data[16 * i])));
+        }
+
+        #pragma GCC unroll 16
+        for (size_t i = 0; i < 16; i++) {
+            const uint32x4_t wk = vaddq_u32(w[i % 4], vld1q_u32(&sha256_round_constants[4 * i]));
+            const uint32x4_t abcd_prev = abcd;
+            abcd = vsha256hq_u32(abcd, efgh, wk);
+            efgh = vsha256h2q_u32(efgh, abcd_prev, wk);
+
+            // W[4i + 16 ... 4i + 19] (6.2.2.1)
+            if (i < 12) {
+                w[i % 4] = vsha256su1q_u32(vsha256su0q_u32(w[i % 4], w[(i + 1) % 4]), w[(i + 2) % 4], w[(i + 3) % 4]);
+            }
+        }
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        efgh = vaddq_u32(efgh, efgh_save);
+    }
+
+    vst1q_u32(&state[0], abcd);
+    vst1q_u32(&state[4], efgh);
+}
+
+static const sha256_backend_t armv8 = {
+    .name = "armv8",
+    .compress = armv8_compress,
+};
+
+const sha256_backend_t *sha256_armv8_backend(void)
+{
+#if defined(__linux__)
+    if (!(getauxval(AT_HWCAP) & HWCAP_SHA2)) {
+        return NULL;
+    }
+#endif
+    // Every Apple arm64 core implements the SHA2 instructions
+    return &armv8;
+}
+
+#else
+
+const sha256_backend_t *sha256_armv8_backend(void)
+{
+    return NULL;
+}
+
+#endif
@@ -10,7 +10,19 @@
  *
  */
 
-#include "sha256.h"
+#include "sha256-backend.h"
+
+// (4.2.2)
+const uint32_t sha256_round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
 
 // SHR(x, n) (3.2.3)
 static inline uint32_t shr(uint32_t x, uint32_t n)
@@ -76,91 +88,152 @@ void sha256_init(sha256_t *ctx)
     ctx->state[7] = 0x5be0cd19;
 }
 
-static void sha256_hash(sha256_t *ctx, const uint8_t *data)
+static void sha256_hash(uint32_t *state, const uint8_t *data)
 {
-    // (4.2.2)
-    static const uint32_t k[64] = {
-        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-    };
+    const uint32_t *k = sha256_round_constants;
 
-    // Message schedule (6.2.2.1)
-    uint32_t w[64];
-    for (size_t i = 0; i < 64; i++) {
-        if (i < 16) {
-            w[i] = (uint32_t)data[4 * i + 0] << 0x18 |
-                   (uint32_t)data[4 * i + 1] << 0x10 |
-                   (uint32_t)data[4 * i + 2] << 0x08 |
-                   (uint32_t)data[4 * i + 3] << 0x00;
-        }
-        else {
-            w[i] = sig1(w[i - 0x02]) +
-                   sig0(w[i - 0x0f]) +
-                   w[i - 0x07] +
-                   w[i - 0x10];
-        }
+    // Message schedule (6.2.2.1), kept as a window of the last 16 words and extended as the rounds consume it
+    uint32_t w[16];
+    #pragma GCC unroll 16
+    for (size_t i = 0; i < 16; i++) {
+        w[i] = (uint32_t)data[4 * i + 0] << 0x18 |
+               (uint32_t)data[4 * i + 1] << 0x10 |
+               (uint32_t)data[4 * i + 2] << 0x08 |
+               (uint32_t)data[4 * i + 3] << 0x00;
     }
 
     // (6.2.2.2)
-    uint32_t s[8] = {
-        ctx->state[0], // a
-        ctx->state[1], // b
-        ctx->state[2], // c
-        ctx->state[3], // d
-        ctx->state[4], // e
-        ctx->state[5], // f
-        ctx->state[6], // g
-        ctx->state[7], // h
-    };
-
-    // Offsets for indexing into `s` in a way the resembles the spec
-    // Elements are initialized to their index + 1 and get decremented prior computation
-    enum vars {
-        a, b, c, d, e, f, g, h
-    };
-    int32_t idx[] = {
-        [a] = 1, [b] = 2, [c] = 3, [d] = 4, [e] = 5, [f] = 6, [g] = 7, [h] = 8
-    };
-
-    // pragma gcc pls unroll
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+    uint32_t f = state[5];
+    uint32_t g = state[6];
+    uint32_t h = state[7];
+
+    #pragma GCC unroll 64
     for (size_t i = 0; i < 64; i++) {
-        for (size_t j = 0; j < 8; j++) {
-            idx[j] = idx[j] ? idx[j] - 1 : 7;
+        if (i >= 16) {
+            w[i & 0x0f] += sig1(w[(i - 0x02) & 0x0f]) +
+                           sig0(w[(i - 0x0f) & 0x0f]) +
+                           w[(i - 0x07) & 0x0f];
         }
         // (6.2.2.3)
-        s[idx[h]] += sum1(s[idx[e]]);
-        s[idx[h]] += ch(s[idx[e]], s[idx[f]], s[idx[g]]);
-        s[idx[h]] += k[i];
-        s[idx[h]] += w[i];
-        s[idx[d]] += s[idx[h]];
-        s[idx[h]] += maj(s[idx[a]], s[idx[b]], s[idx[c]]);
-        s[idx[h]] += sum0(s[idx[a]]);
+        const uint32_t t1 = h + sum1(e) + ch(e, f, g) + k[i] + w[i & 0x0f];
+        const uint32_t t2 = sum0(a) + maj(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
     }
+
     // (6.2.2.4)
-    for (size_t i = 0; i < 8; i++) {
-        ctx->state[i] += s[i];
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void portable_compress(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+    for (; blocks; blocks--, data += 64) {
+        sha256_hash(state, data);
+    }
+}
+
+static const sha256_backend_t portable = {
+    .name = "portable",
+    .compress = portable_compress,
+};
+
+static const sha256_backend_t *backend = &portable;
+
+static void portable_compress_lanes(uint32_t *const *states, const uint8_t *const *data, size_t blocks)
+{
+    backend->compress(states[0], data[0], blocks);
+}
+
+// One message at a time through the single-stream backend
+static const sha256_lanes_backend_t portable_lanes = {
+    .name = "portable",
+    .lanes = 1,
+    .compress_lanes = portable_compress_lanes,
+};
+
+static const sha256_lanes_backend_t *lanes_backend = &portable_lanes;
+
+// Prefer the dedicated instructions when the host has them
+__attribute__((constructor))
+static void sha256_select_backend(void)
+{
+    const sha256_backend_t *shani = sha256_ni_backend();
+    const sha256_backend_t *armv8 = sha256_armv8_backend();
+    if (shani) {
+        backend = shani;
+    }
+    else if (armv8) {
+        backend = armv8;
+    }
+
+    const sha256_lanes_backend_t *shani_lanes = sha256_ni_lanes_backend();
+    const sha256_lanes_backend_t *avx2_lanes = sha256_avx2_lanes_backend();
+    if (shani_lanes) {
+        lanes_backend = shani_lanes;
+    }
+    else if (avx2_lanes) {
+        lanes_backend = avx2_lanes;
+    }
+}
+
+// Output the state in big-endian order
+static void store_digest(const uint32_t *state, uint8_t *hash)
+{
+    for (size_t i = 0; i < 4; i++) {
+        for (size_t j = 0; j < 8; j++) {
+            hash[(4 * j) + i] = (state[j] >> (24 - (8 * i))) & 0xff;
+        }
     }
 }
 
 void sha256_append(sha256_t *ctx, const void *src, size_t len)
 {
     const uint8_t *data = (const uint8_t *)src;
-    for (size_t i = 0; i < len; i++) {
-        // Copy byte over to the context block and hash
-        // in 512-bit increments
-        ctx->data[ctx->block_bytes++] = data[i];
-        if (ctx->block_bytes == 64) {
-            sha256_hash(ctx, ctx->data);
-            ctx->bits_total += 512;
-            ctx->block_bytes = 0;
+
+    // Top up a partial block first
+    if (ctx->block_bytes) {
+        const size_t fill = 64 - ctx->block_bytes < len ? 64 - ctx->block_bytes : len;
+        memcpy(&ctx->data[ctx->block_bytes], data, fill);
+        ctx->block_bytes += fill;
+        data += fill;
+        len -= fill;
+        if (ctx->block_bytes < 64) {
+            return;
         }
+        backend->compress(ctx->state, ctx->data, 1);
+        ctx->bits_total += 512;
+        ctx->block_bytes = 0;
     }
+
+    // Hash whole blocks straight from the source
+    const size_t blocks = len / 64;
+    if (blocks) {
+        backend->compress(ctx->state, data, blocks);
+        ctx->bits_total += 512 * (uint64_t)blocks;
+        data += 64 * blocks;
+        len -= 64 * blocks;
+    }
+
+    memcpy(ctx->data, data, len);
+    ctx->block_bytes = len;
 }
 
 void sha256_finish(sha256_t *ctx, void *dst)
@@ -174,7 +247,7 @@ void sha256_finish(sha256_t *ctx, void *dst)
         ctx->data[block++] = 0;
     }
     if (end == 64) {
-        sha256_hash(ctx, ctx->data);
+        backend->compress(ctx->state, ctx->data, 1);
         memset(ctx->data, 0, 64);
     }
 
@@ -183,12 +256,64 @@ void sha256_finish(sha256_t *ctx, void *dst)
     for (size_t i = 0; i < 8; i++) {
         ctx->data[63 - i] = (uint8_t)(ctx->bits_total >> (uint8_t)(8 * i));
     }
-    sha256_hash(ctx, ctx->data);
+    backend->compress(ctx->state, ctx->data, 1);
 
-    // Copy into destination in reverse order
-    for (size_t i = 0; i < 4; i++) {
-        for (size_t j = 0; j < 8; j++) {
-            hash[(4 * j) + i] = (ctx->state[j] >> (24 - (8 * i))) & 0xff;
+    store_digest(ctx->state, hash);
+}
+
+// Hash `lanes_backend->lanes` messages of `length` bytes
+static void sha256_lanes(const uint8_t *const *chunks, size_t length, uint8_t *const *digests)
+{
+    const size_t lanes = lanes_backend->lanes;
+    uint32_t states[SHA256_LANES_MAX][8];
+    uint32_t *state_ptrs[SHA256_LANES_MAX] = { 0 };
+    for (size_t j = 0; j < lanes; j++) {
+        sha256_t ctx;
+        sha256_init(&ctx);
+        memcpy(states[j], ctx.state, sizeof(states[j]));
+        state_ptrs[j] = states[j];
+    }
+
+    const size_t blocks = length / SHA256_BLOCK_SIZE;
+    lanes_backend->compress_lanes(state_ptrs, chunks, blocks);
+
+    // Every message ends in the same number of padding blocks (5.1.1)
+    const size_t tail = length % SHA256_BLOCK_SIZE;
+    const size_t tail_blocks = tail < 56 ? 1 : 2;
+    const uint64_t bits = 8 * (uint64_t)length;
+    uint8_t padding[SHA256_LANES_MAX][2 * SHA256_BLOCK_SIZE];
+    const uint8_t *padding_ptrs[SHA256_LANES_MAX] = { 0 };
+    for (size_t j = 0; j < lanes; j++) {
+        memset(padding[j], 0, sizeof(padding[j]));
+        memcpy(padding[j], &chunks[j][SHA256_BLOCK_SIZE * blocks], tail);
+        padding[j][tail] = 128;
+        for (size_t i = 0; i < 8; i++) {
+            padding[j][SHA256_BLOCK_SIZE * tail_blocks - 1 - i] = (uint8_t)(bits >> (8 * i));
         }
+        padding_ptrs[j] = padding[j];
+    }
+    lanes_backend->compress_lanes(state_ptrs, padding_ptrs, tail_blocks);
+
+    for (size_t j = 0; j < lanes; j++) {
+        store_digest(states[j], digests[j]);
+    }
+}
+
+void sha256_chunks(const void *const *chunks, size_t length, uint8_t *const *digests, size_t count)
+{
+    const uint8_t *const *data = (const uint8_t *const *)chunks;
+    const size_t lanes = lanes_backend->lanes;
+
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        sha256_lanes(&data[i], length, &digests[i]);
+    }
+
+    // Leftover messages one at a time
+    for (; i < count; i++) {
+        sha256_t ctx;
+        sha256_init(&ctx);
+        sha256_append(&ctx, data[i], length);
+        sha256_finish(&ctx, digests[i]);
     }
 }
@@ -15,6 +15,12 @@
 #include <stdint.h>
 #include <string.h>
 
+enum SHA256 {
+    SHA256_BLOCK_SIZE = 64,
+    SHA256_DIGEST_LEN = 32,
+    SHA256_LANES_MAX = 8, // Independent messages hashed side by side
+};
+
 typedef struct sha256_t {
     uint8_t data[64];
     uint64_t block_bytes;
@@ -45,3 +51,14 @@ void sha256_append(sha256_t *ctx, const void *src, size_t len);
  * @param[out] dst destination
  */
 void sha256_finish(sha256_t *ctx, void *dst);
+
+/**
+ * @brief Hash several messages of the same length side by side, equivalent to calling
+ * sha256_init(), sha256_append(), and sha256_finish() on each message in turn
+ *
+ * @param[in] chunks pointers to the messages, one per digest
+ * @param[in] length number of bytes in every message
+ * @param[out] digests 32-byte destinations, one per message
+ * @param[in] count number of messages
+ */
+void sha256_chunks(const void *const *chunks, size_t length, uint8_t *const *digests, size_t count);
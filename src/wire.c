@@ -1,7 +1,7 @@
 /**
  * @file wire.c
  * @author Jason Conway (jpc@jasonconway.dev)
- * @brief Wire is an encyption/decryption tool for parcel built on AES in CBC mode
+ * @brief Wire is an encyption/decryption tool for parcel built on AES in CBC or GCM mode, or ChaCha20-Poly1305
  * @version 0.9.2
  * @date 2022-02-06
  *
@@ -11,6 +11,21 @@
 
 #include "wire.h"
 
+enum WireWorkers {
+	WIRE_WORKERS_MAX = 4,        // Threads decrypting a single wire, including the caller
+	WIRE_PARALLEL_MIN = 1 << 16, // Smaller wires are not worth splitting
+};
+
+static size_t wire_workers = 1;
+
+// Size the worker pool to the host. Its threads are only started once a wire is large enough to split
+__attribute__((constructor))
+static void wire_select_workers(void)
+{
+	const size_t procs = xnprocs();
+	wire_workers = procs < WIRE_WORKERS_MAX ? procs : WIRE_WORKERS_MAX;
+}
+
 // Pack byte array into 64-bit word
 uint64_t wire_pack64(const uint8_t *src)
 {
@@ -57,6 +72,17 @@ void wire_set_ctrl_args(struct wire_ctrl_message *ctrl, uint64_t args)
 	wire_unpack64(ctrl->args, (uint64_t)args);
 }
 
+enum wire_suite wire_get_ctrl_suite(struct wire_ctrl_message *ctrl)
+{
+	const uint64_t suite = wire_pack64(&ctrl->args[8]);
+	return suite < SUITE_COUNT ? (enum wire_suite)suite : SUITE_AES_CBC_CMAC;
+}
+
+void wire_set_ctrl_suite(struct wire_ctrl_message *ctrl, enum wire_suite suite)
+{
+	wire_unpack64(&ctrl->args[8], (uint64_t)suite);
+}
+
 void wire_set_ctrl_function(struct wire_ctrl_message *ctrl, enum ctrl_function function)
 {
 	wire_unpack64(ctrl->function, (uint64_t)function);
@@ -77,6 +103,46 @@ void wire_set_raw(uint8_t *dst, uint64_t src)
 	wire_unpack64(dst, src);
 }
 
+wire_suites_t wire_host_suites(void)
+{
+	// Without AES hardware ChaCha20 is several times faster than either AES suite
+	const enum wire_suite fastest = aes128_gcm_accelerated() ? SUITE_AES_GCM : SUITE_CHACHA20_POLY1305;
+	return (wire_suites_t) {
+		.supported = (1 << SUITE_AES_CBC_CMAC) | (1 << SUITE_AES_GCM) | (1 << SUITE_CHACHA20_POLY1305),
+		.preferred = 1 << fastest,
+	};
+}
+
+enum wire_suite wire_select_suite(wire_suites_t group)
+{
+	const uint64_t unanimous = group.supported & group.preferred;
+	if (unanimous & (1 << SUITE_AES_GCM)) {
+		return SUITE_AES_GCM;
+	}
+
+	// Members disagree, so pick the suite that is never slow: ChaCha20 runs well on any
+	// host, while GCM is only quick with AES hardware
+	if (group.supported & (1 << SUITE_CHACHA20_POLY1305)) {
+		return SUITE_CHACHA20_POLY1305;
+	}
+	if (group.supported & (1 << SUITE_AES_GCM)) {
+		return SUITE_AES_GCM;
+	}
+	return SUITE_AES_CBC_CMAC;
+}
+
+const char *wire_suite_name(enum wire_suite suite)
+{
+	switch (suite) {
+		case SUITE_AES_GCM:
+			return "AES-128-GCM";
+		case SUITE_CHACHA20_POLY1305:
+			return "ChaCha20-Poly1305";
+		default:
+			return "AES-128-CBC + AES-CMAC";
+	}
+}
+
 wire_t *new_wire(void)
 {
 	return xcalloc(RECV_MAX_BYTES);
@@ -93,60 +159,416 @@ wire_t *new_wire(void)
 wire_t *init_wire(void *data, uint64_t type, size_t *len)
 {
 	const uint64_t data_length = BLOCK_LEN * ((*len + 15) / BLOCK_LEN);
-	const size_t wire_length = sizeof(wire_t) + data_length;
-	wire_t *wire = xcalloc(wire_length);
+	wire_t *wire = xcalloc(sizeof(wire_t) + data_length);
 	if (!wire) {
 		return NULL;
 	}
 
-	if (xgetrandom(wire->iv, BLOCK_LEN) < 0) {
+	memcpy(wire->data, data, *len);
+	if (!(*len = init_wire_header(wire, type, *len))) {
 		return xfree(wire);
 	}
+	return wire;
+}
+
+size_t init_wire_header(wire_t *wire, uint64_t type, size_t len)
+{
+	const uint64_t data_length = BLOCK_LEN * ((len + 15) / BLOCK_LEN);
+	if (xgetrandom(wire->iv, BLOCK_LEN) < 0) {
+		return 0;
+	}
+	memset(wire->mac, 0, sizeof(wire->mac));
+	memset(wire->lac, 0, sizeof(wire->lac));
 	wire_unpack64(wire->length, data_length);
 	wire_unpack64(wire->type, type);
-	memcpy(wire->data, data, *len);
-	*len = wire_length;
-	return wire;
+	memset(&wire->data[len], 0, data_length - len);
+	return sizeof(wire_t) + data_length;
 }
 
-size_t encrypt_wire(wire_t *wire, const uint8_t *key)
+// Counter block `n` of a GCM wire: the first 12 bytes of the IV followed by a 32-bit big-endian count
+static void gcm_counter_block(uint8_t *block, const wire_t *wire, uint8_t n)
+{
+	memcpy(block, wire->iv, BLOCK_LEN - 4);
+	memset(&block[BLOCK_LEN - 4], 0, 3);
+	block[BLOCK_LEN - 1] = n;
+}
+
+// The LAC of a GCM wire is the GHASH of its encrypted length, masked by counter block 0
+static void gcm_lac(const aes128_t *ctx, const wire_t *wire, uint8_t *lac)
+{
+	uint8_t j0[16];
+	gcm_counter_block(j0, wire, 0);
+
+	aes128_gcm_t gcm;
+	aes128_gcm_init(&gcm, ctx, j0);
+	aes128_gcm_append(&gcm, wire->length, BLOCK_LEN);
+	aes128_gcm_finish(&gcm, lac);
+}
+
+// The LAC of a ChaCha20-Poly1305 wire is the Poly1305 of its encrypted length, keyed
+// by the second half of block 0 since the AEAD only uses the first
+static void chacha_lac(const uint8_t *key, const wire_t *wire, uint8_t *lac)
+{
+	uint8_t block[CHACHA20_BLOCK_SIZE] = { 0 };
+	chacha20_t chacha;
+	chacha20_init(&chacha, key, wire->iv, 0);
+	chacha20_xor(&chacha, block, sizeof(block));
+	poly1305(&block[POLY1305_KEY_LEN], wire->length, BLOCK_LEN, lac);
+}
+
+// Encrypt the length, compute the LAC, and MAC the header up to the type section,
+// leaving ctxs[0] and `cmac` ready for the type and data sections
+static size_t seal_wire(aes128_t *ctxs, aes128_cmac_t *cmac, wire_t *wire, const uint8_t *key)
 {
-	aes128_t ctxs[2]; // ctxs[0] for encryption, ctxs[1] for CMAC
 	aes128_init(&ctxs[0], wire->iv, &key[CIPHER_OFFSET]);
 	aes128_init_cmac(&ctxs[1], &key[CMAC_OFFSET]);
 
 	// Grab length from wire
 	const size_t data_length = wire_pack64(wire->length);
 
-	// Encrypt chunks
-	aes128_encrypt(&ctxs[0], wire->length, data_length + BASE_ENC_LEN);
-
-	// MAC for length only (LAC)
+	// Encrypt length and compute its MAC (LAC)
+	aes128_encrypt(&ctxs[0], wire->length, BLOCK_LEN);
 	aes128_cmac(&ctxs[1], wire->length, BLOCK_LEN, wire->lac);
 
-	// MAC for LAC, IV, length, type, and chunks into the wire
-	aes128_cmac(&ctxs[1], wire->lac, data_length + BASE_AUTH_LEN, wire->mac);
+	// MAC for LAC, IV, length, type, and chunks into the wire, with the
+	// remaining chunks MAC'd as they are encrypted
+	aes128_cmac_init(cmac, &ctxs[1]);
+	aes128_cmac_append(cmac, wire->lac, WIRE_OFFSET_TYPE - WIRE_OFFSET_LAC);
 	return data_length;
 }
 
-int decrypt_wire(wire_t *wire, size_t *len, const uint8_t *key)
+// GCM counterpart of seal_wire(), leaving `gcm` ready for the type and data sections.
+// The wire is standard GCM with the LAC and IV as additional data and everything from the length onwards as ciphertext
+static size_t seal_wire_gcm(aes128_t *ctx, aes128_gcm_t *gcm, wire_t *wire, const uint8_t *key)
 {
-	aes128_t ctxs[2];
-	aes128_init(&ctxs[0], wire->iv, &key[CIPHER_OFFSET]);
-	aes128_init_cmac(&ctxs[1], &key[CMAC_OFFSET]);
+	aes128_init_cmac(ctx, &key[CIPHER_OFFSET]);
 
-	// Decrypt only the length
-	uint8_t verification_cmac[16];
-	aes128_cmac(&ctxs[1], wire->length, BLOCK_LEN, verification_cmac);
-	if (memcmp(&wire->lac[0], verification_cmac, BLOCK_LEN)) {
-		return WIRE_INVALID_KEY;
+	// Grab length from wire
+	const size_t data_length = wire_pack64(wire->length);
+
+	// Counter block 1 masks the MAC, leaving the keystream to begin at block 2
+	uint8_t j0[16];
+	gcm_counter_block(j0, wire, 1);
+	aes128_gcm_init(gcm, ctx, j0);
+
+	// Encrypt length and compute its MAC (LAC)
+	aes128_gcm_ctr(gcm, wire->length, BLOCK_LEN);
+	gcm_lac(ctx, wire, wire->lac);
+
+	aes128_gcm_aad(gcm, wire->lac, WIRE_OFFSET_LENGTH - WIRE_OFFSET_LAC);
+	aes128_gcm_append(gcm, wire->length, BLOCK_LEN);
+	return data_length;
+}
+
+// ChaCha20-Poly1305 counterpart of seal_wire(), laid out exactly as seal_wire_gcm()
+static size_t seal_wire_chacha(chacha20_poly1305_t *chacha, wire_t *wire, const uint8_t *key)
+{
+	chacha20_poly1305_init(chacha, key, wire->iv);
+
+	// Grab length from wire
+	const size_t data_length = wire_pack64(wire->length);
+
+	// Encrypt length and compute its MAC (LAC)
+	chacha20_poly1305_xor(chacha, wire->length, BLOCK_LEN);
+	chacha_lac(key, wire, wire->lac);
+
+	chacha20_poly1305_aad(chacha, wire->lac, WIRE_OFFSET_LENGTH - WIRE_OFFSET_LAC);
+	chacha20_poly1305_append(chacha, wire->length, BLOCK_LEN);
+	return data_length;
+}
+
+size_t encrypt_wire(wire_t *wire, enum wire_suite suite, const uint8_t *key)
+{
+	aes128_t ctxs[2]; // ctxs[0] for encryption, ctxs[1] for CMAC
+	size_t data_length = 0;
+	switch (suite) {
+		case SUITE_AES_GCM: {
+			aes128_gcm_t gcm;
+			data_length = seal_wire_gcm(&ctxs[0], &gcm, wire, key);
+			aes128_gcm_encrypt(&gcm, wire->type, data_length + BASE_DEC_LEN);
+			aes128_gcm_finish(&gcm, wire->mac);
+			break;
+		}
+		case SUITE_CHACHA20_POLY1305: {
+			chacha20_poly1305_t chacha;
+			data_length = seal_wire_chacha(&chacha, wire, key);
+			chacha20_poly1305_encrypt(&chacha, wire->type, data_length + BASE_DEC_LEN);
+			chacha20_poly1305_finish(&chacha, wire->mac);
+			break;
+		}
+		default: {
+			aes128_cmac_t cmac;
+			data_length = seal_wire(ctxs, &cmac, wire, key);
+			aes128_encrypt_cmac(&ctxs[0], &cmac, wire->type, data_length + BASE_DEC_LEN);
+			aes128_cmac_finish(&cmac, wire->mac);
+			break;
+		}
+	}
+	return data_length;
+}
+
+void encrypt_wires(wire_t **wires, size_t count, enum wire_suite suite, const uint8_t *key)
+{
+	// GCM and ChaCha20 already run their blocks in parallel within each wire
+	if (suite != SUITE_AES_CBC_CMAC) {
+		for (size_t i = 0; i < count; i++) {
+			encrypt_wire(wires[i], suite, key);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < count; i += AES_LANES) {
+		const size_t lanes = count - i < AES_LANES ? count - i : AES_LANES;
+
+		aes128_t ctxs[AES_LANES][2];
+		aes128_cmac_t cmac[AES_LANES];
+		aes128_t *lane_ctxs[AES_LANES];
+		aes128_cmac_t *lane_cmacs[AES_LANES];
+		uint8_t *chunks[AES_LANES];
+		size_t lengths[AES_LANES];
+
+		for (size_t j = 0; j < lanes; j++) {
+			lengths[j] = seal_wire(ctxs[j], &cmac[j], wires[i + j], key) + BASE_DEC_LEN;
+			lane_ctxs[j] = &ctxs[j][0];
+			lane_cmacs[j] = &cmac[j];
+			chunks[j] = wires[i + j]->type;
+		}
+
+		// Type and data sections of every wire are encrypted and MAC'd side by side
+		aes128_encrypt_cmac_lanes(lane_ctxs, lane_cmacs, chunks, lengths, lanes);
+		for (size_t j = 0; j < lanes; j++) {
+			aes128_cmac_finish(&cmac[j], wires[i + j]->mac);
+		}
 	}
+}
+
+// Check the LAC and decrypt the length, leaving `stream` ready to authenticate the wire from the LAC onwards
+static int open_wire(wire_stream_t *stream, const wire_t *wire, enum wire_suite suite, const uint8_t *key, size_t *data_length)
+{
+	stream->suite = suite;
 
+	uint8_t verification_lac[16];
 	uint8_t length[16];
 	memcpy(length, wire->length, BLOCK_LEN);
 
-	aes128_decrypt(&ctxs[0], length, BLOCK_LEN);
-	const size_t data_length = wire_pack64(length);
+	switch (suite) {
+		case SUITE_AES_GCM: {
+			aes128_init_cmac(&stream->ctxs[0], &key[CIPHER_OFFSET]);
+			gcm_lac(&stream->ctxs[0], wire, verification_lac);
+			if (memcmp(&wire->lac[0], verification_lac, BLOCK_LEN)) {
+				return WIRE_INVALID_KEY;
+			}
+
+			uint8_t j0[16];
+			gcm_counter_block(j0, wire, 1);
+			aes128_gcm_init(&stream->gcm, &stream->ctxs[0], j0);
+			aes128_gcm_ctr(&stream->gcm, length, BLOCK_LEN);
+			break;
+		}
+		case SUITE_CHACHA20_POLY1305:
+			chacha_lac(key, wire, verification_lac);
+			if (memcmp(&wire->lac[0], verification_lac, BLOCK_LEN)) {
+				return WIRE_INVALID_KEY;
+			}
+
+			chacha20_poly1305_init(&stream->chacha, key, wire->iv);
+			chacha20_poly1305_xor(&stream->chacha, length, BLOCK_LEN);
+			break;
+		default:
+			aes128_init(&stream->ctxs[0], wire->iv, &key[CIPHER_OFFSET]);
+			aes128_init_cmac(&stream->ctxs[1], &key[CMAC_OFFSET]);
+			aes128_cmac(&stream->ctxs[1], wire->length, BLOCK_LEN, verification_lac);
+			if (memcmp(&wire->lac[0], verification_lac, BLOCK_LEN)) {
+				return WIRE_INVALID_KEY;
+			}
+
+			// Decrypt only the length
+			aes128_decrypt(&stream->ctxs[0], length, BLOCK_LEN);
+			aes128_cmac_init(&stream->cmac, &stream->ctxs[1]);
+			break;
+	}
+
+	*data_length = wire_pack64(length);
+	return WIRE_OK;
+}
+
+// Authenticate the first `received` bytes of a wire whose LAC has been checked
+static void stream_begin(wire_stream_t *stream, const wire_t *wire, size_t received)
+{
+	switch (stream->suite) {
+		case SUITE_AES_GCM:
+			// LAC and IV are additional data, authenticated ahead of the rest
+			aes128_gcm_aad(&stream->gcm, wire->lac, WIRE_OFFSET_LENGTH - WIRE_OFFSET_LAC);
+			stream->received = WIRE_OFFSET_LENGTH;
+			break;
+		case SUITE_CHACHA20_POLY1305:
+			chacha20_poly1305_aad(&stream->chacha, wire->lac, WIRE_OFFSET_LENGTH - WIRE_OFFSET_LAC);
+			stream->received = WIRE_OFFSET_LENGTH;
+			break;
+		default:
+			stream->received = WIRE_OFFSET_LAC;
+			break;
+	}
+	wire_stream_append(stream, (const uint8_t *)wire + stream->received, received - stream->received);
+}
+
+// One thread's share of a wire, with a cipher instance positioned at its first byte
+typedef struct wire_segment_t {
+	enum wire_suite suite;
+	aes128_t aes;
+	aes128_gcm_t gcm;
+	chacha20_t chacha;
+	uint8_t *chunk;
+	size_t length;
+} wire_segment_t;
+
+static void *decrypt_segment(void *arg)
+{
+	wire_segment_t *segment = arg;
+	switch (segment->suite) {
+		case SUITE_AES_GCM:
+			aes128_gcm_ctr(&segment->gcm, segment->chunk, segment->length);
+			break;
+		case SUITE_CHACHA20_POLY1305:
+			chacha20_xor(&segment->chacha, segment->chunk, segment->length);
+			break;
+		default:
+			aes128_decrypt(&segment->aes, segment->chunk, segment->length);
+			break;
+	}
+	return NULL;
+}
+
+// Threads kept waiting for segments, so large wires do not pay for thread creation every time
+static struct wire_pool {
+	pthread_once_t once;
+	pthread_mutex_t busy; // Held by the wire being decrypted, one at a time
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t done;
+	wire_segment_t *segments;
+	size_t next;          // Next unclaimed segment
+	size_t count;
+	size_t pending;       // Segments not yet finished
+} wire_pool = {
+	.once = PTHREAD_ONCE_INIT,
+	.busy = PTHREAD_MUTEX_INITIALIZER,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.ready = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+// Claim and decrypt segments until none are left unclaimed. Called with the pool locked
+static void wire_pool_drain(void)
+{
+	while (wire_pool.next < wire_pool.count) {
+		wire_segment_t *segment = &wire_pool.segments[wire_pool.next++];
+		pthread_mutex_unlock(&wire_pool.lock);
+		decrypt_segment(segment);
+		pthread_mutex_lock(&wire_pool.lock);
+		if (!--wire_pool.pending) {
+			pthread_cond_signal(&wire_pool.done);
+		}
+	}
+}
+
+static void *wire_pool_worker(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&wire_pool.lock);
+	for (;;) {
+		while (wire_pool.next >= wire_pool.count) {
+			pthread_cond_wait(&wire_pool.ready, &wire_pool.lock);
+		}
+		wire_pool_drain();
+	}
+	return NULL;
+}
+
+// The caller counts as a worker, so a host that could not start every thread still gets through
+static void wire_pool_start(void)
+{
+	for (size_t i = 1; i < wire_workers; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, wire_pool_worker, NULL)) {
+			break;
+		}
+		pthread_detach(thread);
+	}
+}
+
+// Decrypt every segment, sharing them with the pool unless another wire already has it
+static void wire_pool_run(wire_segment_t *segments, size_t count)
+{
+	if (count == 1 || pthread_mutex_trylock(&wire_pool.busy)) {
+		for (size_t i = 0; i < count; i++) {
+			decrypt_segment(&segments[i]);
+		}
+		return;
+	}
+	pthread_once(&wire_pool.once, wire_pool_start);
+
+	pthread_mutex_lock(&wire_pool.lock);
+	wire_pool.segments = segments;
+	wire_pool.next = 0;
+	wire_pool.count = count;
+	wire_pool.pending = count;
+	pthread_cond_broadcast(&wire_pool.ready);
+	wire_pool_drain();
+	while (wire_pool.pending) {
+		pthread_cond_wait(&wire_pool.done, &wire_pool.lock);
+	}
+	wire_pool.count = 0;
+	pthread_mutex_unlock(&wire_pool.lock);
+	pthread_mutex_unlock(&wire_pool.busy);
+}
+
+// Decrypt the type and data sections of an authenticated wire, splitting large wires across threads.
+// Every block of all three suites can be decrypted independently once its IV or counter is known
+static void decrypt_sections(wire_stream_t *stream, uint8_t *chunk, size_t length)
+{
+	const size_t workers = length < WIRE_PARALLEL_MIN ? 1 : wire_workers;
+
+	// Segment boundaries fall on ChaCha20 blocks, and so on AES blocks too
+	const size_t share = CHACHA20_BLOCK_SIZE * (length / workers / CHACHA20_BLOCK_SIZE);
+
+	// Position each segment before any thread starts, as CBC takes its IV from the ciphertext before it
+	wire_segment_t segments[WIRE_WORKERS_MAX];
+	size_t offset = 0;
+	for (size_t i = 0; i < workers; i++) {
+		wire_segment_t *segment = &segments[i];
+		segment->suite = stream->suite;
+		segment->chunk = &chunk[offset];
+		segment->length = i == workers - 1 ? length - offset : share;
+		offset += segment->length;
+
+		switch (stream->suite) {
+			case SUITE_AES_GCM:
+				segment->gcm = stream->gcm;
+				aes128_gcm_skip(&stream->gcm, segment->length);
+				break;
+			case SUITE_CHACHA20_POLY1305:
+				segment->chacha = stream->chacha.chacha;
+				chacha20_skip(&stream->chacha.chacha, segment->length);
+				break;
+			default:
+				segment->aes = stream->ctxs[0];
+				memcpy(stream->ctxs[0].iv, &segment->chunk[segment->length - BLOCK_LEN], BLOCK_LEN);
+				break;
+		}
+	}
+
+	wire_pool_run(segments, workers);
+}
+
+int decrypt_wire(wire_t *wire, size_t *len, enum wire_suite suite, const uint8_t *key)
+{
+	wire_stream_t stream;
+	size_t data_length = 0;
+	if (open_wire(&stream, wire, suite, key, &data_length)) {
+		return WIRE_INVALID_KEY;
+	}
+
 	size_t wire_length = data_length + sizeof(wire_t);
 	if (*len && *len != wire_length) {
 		const size_t received = *len;
@@ -154,15 +576,100 @@ int decrypt_wire(wire_t *wire, size_t *len, const uint8_t *key)
 		return WIRE_PARTIAL;
 	}
 	
+	// Large wires are verified first and then decrypted by several threads at once
+	if (wire_workers > 1 && data_length >= WIRE_PARALLEL_MIN) {
+		stream.length = wire_length;
+		stream_begin(&stream, wire, wire_length);
+		return wire_stream_decrypt(&stream, wire, len);
+	}
+
 	*len = data_length;
 
-	// Verify MAC prior to decrypting in full
-	aes128_cmac(&ctxs[1], wire->lac, data_length + BASE_AUTH_LEN, verification_cmac);
+	// Verify and decrypt in a single pass, discarding the plaintext if the MAC does not match
+	uint8_t verification_cmac[16];
+	switch (suite) {
+		case SUITE_AES_GCM:
+			aes128_gcm_aad(&stream.gcm, wire->lac, WIRE_OFFSET_LENGTH - WIRE_OFFSET_LAC);
+			aes128_gcm_append(&stream.gcm, wire->length, BLOCK_LEN);
+			aes128_gcm_decrypt(&stream.gcm, wire->type, data_length + BASE_DEC_LEN);
+			aes128_gcm_finish(&stream.gcm, verification_cmac);
+			break;
+		case SUITE_CHACHA20_POLY1305:
+			chacha20_poly1305_aad(&stream.chacha, wire->lac, WIRE_OFFSET_LENGTH - WIRE_OFFSET_LAC);
+			chacha20_poly1305_append(&stream.chacha, wire->length, BLOCK_LEN);
+			chacha20_poly1305_decrypt(&stream.chacha, wire->type, data_length + BASE_DEC_LEN);
+			chacha20_poly1305_finish(&stream.chacha, verification_cmac);
+			break;
+		default:
+			aes128_cmac_append(&stream.cmac, wire->lac, WIRE_OFFSET_TYPE - WIRE_OFFSET_LAC);
+			aes128_decrypt_cmac(&stream.ctxs[0], &stream.cmac, wire->type, data_length + BASE_DEC_LEN);
+			aes128_cmac_finish(&stream.cmac, verification_cmac);
+			break;
+	}
+	if (memcmp(&wire->mac[0], verification_cmac, BLOCK_LEN)) {
+		memset(wire->type, 0, data_length + BASE_DEC_LEN);
+		fprintf(stderr, "> internal: CMAC does not match\n");
+		return WIRE_CMAC_ERROR;
+	}
+	return WIRE_OK;
+}
+
+int wire_stream_init(wire_stream_t *stream, const wire_t *wire, size_t received, enum wire_suite suite, const uint8_t *key)
+{
+	size_t data_length = 0;
+	if (open_wire(stream, wire, suite, key, &data_length)) {
+		return WIRE_INVALID_KEY;
+	}
+
+	stream->length = data_length + sizeof(wire_t);
+	stream_begin(stream, wire, received);
+	return WIRE_OK;
+}
+
+void wire_stream_append(wire_stream_t *stream, const void *data, size_t len)
+{
+	// Never MAC past the end of the wire
+	if (stream->received + len > stream->length) {
+		len = stream->length - stream->received;
+	}
+	switch (stream->suite) {
+		case SUITE_AES_GCM:
+			aes128_gcm_append(&stream->gcm, data, len);
+			break;
+		case SUITE_CHACHA20_POLY1305:
+			chacha20_poly1305_append(&stream->chacha, data, len);
+			break;
+		default:
+			aes128_cmac_append(&stream->cmac, data, len);
+			break;
+	}
+	stream->received += len;
+}
+
+int wire_stream_decrypt(wire_stream_t *stream, wire_t *wire, size_t *len)
+{
+	if (stream->received != stream->length) {
+		return WIRE_PARTIAL;
+	}
+
+	uint8_t verification_cmac[16];
+	switch (stream->suite) {
+		case SUITE_AES_GCM:
+			aes128_gcm_finish(&stream->gcm, verification_cmac);
+			break;
+		case SUITE_CHACHA20_POLY1305:
+			chacha20_poly1305_finish(&stream->chacha, verification_cmac);
+			break;
+		default:
+			aes128_cmac_finish(&stream->cmac, verification_cmac);
+			break;
+	}
 	if (memcmp(&wire->mac[0], verification_cmac, BLOCK_LEN)) {
 		fprintf(stderr, "> internal: CMAC does not match\n");
 		return WIRE_CMAC_ERROR;
 	}
 
-	aes128_decrypt(&ctxs[0], wire->type, data_length + BASE_DEC_LEN);
+	*len = stream->length - sizeof(wire_t);
+	decrypt_sections(stream, wire->type, *len + BASE_DEC_LEN);
 	return WIRE_OK;
 }
@@ -1,7 +1,7 @@
 /**
  * @file wire.h
  * @author Jason Conway (jpc@jasonconway.dev)
- * @brief Wire is an encyption/decryption tool for Parcel built on AES in CBC mode
+ * @brief Wire is an encyption/decryption tool for Parcel built on AES in CBC or GCM mode, or ChaCha20-Poly1305
  * @version 0.9.2
  * @date 2022-02-06
  *
@@ -12,6 +12,7 @@
 #pragma once
 
 #include "aes128.h"
+#include "chacha20.h"
 #include "sha256.h"
 #include "xplatform.h"
 #include "xutils.h"
@@ -34,12 +35,18 @@ enum Wire {
 
 enum TypeFile {
 	FILE_PATH_MAX_LENGTH = FILENAME_MAX,
-	FILE_NAME_START = 0,
-	FILE_NAME_LEN = (1 << 8) - 1, // Win32 API limit
-	FILE_SIZE_START = FILE_NAME_LEN,
-	FILE_DATA_START = FILE_NAME_LEN + BLOCK_LEN,
-	FILE_HEADER_SIZE = FILE_DATA_START,
-	FILE_DATA_MAX_SIZE = DATA_LEN_MAX - FILE_HEADER_SIZE,
+	FILE_CHUNK_LEN = 1 << 18, // File data carried by each wire
+	FILE_DIGEST_LEN = 32,     // SHA-256 over the SHA-256 of each chunk
+	FILE_IO_CHUNK = 1 << 16,  // Bytes read or written, and hashed, per step
+	FILE_ID_LEN = 16,
+	FILE_ROUTE_LEN = 16,
+};
+
+enum file_function {
+	FILE_OFFER = 0x6f666672, // "offr", a file is up for grabs
+	FILE_WANT = 0x77616e74,  // "want", a receiver accepted, with the chunks it is missing
+	FILE_CHUNK = 0x63686e6b, // "chnk", file data
+	FILE_DONE = 0x646f6e65,  // "done", the sender is finished
 };
 
 enum TypeCtrl {
@@ -82,6 +89,25 @@ enum ctrl_function {
 	CTRL_DHKE = 0x64686b65, // "dhke"
 };
 
+/**
+ * @brief Cipher suites a wire can be sealed with. Each group's suite is chosen by
+ * the daemon during the key exchange, control wires always use SUITE_AES_CBC_CMAC
+ */
+enum wire_suite {
+	SUITE_AES_CBC_CMAC,      // AES-128-CBC, authenticated with AES-CMAC
+	SUITE_AES_GCM,           // AES-128-GCM, authenticated with GHASH
+	SUITE_CHACHA20_POLY1305, // ChaCha20, authenticated with Poly1305
+	SUITE_COUNT,
+};
+
+/**
+ * @brief Cipher suites a host can use and those it runs fastest, as bitmasks with one bit per enum wire_suite
+ */
+typedef struct wire_suites_t {
+	uint64_t supported;
+	uint64_t preferred;
+} wire_suites_t;
+
 enum DecryptionStatus {
 	WIRE_OK,
 	WIRE_CMAC_ERROR,
@@ -91,21 +117,141 @@ enum DecryptionStatus {
 
 struct wire_ctrl_message {
 	uint8_t function[16];
-	uint8_t args[16];
+	uint8_t args[16]; // Exchange rounds, followed by the group's cipher suite
 	uint8_t renewed_key[32];
 };
 
+/**
+ * @brief A file is sent as a run of chunks, each in its own wire, so neither end holds more than a chunk at a time.
+ * The sender offers the file to the group, members who accept answer with a bitmap of the chunks they are missing,
+ * and only those chunks are sent, routed by the daemon to the members who accepted. Receivers keep partial files,
+ * so accepting the same file again picks up where it left off
+ */
 struct wire_file_message {
+	uint8_t function[16];              // See enum file_function
 	char filename[64];
-	uint8_t filesize[16];
-	uint8_t filedata[];
+	uint8_t filesize[16];              // Size of the whole file
+	uint8_t file_id[FILE_ID_LEN];      // Derived from the name, size, and digest of the file
+	uint8_t route[FILE_ROUTE_LEN];     // Random, names the file's route through the daemon
+	uint8_t offset[16];                // Position of this chunk in the file
+	uint8_t length[16];                // Bytes of file data, or of the bitmap in a FILE_WANT
+	uint8_t digest[FILE_DIGEST_LEN];   // SHA-256 over the digests of every chunk, in order
+	uint8_t filedata[];                // File data, or one bit per chunk still missing in a FILE_WANT
 };
 
+/**
+ * @brief What the daemon does with a framed wire. Routes let file data skip members who did not accept it
+ */
+enum frame_action {
+	FRAME_BROADCAST,   // Relay to every other member
+	FRAME_ROUTE_OPEN,  // Open a route owned by the sender, then relay to every other member
+	FRAME_ROUTE_JOIN,  // Add the sender to a route, then relay to the route's owner
+	FRAME_ROUTE_DATA,  // Relay to the route's members
+	FRAME_ROUTE_CLOSE, // Relay to the route's members, then close the route
+	FRAME_KEY,         // A bare intermediate key for the daemon's key exchange, never relayed
+	FRAME_KEY_ABORT,   // No payload. Calls off a key exchange a member dropped out of, and is answered in kind
+};
+
+/**
+ * @brief Plaintext header sent ahead of every wire a client hands to the daemon, so the daemon
+ * can relay whole wires without holding the session key. The daemon strips it before fanning out.
+ * Wires on an unknown route are relayed to everyone
+ */
+typedef struct wire_frame_t {
+	uint8_t length[16];
+	uint8_t action[16];            // See enum frame_action
+	uint8_t route[FILE_ROUTE_LEN]; // Unused by FRAME_BROADCAST
+} wire_frame_t;
+
+/**
+ * @brief Receive-side state for a wire whose CMAC is computed as it arrives
+ */
+typedef struct wire_stream_t {
+	enum wire_suite suite;
+	aes128_t ctxs[2];           // ctxs[0] for decryption or GCM, ctxs[1] for CMAC
+	aes128_cmac_t cmac;         // Running MAC over LAC, IV, length, type, and data
+	aes128_gcm_t gcm;           // Running GHASH with LAC and IV as additional data
+	chacha20_poly1305_t chacha; // Running Poly1305 with LAC and IV as additional data
+	size_t received;    // Bytes of the wire seen so far
+	size_t length;      // Total length of the wire
+} wire_stream_t;
+
 wire_t *new_wire(void);
 wire_t *init_wire(void *data, uint64_t type, size_t *len);
 
-size_t encrypt_wire(wire_t *wire, const uint8_t *key);
-int decrypt_wire(wire_t *wire, size_t *len, const uint8_t *key);
+/**
+ * @brief Set up the header of a wire whose data was written straight into wire->data, sparing init_wire()'s copy
+ *
+ * @param[inout] wire wire with room for `len` bytes of data rounded up to a whole block
+ * @param[in] type see enum wire_type
+ * @param[in] len bytes of data already in place
+ * @return length of the whole wire, or 0 on failure
+ */
+size_t init_wire_header(wire_t *wire, uint64_t type, size_t len);
+
+/**
+ * @brief Cipher suites this build can seal and open, and those it prefers on this host
+ */
+wire_suites_t wire_host_suites(void);
+
+/**
+ * @brief Choose the cipher suite for a group
+ *
+ * @param[in] group bitwise AND of the wire_host_suites() of every member
+ * @return the suite every member prefers if there is one, otherwise the fastest suite common to the group
+ */
+enum wire_suite wire_select_suite(wire_suites_t group);
+
+/**
+ * @brief Human-readable name of a cipher suite
+ */
+const char *wire_suite_name(enum wire_suite suite);
+
+size_t encrypt_wire(wire_t *wire, enum wire_suite suite, const uint8_t *key);
+
+/**
+ * @brief Encrypt several independent wires under the same key. CBC wires have
+ * their CBC and CMAC chains interleaved so they run in parallel
+ *
+ * @param[inout] wires wires initialized with init_wire()
+ * @param[in] count number of wires
+ * @param[in] suite cipher suite to seal the wires with
+ * @param[in] key 32-byte session or control key
+ */
+void encrypt_wires(wire_t **wires, size_t count, enum wire_suite suite, const uint8_t *key);
+
+int decrypt_wire(wire_t *wire, size_t *len, enum wire_suite suite, const uint8_t *key);
+
+/**
+ * @brief Begin verifying a partially received wire
+ *
+ * @param[out] stream wire_stream_t instance
+ * @param[in] wire wire containing at least its header
+ * @param[in] received number of bytes of the wire received so far
+ * @param[in] suite cipher suite the wire was sealed with
+ * @param[in] key 32-byte session or control key
+ * @return WIRE_OK, or WIRE_INVALID_KEY if the LAC does not match
+ */
+int wire_stream_init(wire_stream_t *stream, const wire_t *wire, size_t received, enum wire_suite suite, const uint8_t *key);
+
+/**
+ * @brief MAC the next portion of a wire as it arrives
+ *
+ * @param[inout] stream wire_stream_t instance
+ * @param[in] data bytes immediately following those previously received
+ * @param[in] len number of bytes received
+ */
+void wire_stream_append(wire_stream_t *stream, const void *data, size_t len);
+
+/**
+ * @brief Check the MAC of a fully received wire and decrypt it
+ *
+ * @param[inout] stream wire_stream_t instance
+ * @param[inout] wire the complete wire
+ * @param[out] len length of the wire data section
+ * @return WIRE_OK, or WIRE_CMAC_ERROR if the MAC does not match
+ */
+int wire_stream_decrypt(wire_stream_t *stream, wire_t *wire, size_t *len);
 
 uint64_t wire_pack64(const uint8_t *src);
 uint64_t wire_get_raw(uint8_t *src);
@@ -118,4 +264,7 @@ void wire_set_ctrl_function(struct wire_ctrl_message *ctrl, enum ctrl_function f
 uint64_t wire_get_ctrl_args(struct wire_ctrl_message *ctrl);
 void wire_set_ctrl_args(struct wire_ctrl_message *ctrl, uint64_t args);
 
+enum wire_suite wire_get_ctrl_suite(struct wire_ctrl_message *ctrl);
+void wire_set_ctrl_suite(struct wire_ctrl_message *ctrl, enum wire_suite suite);
+
 void wire_set_ctrl_renewal(struct wire_ctrl_message *ctrl, const uint8_t *renewed_key);
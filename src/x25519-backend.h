@@ -0,0 +1,36 @@
+/**
+ * @file x25519-backend.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multi-lane ladders implemented by each X25519 backend
+ * @version 0.9.4
+ * @date 2022-02-01
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "x25519.h"
+
+enum X25519Backend {
+    X25519_LANES_MAX = 8,
+};
+
+/**
+ * @brief Ladders behind x25519_batch()
+ */
+typedef struct x25519_backend_t {
+    const char *name;
+    size_t lanes; // At most X25519_LANES_MAX
+
+    // Run `lanes` independent ladders side by side, each equivalent to x25519(public[i], secret[i], basepoint[i])
+    void (*ladder)(uint8_t *const *public, const uint8_t *const *secret, const uint8_t *const *basepoint);
+} x25519_backend_t;
+
+/**
+ * @brief AVX2 backend, four ladders at a time in radix 2^25.5
+ *
+ * @return NULL if the host is not x86 or lacks AVX2
+ */
+const x25519_backend_t *x25519_avx2_backend(void);
@@ -0,0 +1,350 @@
+/**
+ * @file x25519-simd.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief AVX2 backend for x25519, running four independent ladders in the 64-bit lanes of each register
+ * @ref https://cr.yp.to/ecdh/curve25519-20060209.pdf
+ * @version 0.9.4
+ * @date 2022-02-01
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "x25519-backend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+enum X25519Lanes {
+    LANES = 4,
+    LIMBS = 10,
+};
+
+// Ten unsigned limbs in radix 2^25.5, alternating between 26 and 25 bits, with vector i holding limb i of all four
+// lanes. _mm256_mul_epu32() multiplies the low 32 bits of each lane, so limbs stay below 2^28 and multiply() scales
+// only its right operand by 19, which subtract() keeps below 2^32 by adding 2p rather than 4p
+typedef struct field4_t {
+    __m256i q[LIMBS];
+} field4_t;
+
+// Width of limb i
+#define LIMB_BITS(i) (26 - ((i) & 1))
+
+AVX2 static inline __m256i times19(__m256i x)
+{
+    return _mm256_add_epi64(x, _mm256_add_epi64(_mm256_slli_epi64(x, 1), _mm256_slli_epi64(x, 4)));
+}
+
+// Carry 64-bit column sums into limbs, folding the carry out of the top limb back into the bottom one
+// since 2^255 = 19 mod p
+AVX2 static inline void carry_reduce(field4_t *dst, __m256i *t)
+{
+    const __m256i mask26 = _mm256_set1_epi64x((1 << 26) - 1);
+    const __m256i mask25 = _mm256_set1_epi64x((1 << 25) - 1);
+
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        const __m256i carry = _mm256_srli_epi64(t[i], LIMB_BITS(i));
+        t[i] = _mm256_and_si256(t[i], (i & 1) ? mask25 : mask26);
+        if (i == LIMBS - 1) {
+            t[0] = _mm256_add_epi64(t[0], times19(carry));
+        }
+        else {
+            t[i + 1] = _mm256_add_epi64(t[i + 1], carry);
+        }
+    }
+    t[1] = _mm256_add_epi64(t[1], _mm256_srli_epi64(t[0], 26));
+    t[0] = _mm256_and_si256(t[0], mask26);
+
+    memcpy(dst->q, t, sizeof(dst->q));
+}
+
+AVX2 static inline void multiply(field4_t *dst, const field4_t *a, const field4_t *b)
+{
+    // Products landing at 2^255 and above wrap around multiplied by 19, odd-by-odd products are doubled
+    __m256i a2[LIMBS];
+    __m256i b19[LIMBS];
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        a2[i] = _mm256_add_epi64(a->q[i], a->q[i]);
+        b19[i] = _mm256_mul_epu32(b->q[i], _mm256_set1_epi64x(19));
+    }
+
+    __m256i t[LIMBS];
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        t[i] = _mm256_setzero_si256();
+    }
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        #pragma GCC unroll 10
+        for (size_t j = 0; j < LIMBS; j++) {
+            const __m256i x = (i & j & 1) ? a2[i] : a->q[i];
+            const __m256i y = (i + j >= LIMBS) ? b19[j] : b->q[j];
+            t[(i + j) % LIMBS] = _mm256_add_epi64(t[(i + j) % LIMBS], _mm256_mul_epu32(x, y));
+        }
+    }
+    carry_reduce(dst, t);
+}
+
+// Each cross product appears twice, leaving 55 multiplications instead of 100
+AVX2 static inline void square(field4_t *dst, const field4_t *src)
+{
+    __m256i x2[LIMBS];
+    __m256i x4[LIMBS];
+    __m256i x19[LIMBS];
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        x2[i] = _mm256_slli_epi64(src->q[i], 1);
+        x4[i] = _mm256_slli_epi64(src->q[i], 2);
+        x19[i] = _mm256_mul_epu32(src->q[i], _mm256_set1_epi64x(19));
+    }
+
+    __m256i t[LIMBS];
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        t[i] = _mm256_setzero_si256();
+    }
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        #pragma GCC unroll 10
+        for (size_t j = i; j < LIMBS; j++) {
+            const size_t scale = (i == j ? 1 : 2) * ((i & j & 1) ? 2 : 1);
+            const __m256i x = (scale == 4) ? x4[i] : (scale == 2) ? x2[i] : src->q[i];
+            const __m256i y = (i + j >= LIMBS) ? x19[j] : src->q[j];
+            t[(i + j) % LIMBS] = _mm256_add_epi64(t[(i + j) % LIMBS], _mm256_mul_epu32(x, y));
+        }
+    }
+    carry_reduce(dst, t);
+}
+
+// Multiply by (A - 2) / 4 = 121665
+AVX2 static inline void multiply_a24(field4_t *dst, const field4_t *src)
+{
+    __m256i t[LIMBS];
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        t[i] = _mm256_mul_epu32(src->q[i], _mm256_set1_epi64x(121665));
+    }
+    carry_reduce(dst, t);
+}
+
+AVX2 static inline void add(field4_t *dst, const field4_t *a, const field4_t *b)
+{
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        dst->q[i] = _mm256_add_epi64(a->q[i], b->q[i]);
+    }
+}
+
+// Add 2p before subtracting so no limb goes negative
+AVX2 static inline void subtract(field4_t *dst, const field4_t *a, const field4_t *b)
+{
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        const int64_t p2 = (i == 0) ? 2 * ((1 << 26) - 19) : 2 * ((1 << LIMB_BITS(i)) - 1);
+        dst->q[i] = _mm256_sub_epi64(_mm256_add_epi64(a->q[i], _mm256_set1_epi64x(p2)), b->q[i]);
+    }
+}
+
+// Conditionally swap the contents of a and b in each lane whose mask is all ones, must be constant time
+AVX2 static inline void swap(field4_t *a, field4_t *b, __m256i mask)
+{
+    #pragma GCC unroll 10
+    for (size_t i = 0; i < LIMBS; i++) {
+        const __m256i val = _mm256_and_si256(mask, _mm256_xor_si256(a->q[i], b->q[i]));
+        a->q[i] = _mm256_xor_si256(a->q[i], val);
+        b->q[i] = _mm256_xor_si256(b->q[i], val);
+    }
+}
+
+AVX2 static inline void square_n(field4_t *dst, const field4_t *src, size_t n)
+{
+    square(dst, src);
+    for (size_t i = 1; i < n; i++) {
+        square(dst, dst);
+    }
+}
+
+// Fermat inversion with the same addition chain as the scalar field
+AVX2 static void inverse(field4_t *dst, const field4_t *src)
+{
+    field4_t z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+    square(&z2, src);
+    square_n(&t, &z2, 2);
+    multiply(&z9, &t, src);
+    multiply(&z11, &z9, &z2);
+    square(&t, &z11);
+    multiply(&z2_5_0, &t, &z9);
+
+    square_n(&t, &z2_5_0, 5);
+    multiply(&z2_10_0, &t, &z2_5_0);
+    square_n(&t, &z2_10_0, 10);
+    multiply(&z2_20_0, &t, &z2_10_0);
+    square_n(&t, &z2_20_0, 20);
+    multiply(&t, &t, &z2_20_0);
+    square_n(&t, &t, 10);
+    multiply(&z2_50_0, &t, &z2_10_0);
+    square_n(&t, &z2_50_0, 50);
+    multiply(&z2_100_0, &t, &z2_50_0);
+    square_n(&t, &z2_100_0, 100);
+    multiply(&t, &t, &z2_100_0);
+    square_n(&t, &t, 50);
+    multiply(&t, &t, &z2_50_0);
+    square_n(&t, &t, 5);
+    multiply(dst, &t, &z11);
+}
+
+// Load one lane's limbs from bytes, ignoring the top bit
+static void unpack(uint64_t *limbs, const uint8_t *src)
+{
+    for (size_t i = 0, offset = 0; i < LIMBS; offset += LIMB_BITS(i), i++) {
+        uint64_t window = 0;
+        for (size_t j = 0; j < 5 && offset / 8 + j < 32; j++) {
+            window |= (uint64_t)src[offset / 8 + j] << (8 * j);
+        }
+        limbs[i] = (window >> (offset % 8)) & ((UINT64_C(1) << LIMB_BITS(i)) - 1);
+    }
+}
+
+// Store one lane's limbs as bytes, fully reduced
+static void pack(uint8_t *dst, const uint64_t *src)
+{
+    uint64_t h[LIMBS];
+    memcpy(h, src, sizeof(h));
+
+    // Ensure all limbs are in [0, 2^bits - 1], leaving the value in [0, 2p)
+    for (size_t i = 0; i < LIMBS; i++) {
+        const uint64_t carry = h[i] >> LIMB_BITS(i);
+        h[i] &= (UINT64_C(1) << LIMB_BITS(i)) - 1;
+        if (i == LIMBS - 1) {
+            h[0] += 19 * carry;
+        }
+        else {
+            h[i + 1] += carry;
+        }
+    }
+    h[1] += h[0] >> 26;
+    h[0] &= (1 << 26) - 1;
+
+    // q is 1 exactly when h >= p, in which case adding 19 and dropping 2^255 subtracts p
+    uint64_t q = (h[0] + 19) >> 26;
+    for (size_t i = 1; i < LIMBS; i++) {
+        q = (h[i] + q) >> LIMB_BITS(i);
+    }
+    h[0] += 19 * q;
+    for (size_t i = 0; i < LIMBS; i++) {
+        if (i < LIMBS - 1) {
+            h[i + 1] += h[i] >> LIMB_BITS(i);
+        }
+        h[i] &= (UINT64_C(1) << LIMB_BITS(i)) - 1;
+    }
+
+    memset(dst, 0, 32);
+    for (size_t i = 0, offset = 0; i < LIMBS; offset += LIMB_BITS(i), i++) {
+        const uint64_t limb = h[i] << (offset % 8);
+        for (size_t j = 0; j < 5 && offset / 8 + j < 32; j++) {
+            dst[offset / 8 + j] |= (uint8_t)(limb >> (8 * j));
+        }
+    }
+}
+
+AVX2 static void avx2_ladder(uint8_t *const *public, const uint8_t *const *secret, const uint8_t *const *basepoint)
+{
+    uint64_t limbs[LIMBS][LANES];
+    for (size_t lane = 0; lane < LANES; lane++) {
+        uint64_t lane_limbs[LIMBS];
+        unpack(lane_limbs, basepoint[lane]);
+        for (size_t i = 0; i < LIMBS; i++) {
+            limbs[i][lane] = lane_limbs[i];
+        }
+    }
+
+    field4_t x;
+    for (size_t i = 0; i < LIMBS; i++) {
+        x.q[i] = _mm256_loadu_si256((const __m256i *)limbs[i]);
+    }
+
+    // a, b, c, and d exactly as in the scalar ladder
+    field4_t inputs[4];
+    memset(inputs, 0, sizeof(inputs));
+    inputs[0].q[0] = _mm256_set1_epi64x(1);
+    inputs[1] = x;
+    inputs[3].q[0] = _mm256_set1_epi64x(1);
+
+    field4_t intermediate[2];
+
+    for (int64_t i = 254; i >= 0; i--) {
+        const __m256i mask = _mm256_sub_epi64(_mm256_setzero_si256(), _mm256_setr_epi64x(
+            (secret[0][i / 8] >> (i & 7)) & 1, (secret[1][i / 8] >> (i & 7)) & 1,
+            (secret[2][i / 8] >> (i & 7)) & 1, (secret[3][i / 8] >> (i & 7)) & 1));
+
+        swap(&inputs[0], &inputs[1], mask);
+        swap(&inputs[2], &inputs[3], mask);
+
+        add(&intermediate[0], &inputs[0], &inputs[2]);        // v1 = a + c
+        subtract(&inputs[0], &inputs[0], &inputs[2]);         // v2 = a - c
+        add(&inputs[2], &inputs[1], &inputs[3]);              // v3 = b + d
+        subtract(&inputs[1], &inputs[1], &inputs[3]);         // v4 = b - d
+        square(&inputs[3], &intermediate[0]);                 // v5 = v1**2
+        square(&intermediate[1], &inputs[0]);                 // v6 = v2**2
+        multiply(&inputs[0], &inputs[2], &inputs[0]);         // v7 = v3*v2
+        multiply(&inputs[2], &inputs[1], &intermediate[0]);   // v8 = v4*v1
+        add(&intermediate[0], &inputs[0], &inputs[2]);        // v9 = v7 + v8
+        subtract(&inputs[0], &inputs[0], &inputs[2]);         // v10 = v7 - v8
+        square(&inputs[1], &inputs[0]);                       // v11 = v10**2
+        subtract(&inputs[2], &inputs[3], &intermediate[1]);   // v12 = v5 - v6
+        multiply_a24(&inputs[0], &inputs[2]);                 // v13 = 121665*v12
+        add(&inputs[0], &inputs[0], &inputs[3]);              // v14 = v13 + v5
+        multiply(&inputs[2], &inputs[2], &inputs[0]);         // v15 = v12*v14
+        multiply(&inputs[0], &inputs[3], &intermediate[1]);   // v16 = v5*v6
+        multiply(&inputs[3], &inputs[1], &x);                 // v17 = v11*x
+        square(&inputs[1], &intermediate[0]);                 // v18 = v9**2
+
+        swap(&inputs[0], &inputs[1], mask);
+        swap(&inputs[2], &inputs[3], mask);
+    }
+
+    // x2 / z2
+    inverse(&inputs[2], &inputs[2]);
+    multiply(&inputs[0], &inputs[0], &inputs[2]);
+
+    for (size_t i = 0; i < LIMBS; i++) {
+        _mm256_storeu_si256((__m256i *)limbs[i], inputs[0].q[i]);
+    }
+    for (size_t lane = 0; lane < LANES; lane++) {
+        uint64_t lane_limbs[LIMBS];
+        for (size_t i = 0; i < LIMBS; i++) {
+            lane_limbs[i] = limbs[i][lane];
+        }
+        pack(public[lane], lane_limbs);
+    }
+}
+
+static const x25519_backend_t avx2 = {
+    .name = "avx2",
+    .lanes = LANES,
+    .ladder = avx2_ladder,
+};
+
+const x25519_backend_t *x25519_avx2_backend(void)
+{
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2")) {
+        return NULL;
+    }
+    return &avx2;
+}
+
+#else
+
+const x25519_backend_t *x25519_avx2_backend(void)
+{
+    return NULL;
+}
+
+#endif
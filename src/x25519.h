@@ -24,3 +24,22 @@
  *
  */
 void x25519(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint);
+
+/**
+ * @brief Several independent X25519 computations, equivalent to calling x25519() on each in turn.
+ * Groups of ladders run side by side in SIMD lanes when the host supports it
+ *
+ * @param[out] public 32-byte public keys / shared secrets, one per computation
+ * @param[in] secret 32-byte secret keys, one per computation
+ * @param[in] basepoint 32-byte points, one per computation
+ * @param[in] count number of computations
+ */
+void x25519_batch(uint8_t *const *public, const uint8_t *const *secret, const uint8_t *const *basepoint, size_t count);
+
+/**
+ * @brief X25519 with the standard base point u = 9, computed from precomputed multiples of it
+ *
+ * @param[out] public 32-byte public key, identical to x25519(public, secret, { 9 })
+ * @param[in] secret 32-byte secret key
+ */
+void x25519_base(uint8_t *public, const uint8_t *secret);
@@ -10,6 +10,7 @@
  */
 
 #include "xplatform.h"
+#include "chacha20.h"
 
 /**
  * @section BSD / Winsock wrappers
@@ -33,6 +34,43 @@ ssize_t xrecv(sock_t socket, void *data, size_t len, int flags)
 #endif
 }
 
+ssize_t xsend_nowait(sock_t socket, const void *data, size_t len)
+{
+#if __unix__ || __APPLE__
+	const ssize_t sent = send(socket, data, len, MSG_DONTWAIT);
+	if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
+	return sent;
+#elif _WIN32
+	u_long nonblocking = 1;
+	if (ioctlsocket(socket, FIONBIO, &nonblocking)) {
+		return -1;
+	}
+	const int sent = send(socket, (const char *)data, (int)len, 0);
+	const bool full = sent == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK;
+	nonblocking = 0;
+	if (ioctlsocket(socket, FIONBIO, &nonblocking)) {
+		return -1;
+	}
+	return full ? 0 : sent;
+#endif
+}
+
+int xsettimeout(sock_t socket, unsigned int seconds)
+{
+#if __unix__ || __APPLE__
+	const struct timeval timeout = { .tv_sec = seconds };
+#elif _WIN32
+	const DWORD timeout = seconds * 1000;
+#endif
+	if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const void *)&timeout, sizeof(timeout)) ||
+		setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (const void *)&timeout, sizeof(timeout))) {
+		return -1;
+	}
+	return 0;
+}
+
 int xclose(sock_t socket)
 {
 #if __unix__ || __APPLE__
@@ -251,20 +289,142 @@ size_t xfd_init_count(sock_t fd)
  * @section unistd / win32 wrappers and portable implementations
  */
 
-ssize_t xgetrandom(void *dst, size_t len)
+// Read `len` bytes of entropy straight from the operating system
+static ssize_t xgetentropy(void *dst, size_t len)
 {
-#if __unix__ || __APPLE__
+#if __linux__
+	for (size_t i = 0; i < len;) {
+		const ssize_t bytes = getrandom((uint8_t *)dst + i, len - i, 0);
+		if (bytes < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		i += (size_t)bytes;
+	}
+	return len;
+#elif __APPLE__
+	// getentropy() fills at most 256 bytes per call
+	for (size_t i = 0; i < len; i += 256) {
+		if (getentropy((uint8_t *)dst + i, len - i < 256 ? len - i : 256)) {
+			return -1;
+		}
+	}
+	return len;
+#elif __unix__
 	FILE *random = fopen("/dev/urandom", "rb");
 	if (!random) {
 		return -1;
 	}
-	if (!fread(dst, len, 1, random)) {
+	const size_t read = fread(dst, len, 1, random);
+	(void)fclose(random);
+	return read ? (ssize_t)len : -1;
+#elif _WIN32
+	return !RtlGenRandom(dst, len) ? -1 : (ssize_t)len;
+#endif
+}
+
+enum Csprng {
+	CSPRNG_KEY_LEN = CHACHA20_KEY_LEN,
+	CSPRNG_BUFFER_LEN = 16 * CHACHA20_BLOCK_SIZE, // Keystream generated per refill
+	CSPRNG_RESEED_BYTES = 1 << 20,                // Output between reseeds from the operating system
+};
+
+// Per-thread ChaCha20 generator with fast key erasure: each refill's first bytes become the next key,
+// and every byte is wiped from the buffer as it is handed out
+typedef struct csprng_t {
+	uint8_t key[CSPRNG_KEY_LEN];
+	uint8_t buffer[CSPRNG_BUFFER_LEN];
+	size_t available;    // Unused bytes at the end of `buffer`
+	size_t output;       // Bytes handed out since the last reseed
+	uint64_t generation; // csprng_generation when last seeded
+} csprng_t;
+
+static _Thread_local csprng_t csprng;
+
+// Incremented in every forked child so no two processes share a generator state
+static atomic_uint_fast64_t csprng_generation = 1;
+
+#if __unix__ || __APPLE__
+static pthread_once_t csprng_once = PTHREAD_ONCE_INIT;
+
+static void csprng_forked(void)
+{
+	atomic_fetch_add(&csprng_generation, 1);
+}
+
+static void csprng_register_fork(void)
+{
+	(void)pthread_atfork(NULL, NULL, csprng_forked);
+}
+#endif
+
+static int csprng_seed(csprng_t *rng)
+{
+#if __unix__ || __APPLE__
+	(void)pthread_once(&csprng_once, csprng_register_fork);
+#endif
+	if (xgetentropy(rng->key, CSPRNG_KEY_LEN) < 0) {
 		return -1;
 	}
-	(void)fclose(random);
+	memset(rng->buffer, 0, CSPRNG_BUFFER_LEN);
+	rng->available = 0;
+	rng->output = 0;
+	rng->generation = atomic_load(&csprng_generation);
+	return 0;
+}
+
+static void csprng_refill(csprng_t *rng)
+{
+	static const uint8_t nonce[CHACHA20_NONCE_LEN] = { 0 };
+	chacha20_t ctx;
+	chacha20_init(&ctx, rng->key, nonce, 0);
+	memset(rng->buffer, 0, CSPRNG_BUFFER_LEN);
+	chacha20_xor(&ctx, rng->buffer, CSPRNG_BUFFER_LEN);
+	memset(&ctx, 0, sizeof(ctx));
+
+	memcpy(rng->key, rng->buffer, CSPRNG_KEY_LEN);
+	memset(rng->buffer, 0, CSPRNG_KEY_LEN);
+	rng->available = CSPRNG_BUFFER_LEN - CSPRNG_KEY_LEN;
+}
+
+ssize_t xgetrandom(void *dst, size_t len)
+{
+	csprng_t *rng = &csprng;
+	if (!rng->generation || rng->generation != atomic_load(&csprng_generation) || rng->output >= CSPRNG_RESEED_BYTES) {
+		if (csprng_seed(rng)) {
+			return -1;
+		}
+	}
+
+	uint8_t *out = dst;
+	for (size_t remaining = len; remaining;) {
+		if (!rng->available) {
+			csprng_refill(rng);
+		}
+		const size_t bytes = remaining < rng->available ? remaining : rng->available;
+		uint8_t *src = &rng->buffer[CSPRNG_BUFFER_LEN - rng->available];
+		memcpy(out, src, bytes);
+		memset(src, 0, bytes);
+		rng->available -= bytes;
+		out += bytes;
+		remaining -= bytes;
+	}
+	rng->output += len;
 	return len;
+}
+
+// Number of online processors, at least one
+size_t xnprocs(void)
+{
+#if __unix__ || __APPLE__
+	const long procs = sysconf(_SC_NPROCESSORS_ONLN);
+	return procs > 0 ? (size_t)procs : 1;
 #elif _WIN32
-	return !RtlGenRandom(dst, len) ? -1 : (ssize_t)len;
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
 #endif
 }
 
@@ -296,6 +456,60 @@ size_t xfilesize(const char *filename)
 #endif
 }
 
+// Reserve `len` bytes of disk for a file up front so it can be written in any order without fragmenting
+int xfallocate(FILE *file, size_t len)
+{
+	if (!len) {
+		return 0;
+	}
+#if __APPLE__
+	const int fd = fileno(file);
+	fstore_t store = {
+		.fst_flags = F_ALLOCATECONTIG,
+		.fst_posmode = F_PEOFPOSMODE,
+		.fst_offset = 0,
+		.fst_length = (off_t)len,
+	};
+	if (fcntl(fd, F_PREALLOCATE, &store) < 0) {
+		store.fst_flags = F_ALLOCATEALL;
+		(void)fcntl(fd, F_PREALLOCATE, &store);
+	}
+	return ftruncate(fd, (off_t)len) ? -1 : 0;
+#elif __unix__
+	return posix_fallocate(fileno(file), 0, (off_t)len) ? -1 : 0;
+#elif _WIN32
+	return _chsize_s(_fileno(file), (__int64)len) ? -1 : 0;
+#endif
+}
+
+int xfseek(FILE *file, uint64_t offset)
+{
+#if __unix__ || __APPLE__
+	return fseeko(file, (off_t)offset, SEEK_SET);
+#elif _WIN32
+	return _fseeki64(file, (__int64)offset, SEEK_SET);
+#endif
+}
+
+// Write at `offset` without going through the stream. pwrite() leaves the file position alone, but WriteFile() moves it
+// past the bytes written, so callers seek before any buffered I/O on the same file
+ssize_t xpwrite(FILE *file, const void *data, size_t len, uint64_t offset)
+{
+#if __unix__ || __APPLE__
+	return pwrite(fileno(file), data, len, (off_t)offset);
+#elif _WIN32
+	OVERLAPPED overlapped = {
+		.Offset = (DWORD)offset,
+		.OffsetHigh = (DWORD)(offset >> 32),
+	};
+	DWORD bytes_written = 0;
+	if (!WriteFile((HANDLE)_get_osfhandle(_fileno(file)), data, (DWORD)len, &bytes_written, &overlapped)) {
+		return -1;
+	}
+	return bytes_written;
+#endif
+}
+
 /**
  * @section malloc / calloc wrapper to lessen Windows runtime dependency
  */
@@ -26,6 +26,8 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <limits.h>
+#include <errno.h>
+#include <time.h>
 
 #if __unix__ || __APPLE__
 	#include <unistd.h>
@@ -40,6 +42,9 @@
 	#include <termios.h>
 	#include <sys/time.h>
 	#include <poll.h>
+	#if __linux__ || __APPLE__
+		#include <sys/random.h>
+	#endif
 	typedef int sock_t;
 	typedef struct termios console_t;
 #endif
@@ -127,6 +132,20 @@ int xaccept(sock_t *connection_socket, sock_t listening_socket, struct sockaddr
 ssize_t xsend(sock_t socket, const void *data, size_t len, int flags);
 ssize_t xrecv(sock_t socket, void *data, size_t len, int flags);
 
+/**
+ * @brief Send as much of `data` as the socket takes without blocking
+ *
+ * @return bytes sent, 0 if the socket cannot take any more yet, -1 on error
+ */
+ssize_t xsend_nowait(sock_t socket, const void *data, size_t len);
+
+/**
+ * @brief Fail blocking sends and receives on `socket` that make no progress for `seconds`
+ *
+ * @return 0 on success, -1 on error
+ */
+int xsettimeout(sock_t socket, unsigned int seconds);
+
 size_t xfd_count(sock_t fd, size_t count);
 size_t xfd_init_count(sock_t fd);
 sock_t xfd_isset(fd_set *set, fd_set *read_fds, size_t index);
@@ -144,7 +163,11 @@ int xstartup(void);
 
 int xgetlogin(char *username, size_t len);
 ssize_t xgetrandom(void *dst, size_t len);
+size_t xnprocs(void);
 size_t xfilesize(const char *filename);
+int xfallocate(FILE *file, size_t len);
+int xfseek(FILE *file, uint64_t offset);
+ssize_t xpwrite(FILE *file, const void *data, size_t len, uint64_t offset);
 char *xget_dir(char *file);
 int xmkdir(const char *path, mode_t mode);
 char *xgethome(void);
@@ -113,6 +113,7 @@ ssize_t xrecvall(sock_t socket, void *data, size_t len)
 		ssize_t bytes_recv = xrecv(socket, &_data[i], len - i, 0);
 		switch (bytes_recv) {
 			case -1:
+			case 0: // Connection closed
 				return -1;
 			default:
 				i += bytes_recv;
@@ -268,12 +269,10 @@ char *xget_dir(char *file)
 size_t xbasename(const char *path, char *filename)
 {
 	const size_t path_length = strnlen(path, FILENAME_MAX);
-	size_t pos = path_length + 1;
-	char *base = NULL;
-	for (const char *start = path;; pos--) {
-		if (start[pos] == '/') {
-			base = (void *)&start[pos + 1];
-			const size_t filename_length = strnlen(base, FILENAME_MAX);
+	for (size_t pos = path_length; pos--;) {
+		if (path[pos] == '/') {
+			const char *base = &path[pos + 1];
+			const size_t filename_length = path_length - (pos + 1);
 			memcpy(filename, base, filename_length);
 			return filename_length;
 		}
@@ -0,0 +1,175 @@
+/**
+ * @file aes128-cmac.c
+ * @brief Check AES-CMAC against the known answers from RFC 4493, in one call and streamed in pieces that straddle
+ * blocks, then check the fused aes128_encrypt_cmac() and aes128_decrypt_cmac() against the CBC example vectors
+ * from NIST SP 800-38A F.2.1 and F.2.2, authenticated with CMAC under the same key
+ * @ref https://datatracker.ietf.org/doc/html/rfc4493
+ *
+ * @copyright Copyright (c) 2021 - 2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "aes128.h"
+#include "kat.h"
+
+static const char key_hex[] = "2b7e151628aed2a6abf7158809cf4f3c";
+
+// Shared by RFC 4493 and SP 800-38A
+static const char plaintext_hex[] = "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+                                    "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+
+typedef struct cmac_vector_t {
+    const char *name;
+    size_t length; // Bytes of the shared plaintext
+    const char *mac;
+} cmac_vector_t;
+
+static const cmac_vector_t vectors[] = {
+    { .name = "CMAC RFC 4493 example 1", .length = 0, .mac = "bb1d6929e95937287fa37d129b756746" },
+    { .name = "CMAC RFC 4493 example 2", .length = 16, .mac = "070a16b46b4d4144f79bdd9dd04a287c" },
+    { .name = "CMAC RFC 4493 example 3", .length = 40, .mac = "dfa66747de9ae63030ca32611497c827" },
+    { .name = "CMAC RFC 4493 example 4", .length = 64, .mac = "51f0bebf7e3b9d92fc49741779363cfe" },
+};
+
+static const char cbc_iv_hex[] = "000102030405060708090a0b0c0d0e0f";
+static const char cbc_ciphertext_hex[] = "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2"
+                                         "73bed6b8e3c1743b7116e69e222295163ff1caa1681fac09120eca307586e1a7";
+static const char cbc_mac_hex[] = "74e901f49e5fdecbaa3a3638cec798c8";
+
+enum CbcVector {
+    CBC_LEN = 64,
+};
+
+static uint8_t key[AES_KEY_LEN], iv[AES_BLOCK_SIZE], plaintext[CBC_LEN], ciphertext[CBC_LEN];
+static aes128_t mac_ctx;
+
+// Stream the first `length` bytes of the plaintext in pieces, cycling through `pieces`
+static void stream_cmac(size_t length, const size_t *pieces, size_t count, uint8_t *mac)
+{
+    aes128_cmac_t cmac;
+    aes128_cmac_init(&cmac, &mac_ctx);
+    size_t offset = 0;
+    for (size_t i = 0; offset < length; i = (i + 1) % count) {
+        const size_t piece = pieces[i] < length - offset ? pieces[i] : length - offset;
+        aes128_cmac_append(&cmac, &plaintext[offset], piece);
+        offset += piece;
+    }
+    aes128_cmac_finish(&cmac, mac);
+}
+
+static int check_cmac(const cmac_vector_t *vector)
+{
+    static const size_t pieces[] = { 1, 15, 3, AES_BLOCK_SIZE, 2 * AES_BLOCK_SIZE };
+    const size_t count = sizeof(pieces) / sizeof(*pieces);
+    uint8_t mac[AES_BLOCK_SIZE];
+
+    aes128_cmac(&mac_ctx, plaintext, vector->length, mac);
+    int failed = kat_check(vector->name, mac, vector->mac, AES_BLOCK_SIZE);
+
+    // Each piece size on its own, then all of them in turn
+    for (size_t i = 0; i < count; i++) {
+        stream_cmac(vector->length, &pieces[i], 1, mac);
+        failed |= kat_check(vector->name, mac, vector->mac, AES_BLOCK_SIZE);
+    }
+    stream_cmac(vector->length, pieces, count, mac);
+    return failed | kat_check(vector->name, mac, vector->mac, AES_BLOCK_SIZE);
+}
+
+// Fused CBC encryption and CMAC, in one call and chained across calls split at each block boundary
+static int check_encrypt_cmac(void)
+{
+    int failed = 0;
+    for (size_t split = 0; split <= CBC_LEN; split += AES_BLOCK_SIZE) {
+        uint8_t chunk[CBC_LEN], mac[AES_BLOCK_SIZE];
+        memcpy(chunk, plaintext, CBC_LEN);
+
+        aes128_t ctx;
+        aes128_init(&ctx, iv, key);
+        aes128_cmac_t cmac;
+        aes128_cmac_init(&cmac, &mac_ctx);
+        aes128_encrypt_cmac(&ctx, &cmac, chunk, split);
+        aes128_encrypt_cmac(&ctx, &cmac, &chunk[split], CBC_LEN - split);
+        aes128_cmac_finish(&cmac, mac);
+
+        failed |= kat_check("CBC SP 800-38A F.2.1", chunk, cbc_ciphertext_hex, CBC_LEN);
+        failed |= kat_check("CMAC over CBC SP 800-38A F.2.1", mac, cbc_mac_hex, AES_BLOCK_SIZE);
+    }
+    return failed;
+}
+
+static int check_decrypt_cmac(void)
+{
+    int failed = 0;
+    for (size_t split = 0; split <= CBC_LEN; split += AES_BLOCK_SIZE) {
+        uint8_t chunk[CBC_LEN], mac[AES_BLOCK_SIZE];
+        memcpy(chunk, ciphertext, CBC_LEN);
+
+        aes128_t ctx;
+        aes128_init(&ctx, iv, key);
+        aes128_cmac_t cmac;
+        aes128_cmac_init(&cmac, &mac_ctx);
+        aes128_decrypt_cmac(&ctx, &cmac, chunk, split);
+        aes128_decrypt_cmac(&ctx, &cmac, &chunk[split], CBC_LEN - split);
+        aes128_cmac_finish(&cmac, mac);
+
+        failed |= kat_check("CBC SP 800-38A F.2.2", chunk, plaintext_hex, CBC_LEN);
+        failed |= kat_check("CMAC over CBC SP 800-38A F.2.2", mac, cbc_mac_hex, AES_BLOCK_SIZE);
+    }
+    return failed;
+}
+
+// A header already in the CMAC, block-aligned so the cipher fuses and unaligned so it cannot
+static int check_cmac_prefix(void)
+{
+    static const size_t prefixes[] = { 5, AES_BLOCK_SIZE, AES_BLOCK_SIZE + 9 };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(*prefixes); i++) {
+        uint8_t message[2 * AES_BLOCK_SIZE + CBC_LEN], expected[AES_BLOCK_SIZE];
+        memset(message, 0xa5, prefixes[i]);
+        memcpy(&message[prefixes[i]], ciphertext, CBC_LEN);
+        aes128_cmac(&mac_ctx, message, prefixes[i] + CBC_LEN, expected);
+
+        for (int decrypt = 0; decrypt < 2; decrypt++) {
+            uint8_t chunk[CBC_LEN], mac[AES_BLOCK_SIZE];
+            memcpy(chunk, decrypt ? ciphertext : plaintext, CBC_LEN);
+
+            aes128_t ctx;
+            aes128_init(&ctx, iv, key);
+            aes128_cmac_t cmac;
+            aes128_cmac_init(&cmac, &mac_ctx);
+            aes128_cmac_append(&cmac, message, prefixes[i]);
+            if (decrypt) {
+                aes128_decrypt_cmac(&ctx, &cmac, chunk, CBC_LEN);
+            }
+            else {
+                aes128_encrypt_cmac(&ctx, &cmac, chunk, CBC_LEN);
+            }
+            aes128_cmac_finish(&cmac, mac);
+
+            if (memcmp(chunk, decrypt ? plaintext : ciphertext, CBC_LEN) || memcmp(mac, expected, AES_BLOCK_SIZE)) {
+                fprintf(stderr, "CBC-CMAC %s after a %zu-byte header does not match aes128_cmac()\n",
+                        decrypt ? "decryption" : "encryption", prefixes[i]);
+                failed = 1;
+            }
+        }
+    }
+    return failed;
+}
+
+int main(void)
+{
+    (void)kat_unhex(key, key_hex);
+    (void)kat_unhex(iv, cbc_iv_hex);
+    (void)kat_unhex(plaintext, plaintext_hex);
+    (void)kat_unhex(ciphertext, cbc_ciphertext_hex);
+    aes128_init_cmac(&mac_ctx, key);
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(*vectors); i++) {
+        failed |= check_cmac(&vectors[i]);
+    }
+    failed |= check_encrypt_cmac();
+    failed |= check_decrypt_cmac();
+    failed |= check_cmac_prefix();
+    return failed;
+}
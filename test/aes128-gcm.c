@@ -0,0 +1,193 @@
+/**
+ * @file aes128-gcm.c
+ * @brief Check AES-128-GCM against the known answers from the GCM specification, test cases 1-4, through each
+ * way the wire code drives it: fused encryption and decryption, ciphertext authenticated with aes128_gcm_append()
+ * ahead of aes128_gcm_ctr(), and keystream split with aes128_gcm_skip()
+ * @ref McGrew and Viega, The Galois/Counter Mode of Operation (GCM), Appendix B
+ *
+ * @copyright Copyright (c) 2021 - 2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "aes128.h"
+#include "kat.h"
+
+typedef struct gcm_vector_t {
+    const char *name;
+    const char *key;
+    const char *iv; // 96 bits
+    const char *aad;
+    const char *plaintext;
+    const char *ciphertext;
+    const char *tag;
+} gcm_vector_t;
+
+static const gcm_vector_t vectors[] = {
+    {
+        .name = "GCM test case 1",
+        .key = "00000000000000000000000000000000",
+        .iv = "000000000000000000000000",
+        .aad = "",
+        .plaintext = "",
+        .ciphertext = "",
+        .tag = "58e2fccefa7e3061367f1d57a4e7455a",
+    },
+    {
+        .name = "GCM test case 2",
+        .key = "00000000000000000000000000000000",
+        .iv = "000000000000000000000000",
+        .aad = "",
+        .plaintext = "00000000000000000000000000000000",
+        .ciphertext = "0388dace60b6a392f328c2b971b2fe78",
+        .tag = "ab6e47d42cec13bdf53a67b21257bddf",
+    },
+    {
+        .name = "GCM test case 3",
+        .key = "feffe9928665731c6d6a8f9467308308",
+        .iv = "cafebabefacedbaddecaf888",
+        .aad = "",
+        .plaintext = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+                     "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+        .ciphertext = "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+                      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+        .tag = "4d5c2af327cd64a62cf35abd2ba6fab4",
+    },
+    {
+        .name = "GCM test case 4",
+        .key = "feffe9928665731c6d6a8f9467308308",
+        .iv = "cafebabefacedbaddecaf888",
+        .aad = "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+        .plaintext = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+                     "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+        .ciphertext = "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+                      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+        .tag = "5bc94fbc3221a5db94fae95ae7121a47",
+    },
+};
+
+typedef struct gcm_case_t {
+    aes128_t ctx;
+    uint8_t j0[AES_BLOCK_SIZE];
+    uint8_t aad[KAT_LEN_MAX];
+    size_t aad_length;
+    uint8_t plaintext[KAT_LEN_MAX];
+    uint8_t ciphertext[KAT_LEN_MAX];
+    size_t length;
+} gcm_case_t;
+
+static void gcm_case_init(gcm_case_t *test, const gcm_vector_t *vector)
+{
+    uint8_t key[AES_KEY_LEN];
+    (void)kat_unhex(key, vector->key);
+    aes128_init_cmac(&test->ctx, key);
+
+    // J0 = IV || 0^31 || 1 for a 96-bit IV
+    memset(test->j0, 0, AES_BLOCK_SIZE);
+    (void)kat_unhex(test->j0, vector->iv);
+    test->j0[AES_BLOCK_SIZE - 1] = 1;
+
+    test->aad_length = kat_unhex(test->aad, vector->aad);
+    test->length = kat_unhex(test->plaintext, vector->plaintext);
+    (void)kat_unhex(test->ciphertext, vector->ciphertext);
+}
+
+static void gcm_start(aes128_gcm_t *gcm, const gcm_case_t *test)
+{
+    aes128_gcm_init(gcm, &test->ctx, test->j0);
+    aes128_gcm_aad(gcm, test->aad, test->aad_length);
+}
+
+// Fused single-pass encryption, in one call and in whole blocks followed by the tail
+static int check_encrypt(const gcm_vector_t *vector, const gcm_case_t *test)
+{
+    int failed = 0;
+    for (size_t split = 0; split <= test->length; split += 2 * AES_BLOCK_SIZE) {
+        uint8_t chunk[KAT_LEN_MAX], tag[AES_BLOCK_SIZE];
+        memcpy(chunk, test->plaintext, test->length);
+
+        aes128_gcm_t gcm;
+        gcm_start(&gcm, test);
+        aes128_gcm_encrypt(&gcm, chunk, split);
+        aes128_gcm_encrypt(&gcm, &chunk[split], test->length - split);
+        aes128_gcm_finish(&gcm, tag);
+
+        failed |= kat_check(vector->name, chunk, vector->ciphertext, test->length);
+        failed |= kat_check(vector->name, tag, vector->tag, AES_BLOCK_SIZE);
+    }
+    return failed;
+}
+
+static int check_decrypt(const gcm_vector_t *vector, const gcm_case_t *test)
+{
+    uint8_t chunk[KAT_LEN_MAX], tag[AES_BLOCK_SIZE];
+    memcpy(chunk, test->ciphertext, test->length);
+
+    aes128_gcm_t gcm;
+    gcm_start(&gcm, test);
+    aes128_gcm_decrypt(&gcm, chunk, test->length);
+    aes128_gcm_finish(&gcm, tag);
+
+    return kat_check(vector->name, chunk, vector->plaintext, test->length) |
+           kat_check(vector->name, tag, vector->tag, AES_BLOCK_SIZE);
+}
+
+// Ciphertext authenticated as it trickles in, in pieces that straddle blocks, then decrypted block-wise
+static int check_append(const gcm_vector_t *vector, const gcm_case_t *test)
+{
+    static const size_t pieces[] = { 1, 7, AES_BLOCK_SIZE, 3, 2 * AES_BLOCK_SIZE };
+    uint8_t chunk[KAT_LEN_MAX], tag[AES_BLOCK_SIZE];
+    memcpy(chunk, test->ciphertext, test->length);
+
+    aes128_gcm_t gcm;
+    gcm_start(&gcm, test);
+    size_t offset = 0;
+    for (size_t i = 0; offset < test->length; i = (i + 1) % (sizeof(pieces) / sizeof(*pieces))) {
+        const size_t length = pieces[i] < test->length - offset ? pieces[i] : test->length - offset;
+        aes128_gcm_append(&gcm, &chunk[offset], length);
+        offset += length;
+    }
+    for (offset = 0; test->length - offset > AES_BLOCK_SIZE; offset += AES_BLOCK_SIZE) {
+        aes128_gcm_ctr(&gcm, &chunk[offset], AES_BLOCK_SIZE);
+    }
+    aes128_gcm_ctr(&gcm, &chunk[offset], test->length - offset);
+    aes128_gcm_finish(&gcm, tag);
+
+    return kat_check(vector->name, chunk, vector->plaintext, test->length) |
+           kat_check(vector->name, tag, vector->tag, AES_BLOCK_SIZE);
+}
+
+// The keystream past a skipped prefix, as a worker thread decrypting the back half of a wire sees it
+static int check_skip(const gcm_vector_t *vector, const gcm_case_t *test)
+{
+    int failed = 0;
+    for (size_t skipped = AES_BLOCK_SIZE; skipped < test->length; skipped += AES_BLOCK_SIZE) {
+        uint8_t chunk[KAT_LEN_MAX];
+        memcpy(chunk, test->ciphertext, test->length);
+
+        aes128_gcm_t gcm;
+        gcm_start(&gcm, test);
+        aes128_gcm_skip(&gcm, skipped);
+        aes128_gcm_ctr(&gcm, &chunk[skipped], test->length - skipped);
+        if (memcmp(&chunk[skipped], &test->plaintext[skipped], test->length - skipped)) {
+            fprintf(stderr, "%s does not match its known answer past %zu skipped bytes\n", vector->name, skipped);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+int main(void)
+{
+    printf("GCM kernels: %s\n", aes128_gcm_accelerated() ? "AES-NI and PCLMULQDQ" : "portable");
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(*vectors); i++) {
+        gcm_case_t test;
+        gcm_case_init(&test, &vectors[i]);
+        failed |= check_encrypt(&vectors[i], &test);
+        failed |= check_decrypt(&vectors[i], &test);
+        failed |= check_append(&vectors[i], &test);
+        failed |= check_skip(&vectors[i], &test);
+    }
+    return failed;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file aes128-lanes.c
+ * @brief Check aes128_encrypt_cmac_lanes() against the single-stream path, with fused and unfused streams mixed
+ *
+ * @copyright Copyright (c) 2021 - 2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include "aes128.h"
+
+enum LanesTest {
+    STREAMS = 2 * AES_LANES + 4,
+    STREAM_LEN = 5 * AES_BLOCK_SIZE,
+};
+
+// Streams are laid out so one fused stream is still queued when the last one, which cannot be fused, comes up
+static bool stream_unaligned(size_t i)
+{
+    return i == 2 || i == STREAMS - 1;
+}
+
+static size_t stream_length(size_t i)
+{
+    return i == AES_LANES ? 0 : STREAM_LEN;
+}
+
+static void stream_init(size_t i, aes128_t *ctx, aes128_t *mac_ctx, aes128_cmac_t *cmac, uint8_t *chunk)
+{
+    uint8_t key[AES_KEY_LEN], mac_key[AES_KEY_LEN], iv[AES_BLOCK_SIZE];
+    for (size_t j = 0; j < AES_KEY_LEN; j++) {
+        key[j] = (uint8_t)(i * 31 + j);
+        mac_key[j] = (uint8_t)(i * 17 + j * 3);
+    }
+    for (size_t j = 0; j < AES_BLOCK_SIZE; j++) {
+        iv[j] = (uint8_t)(i + j * 7);
+    }
+    for (size_t j = 0; j < STREAM_LEN; j++) {
+        chunk[j] = (uint8_t)(i * 13 + j);
+    }
+    aes128_init(ctx, iv, key);
+    aes128_init_cmac(mac_ctx, mac_key);
+    aes128_cmac_init(cmac, mac_ctx);
+
+    // A partial block already in the CMAC keeps the stream off the fused path
+    if (stream_unaligned(i)) {
+        aes128_cmac_append(cmac, iv, 3);
+    }
+}
+
+int main(void)
+{
+    static aes128_t ctxs[STREAMS], mac_ctxs[STREAMS], expected_ctxs[STREAMS], expected_mac_ctxs[STREAMS];
+    static aes128_cmac_t cmacs[STREAMS], expected_cmacs[STREAMS];
+    static uint8_t chunks[STREAMS][STREAM_LEN], expected[STREAMS][STREAM_LEN];
+
+    aes128_t *ctx_ptrs[STREAMS];
+    aes128_cmac_t *cmac_ptrs[STREAMS];
+    uint8_t *chunk_ptrs[STREAMS];
+    size_t lengths[STREAMS];
+    for (size_t i = 0; i < STREAMS; i++) {
+        stream_init(i, &ctxs[i], &mac_ctxs[i], &cmacs[i], chunks[i]);
+        stream_init(i, &expected_ctxs[i], &expected_mac_ctxs[i], &expected_cmacs[i], expected[i]);
+        aes128_encrypt_cmac(&expected_ctxs[i], &expected_cmacs[i], expected[i], stream_length(i));
+
+        ctx_ptrs[i] = &ctxs[i];
+        cmac_ptrs[i] = &cmacs[i];
+        chunk_ptrs[i] = chunks[i];
+        lengths[i] = stream_length(i);
+    }
+    aes128_encrypt_cmac_lanes(ctx_ptrs, cmac_ptrs, chunk_ptrs, lengths, STREAMS);
+
+    int failed = 0;
+    for (size_t i = 0; i < STREAMS; i++) {
+        uint8_t mac[AES_BLOCK_SIZE], expected_mac[AES_BLOCK_SIZE];
+        aes128_cmac_finish(&cmacs[i], mac);
+        aes128_cmac_finish(&expected_cmacs[i], expected_mac);
+        if (memcmp(chunks[i], expected[i], STREAM_LEN) || memcmp(mac, expected_mac, AES_BLOCK_SIZE)) {
+            fprintf(stderr, "stream %zu does not match the single-stream path\n", i);
+            failed = 1;
+        }
+    }
+    return failed;
+}
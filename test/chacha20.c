@@ -0,0 +1,370 @@
+/**
+ * @file chacha20.c
+ * @brief Check ChaCha20, Poly1305, and ChaCha20-Poly1305 against the known answers from RFC 8439, then check every
+ * SIMD kernel the host supports, chacha20_skip(), and the refills behind xgetrandom(), against a plain implementation
+ * of the block function
+ * @ref https://datatracker.ietf.org/doc/html/rfc8439
+ *
+ * @copyright Copyright (c) 2021 - 2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "chacha20.h"
+#include "chacha20-backend.h"
+#include "kat.h"
+
+enum ChaCha20Test {
+    KERNEL_BLOCKS_MAX = 19, // Covers a full pass of the widest kernel twice over plus a remainder
+};
+
+static const char sunscreen[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, "
+                                "sunscreen would be it.";
+
+// RFC 8439 2.3.2, key 00:01:..:1f
+static const char block_nonce[] = "000000090000004a00000000";
+static const char block_keystream[] = "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+                                      "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e";
+
+// RFC 8439 2.4.2, the same key
+static const char encryption_nonce[] = "000000000000004a00000000";
+static const char encryption_ciphertext[] = "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+                                            "f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+                                            "07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+                                            "5af90bbf74a35be6b40b8eedf2785e42874d";
+
+// RFC 8439 A.1 #1 and #2, blocks 0 and 1 under the all-zero key and nonce
+static const char zero_keystream[] = "76b8e0ada0f13d90405d6ae55386bd28bdd219b8a08ded1aa836efcc8b770dc7"
+                                     "da41597c5157488d7724e03fb8d84a376a43b8f41518a11cc387b669b2ee6586"
+                                     "9f07e7be5551387a98ba977c732d080dcb0f29a048e3656912c6533e32ee7aed"
+                                     "29b721769ce64e43d57133b074d839d531ed1f28510afb45ace10a1f4b794d6f";
+
+typedef struct poly1305_vector_t {
+    const char *name;
+    const char *key;
+    const char *msg;
+    const char *tag;
+} poly1305_vector_t;
+
+// RFC 8439 2.5.2, then the edge cases of A.3 that push the accumulator past 2^130 - 5
+static const poly1305_vector_t poly1305_vectors[] = {
+    {
+        .name = "Poly1305 2.5.2",
+        .key = "85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b",
+        .msg = "43727970746f6772617068696320466f72756d2052657365617263682047726f7570",
+        .tag = "a8061dc1305136c6c22b8baf0c0127a9",
+    },
+    {
+        .name = "Poly1305 A.3 #5",
+        .key = "0200000000000000000000000000000000000000000000000000000000000000",
+        .msg = "ffffffffffffffffffffffffffffffff",
+        .tag = "03000000000000000000000000000000",
+    },
+    {
+        .name = "Poly1305 A.3 #6",
+        .key = "02000000000000000000000000000000ffffffffffffffffffffffffffffffff",
+        .msg = "02000000000000000000000000000000",
+        .tag = "03000000000000000000000000000000",
+    },
+    {
+        .name = "Poly1305 A.3 #7",
+        .key = "0100000000000000000000000000000000000000000000000000000000000000",
+        .msg = "ffffffffffffffffffffffffffffffff"
+               "f0ffffffffffffffffffffffffffffff"
+               "11000000000000000000000000000000",
+        .tag = "05000000000000000000000000000000",
+    },
+    {
+        .name = "Poly1305 A.3 #8",
+        .key = "0100000000000000000000000000000000000000000000000000000000000000",
+        .msg = "ffffffffffffffffffffffffffffffff"
+               "fbfefefefefefefefefefefefefefefe"
+               "01010101010101010101010101010101",
+        .tag = "00000000000000000000000000000000",
+    },
+    {
+        .name = "Poly1305 A.3 #9",
+        .key = "0200000000000000000000000000000000000000000000000000000000000000",
+        .msg = "fdffffffffffffffffffffffffffffff",
+        .tag = "faffffffffffffffffffffffffffffff",
+    },
+    {
+        .name = "Poly1305 A.3 #10",
+        .key = "0100000000000000040000000000000000000000000000000000000000000000",
+        .msg = "e33594d7505e43b90000000000000000"
+               "3394d7505e4379cd0100000000000000"
+               "00000000000000000000000000000000"
+               "01000000000000000000000000000000",
+        .tag = "14000000000000005500000000000000",
+    },
+    {
+        .name = "Poly1305 A.3 #11",
+        .key = "0100000000000000040000000000000000000000000000000000000000000000",
+        .msg = "e33594d7505e43b90000000000000000"
+               "3394d7505e4379cd0100000000000000"
+               "00000000000000000000000000000000",
+        .tag = "13000000000000000000000000000000",
+    },
+};
+
+// RFC 8439 2.8.2
+static const char aead_key[] = "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f";
+static const char aead_nonce[] = "070000004041424344454647";
+static const char aead_aad[] = "50515253c0c1c2c3c4c5c6c7";
+static const char aead_ciphertext[] = "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+                                      "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+                                      "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+                                      "3ff4def08e4b7a9de576d26586cec64b6116";
+static const char aead_tag[] = "1ae10b594f09e26a7e902ecbd0600691";
+
+static void counting_key(uint8_t *key)
+{
+    for (size_t i = 0; i < CHACHA20_KEY_LEN; i++) {
+        key[i] = (uint8_t)i;
+    }
+}
+
+static uint32_t rotl32(uint32_t x, unsigned int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static void quarter_round(uint32_t *x, size_t a, size_t b, size_t c, size_t d)
+{
+    x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 16);
+    x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 12);
+    x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 8);
+    x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 7);
+}
+
+// The block function straight from RFC 8439 2.3, one block of keystream for `counter`
+static void reference_block(const chacha20_t *ctx, uint32_t counter, uint8_t *keystream)
+{
+    uint32_t state[16], x[16];
+    memcpy(state, ctx->state, sizeof(state));
+    state[12] = counter;
+    memcpy(x, state, sizeof(x));
+    for (size_t i = 0; i < 10; i++) {
+        quarter_round(x, 0, 4, 8, 12);
+        quarter_round(x, 1, 5, 9, 13);
+        quarter_round(x, 2, 6, 10, 14);
+        quarter_round(x, 3, 7, 11, 15);
+        quarter_round(x, 0, 5, 10, 15);
+        quarter_round(x, 1, 6, 11, 12);
+        quarter_round(x, 2, 7, 8, 13);
+        quarter_round(x, 3, 4, 9, 14);
+    }
+    for (size_t i = 0; i < 16; i++) {
+        const uint32_t word = x[i] + state[i];
+        for (size_t j = 0; j < 4; j++) {
+            keystream[4 * i + j] = (uint8_t)(word >> (8 * j));
+        }
+    }
+}
+
+// `length` bytes of keystream from block `counter` on
+static void reference_keystream(const chacha20_t *ctx, uint32_t counter, uint8_t *keystream, size_t length)
+{
+    for (size_t offset = 0; offset < length; offset += CHACHA20_BLOCK_SIZE, counter++) {
+        uint8_t block[CHACHA20_BLOCK_SIZE];
+        reference_block(ctx, counter, block);
+        const size_t bytes = length - offset < CHACHA20_BLOCK_SIZE ? length - offset : CHACHA20_BLOCK_SIZE;
+        memcpy(&keystream[offset], block, bytes);
+    }
+}
+
+static int check_chacha20(void)
+{
+    uint8_t key[CHACHA20_KEY_LEN], nonce[CHACHA20_NONCE_LEN], chunk[KAT_LEN_MAX];
+    counting_key(key);
+
+    chacha20_t ctx;
+    (void)kat_unhex(nonce, block_nonce);
+    chacha20_init(&ctx, key, nonce, 1);
+    reference_block(&ctx, 1, chunk);
+    int failed = kat_check("ChaCha20 reference block 2.3.2", chunk, block_keystream, CHACHA20_BLOCK_SIZE);
+
+    memset(chunk, 0, CHACHA20_BLOCK_SIZE);
+    chacha20_xor(&ctx, chunk, CHACHA20_BLOCK_SIZE);
+    failed |= kat_check("ChaCha20 block 2.3.2", chunk, block_keystream, CHACHA20_BLOCK_SIZE);
+
+    // In pieces that leave keystream over for the next call
+    static const size_t pieces[] = { 1, 63, 7, 43 };
+    const size_t length = sizeof(sunscreen) - 1;
+    memcpy(chunk, sunscreen, length);
+    (void)kat_unhex(nonce, encryption_nonce);
+    chacha20_init(&ctx, key, nonce, 1);
+    for (size_t i = 0, offset = 0; offset < length; offset += pieces[i++]) {
+        chacha20_xor(&ctx, &chunk[offset], pieces[i] < length - offset ? pieces[i] : length - offset);
+    }
+    failed |= kat_check("ChaCha20 encryption 2.4.2", chunk, encryption_ciphertext, length);
+    return failed;
+}
+
+// Each kernel against the reference, for every block count up to a few passes of the widest
+static int check_kernel(const chacha20_backend_t *kernel)
+{
+    if (!kernel) {
+        return 0;
+    }
+    printf("ChaCha20 kernel: %s\n", kernel->name);
+
+    uint8_t key[CHACHA20_KEY_LEN], nonce[CHACHA20_NONCE_LEN];
+    counting_key(key);
+    (void)kat_unhex(nonce, block_nonce);
+    chacha20_t ctx;
+    chacha20_init(&ctx, key, nonce, 7);
+
+    int failed = 0;
+    for (size_t blocks = 1; blocks <= KERNEL_BLOCKS_MAX; blocks++) {
+        uint8_t chunk[KERNEL_BLOCKS_MAX * CHACHA20_BLOCK_SIZE], expected[KERNEL_BLOCKS_MAX * CHACHA20_BLOCK_SIZE];
+        for (size_t i = 0; i < sizeof(chunk); i++) {
+            chunk[i] = (uint8_t)(i * 29);
+        }
+        reference_keystream(&ctx, 7, expected, blocks * CHACHA20_BLOCK_SIZE);
+        for (size_t i = 0; i < blocks * CHACHA20_BLOCK_SIZE; i++) {
+            expected[i] ^= (uint8_t)(i * 29);
+        }
+
+        kernel->xor_blocks(ctx.state, chunk, blocks);
+        if (memcmp(chunk, expected, blocks * CHACHA20_BLOCK_SIZE)) {
+            fprintf(stderr, "ChaCha20 %s kernel does not match the reference over %zu blocks\n", kernel->name, blocks);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+// Skipping whole blocks, part of one, and the rest of a block left over, lands where the reference does
+static int check_skip(void)
+{
+    uint8_t key[CHACHA20_KEY_LEN], nonce[CHACHA20_NONCE_LEN];
+    counting_key(key);
+    (void)kat_unhex(nonce, encryption_nonce);
+
+    static const size_t skips[][2] = { { 0, 64 }, { 0, 100 }, { 10, 54 }, { 10, 60 }, { 30, 500 }, { 64, 0 } };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(skips) / sizeof(*skips); i++) {
+        const size_t used = skips[i][0], skipped = skips[i][1], length = 3 * CHACHA20_BLOCK_SIZE + 5;
+        chacha20_t ctx;
+        chacha20_init(&ctx, key, nonce, 1);
+
+        uint8_t chunk[KAT_LEN_MAX], expected[KAT_LEN_MAX + 1024];
+        memset(chunk, 0, sizeof(chunk));
+        chacha20_xor(&ctx, chunk, used);
+        chacha20_skip(&ctx, skipped);
+        memset(chunk, 0, length);
+        chacha20_xor(&ctx, chunk, length);
+
+        reference_keystream(&ctx, 1, expected, used + skipped + length);
+        if (memcmp(chunk, &expected[used + skipped], length)) {
+            fprintf(stderr, "ChaCha20 keystream is off after using %zu bytes and skipping %zu\n", used, skipped);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+// xgetrandom() refills its generator with 16 blocks from counter 0 under a zero nonce, in a single call
+static int check_generator(void)
+{
+    enum { REFILL_LEN = 16 * CHACHA20_BLOCK_SIZE };
+    const uint8_t key[CHACHA20_KEY_LEN] = { 0 }, nonce[CHACHA20_NONCE_LEN] = { 0 };
+    uint8_t buffer[REFILL_LEN] = { 0 }, expected[REFILL_LEN];
+
+    chacha20_t ctx;
+    chacha20_init(&ctx, key, nonce, 0);
+    chacha20_xor(&ctx, buffer, REFILL_LEN);
+    int failed = kat_check("ChaCha20 A.1 #1 and #2", buffer, zero_keystream, 2 * CHACHA20_BLOCK_SIZE);
+
+    reference_keystream(&ctx, 0, expected, REFILL_LEN);
+    if (memcmp(buffer, expected, REFILL_LEN)) {
+        fprintf(stderr, "ChaCha20 generator refill does not match the reference\n");
+        failed = 1;
+    }
+    return failed;
+}
+
+static int check_poly1305(void)
+{
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(poly1305_vectors) / sizeof(*poly1305_vectors); i++) {
+        const poly1305_vector_t *vector = &poly1305_vectors[i];
+        uint8_t key[POLY1305_KEY_LEN], msg[KAT_LEN_MAX], tag[POLY1305_TAG_LEN];
+        (void)kat_unhex(key, vector->key);
+        const size_t length = kat_unhex(msg, vector->msg);
+
+        poly1305(key, msg, length, tag);
+        failed |= kat_check(vector->name, tag, vector->tag, POLY1305_TAG_LEN);
+
+        // A byte at a time, so every block goes through the partial block
+        poly1305_t ctx;
+        poly1305_init(&ctx, key);
+        for (size_t j = 0; j < length; j++) {
+            poly1305_append(&ctx, &msg[j], 1);
+        }
+        poly1305_finish(&ctx, tag);
+        failed |= kat_check(vector->name, tag, vector->tag, POLY1305_TAG_LEN);
+    }
+    return failed;
+}
+
+static void aead_start(chacha20_poly1305_t *ctx)
+{
+    uint8_t key[CHACHA20_KEY_LEN], nonce[CHACHA20_NONCE_LEN], aad[KAT_LEN_MAX];
+    (void)kat_unhex(key, aead_key);
+    (void)kat_unhex(nonce, aead_nonce);
+    chacha20_poly1305_init(ctx, key, nonce);
+    chacha20_poly1305_aad(ctx, aad, kat_unhex(aad, aead_aad));
+}
+
+static int check_aead(void)
+{
+    const size_t length = sizeof(sunscreen) - 1;
+    uint8_t chunk[KAT_LEN_MAX], tag[POLY1305_TAG_LEN];
+    chacha20_poly1305_t ctx;
+
+    memcpy(chunk, sunscreen, length);
+    aead_start(&ctx);
+    chacha20_poly1305_encrypt(&ctx, chunk, length);
+    chacha20_poly1305_finish(&ctx, tag);
+    int failed = kat_check("ChaCha20-Poly1305 2.8.2", chunk, aead_ciphertext, length);
+    failed |= kat_check("ChaCha20-Poly1305 2.8.2", tag, aead_tag, POLY1305_TAG_LEN);
+
+    aead_start(&ctx);
+    chacha20_poly1305_decrypt(&ctx, chunk, length);
+    chacha20_poly1305_finish(&ctx, tag);
+    if (memcmp(chunk, sunscreen, length)) {
+        fprintf(stderr, "ChaCha20-Poly1305 2.8.2 does not decrypt\n");
+        failed = 1;
+    }
+    failed |= kat_check("ChaCha20-Poly1305 2.8.2 decryption", tag, aead_tag, POLY1305_TAG_LEN);
+
+    // Ciphertext authenticated as it arrives, then decrypted in pieces
+    (void)kat_unhex(chunk, aead_ciphertext);
+    aead_start(&ctx);
+    for (size_t offset = 0; offset < length; offset += 13) {
+        chacha20_poly1305_append(&ctx, &chunk[offset], length - offset < 13 ? length - offset : 13);
+    }
+    for (size_t offset = 0; offset < length; offset += 50) {
+        chacha20_poly1305_xor(&ctx, &chunk[offset], length - offset < 50 ? length - offset : 50);
+    }
+    chacha20_poly1305_finish(&ctx, tag);
+    if (memcmp(chunk, sunscreen, length)) {
+        fprintf(stderr, "ChaCha20-Poly1305 2.8.2 does not decrypt after chacha20_poly1305_append()\n");
+        failed = 1;
+    }
+    failed |= kat_check("ChaCha20-Poly1305 2.8.2 appended", tag, aead_tag, POLY1305_TAG_LEN);
+    return failed;
+}
+
+int main(void)
+{
+    int failed = check_chacha20();
+    failed |= check_kernel(chacha20_sse2_backend());
+    failed |= check_kernel(chacha20_avx2_backend());
+    failed |= check_skip();
+    failed |= check_generator();
+    failed |= check_poly1305();
+    failed |= check_aead();
+    return failed;
+}
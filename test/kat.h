@@ -0,0 +1,42 @@
+/**
+ * @file kat.h
+ * @brief Helpers shared by the known-answer tests, which keep their vectors as hex strings
+ *
+ * @copyright Copyright (c) 2021 - 2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+enum KnownAnswer {
+    KAT_LEN_MAX = 512, // Longest vector, in bytes
+};
+
+// Decode `hex` into `dst`, returning the number of bytes
+static inline size_t kat_unhex(uint8_t *dst, const char *hex)
+{
+    size_t length = 0;
+    for (; hex[0] && hex[1] && length < KAT_LEN_MAX; hex += 2) {
+        unsigned int byte;
+        if (sscanf(hex, "%2x", &byte) != 1) {
+            break;
+        }
+        dst[length++] = (uint8_t)byte;
+    }
+    return length;
+}
+
+// Compare `length` bytes of `got` against `hex`, reporting a mismatch under `name`. Returns 1 on mismatch
+static inline int kat_check(const char *name, const uint8_t *got, const char *hex, size_t length)
+{
+    uint8_t expected[KAT_LEN_MAX];
+    if (kat_unhex(expected, hex) != length || memcmp(got, expected, length)) {
+        fprintf(stderr, "%s does not match its known answer\n", name);
+        return 1;
+    }
+    return 0;
+}
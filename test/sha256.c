@@ -0,0 +1,299 @@
+/**
+ * @file sha256.c
+ * @brief Check SHA-256 against the known answers from FIPS 180-4 and the NIST example values, through the streaming
+ * API in one call and in pieces that straddle blocks, then through every single-stream and multi-lane kernel the
+ * host supports, and check sha256_chunks() against one message at a time for every count up to a few past the widest
+ * @ref https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.180-4.pdf
+ *
+ * @copyright Copyright (c) 2021 - 2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "sha256-backend.h"
+#include "kat.h"
+
+enum Messages {
+    MESSAGE_LEN_MAX = 1000000,
+};
+
+typedef struct sha256_vector_t {
+    const char *name;
+    const char *message;
+    size_t repeat; // Copies of `message` hashed back to back
+    const char *digest;
+} sha256_vector_t;
+
+static const sha256_vector_t vectors[] = {
+    {
+        .name = "SHA-256 \"abc\"",
+        .message = "abc",
+        .repeat = 1,
+        .digest = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    },
+    {
+        .name = "SHA-256 empty message",
+        .message = "",
+        .repeat = 1,
+        .digest = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+    },
+    {
+        .name = "SHA-256 448-bit message",
+        .message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+        .repeat = 1,
+        .digest = "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    },
+    {
+        .name = "SHA-256 896-bit message",
+        .message = "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno"
+                   "ijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+        .repeat = 1,
+        .digest = "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1",
+    },
+    {
+        .name = "SHA-256 one million \"a\"",
+        .message = "a",
+        .repeat = 1000000,
+        .digest = "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+    },
+};
+
+static uint8_t message[MESSAGE_LEN_MAX];
+
+// Expand `vector` into `message`, returning its length
+static size_t expand_message(const sha256_vector_t *vector)
+{
+    const size_t length = strlen(vector->message);
+    for (size_t i = 0; i < vector->repeat; i++) {
+        memcpy(&message[i * length], vector->message, length);
+    }
+    return length * vector->repeat;
+}
+
+// Output the state in big-endian order
+static void store_digest(const uint32_t *state, uint8_t *digest)
+{
+    for (size_t j = 0; j < 8; j++) {
+        for (size_t i = 0; i < 4; i++) {
+            digest[(4 * j) + i] = (uint8_t)(state[j] >> (24 - (8 * i)));
+        }
+    }
+}
+
+// Pad the last `length % 64` bytes of a message of `length` bytes (5.1.1), returning the number of blocks
+static size_t pad_tail(uint8_t *padding, const uint8_t *data, size_t length)
+{
+    const size_t tail = length % SHA256_BLOCK_SIZE;
+    const size_t blocks = tail < 56 ? 1 : 2;
+    const uint64_t bits = 8 * (uint64_t)length;
+
+    memset(padding, 0, 2 * SHA256_BLOCK_SIZE);
+    memcpy(padding, &data[length - tail], tail);
+    padding[tail] = 128;
+    for (size_t i = 0; i < 8; i++) {
+        padding[SHA256_BLOCK_SIZE * blocks - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    return blocks;
+}
+
+static void initial_state(uint32_t *state)
+{
+    sha256_t ctx;
+    sha256_init(&ctx);
+    memcpy(state, ctx.state, sizeof(ctx.state));
+}
+
+// One call, then pieces that straddle blocks and a final partial block
+static int check_stream(const sha256_vector_t *vector, size_t length)
+{
+    static const size_t pieces[] = { 1, 63, 2, SHA256_BLOCK_SIZE, 7, 3 * SHA256_BLOCK_SIZE + 5 };
+    uint8_t digest[SHA256_DIGEST_LEN];
+
+    sha256_t ctx;
+    sha256_init(&ctx);
+    sha256_append(&ctx, message, length);
+    sha256_finish(&ctx, digest);
+    int failed = kat_check(vector->name, digest, vector->digest, SHA256_DIGEST_LEN);
+
+    sha256_init(&ctx);
+    size_t offset = 0;
+    for (size_t i = 0; offset < length; i = (i + 1) % (sizeof(pieces) / sizeof(*pieces))) {
+        const size_t piece = pieces[i] < length - offset ? pieces[i] : length - offset;
+        sha256_append(&ctx, &message[offset], piece);
+        offset += piece;
+    }
+    sha256_finish(&ctx, digest);
+    return failed | kat_check(vector->name, digest, vector->digest, SHA256_DIGEST_LEN);
+}
+
+// Drive a single-stream kernel directly, all whole blocks in one call
+static int check_backend(const sha256_backend_t *backend, const sha256_vector_t *vector, size_t length)
+{
+    if (!backend) {
+        return 0;
+    }
+
+    uint32_t state[8];
+    initial_state(state);
+    backend->compress(state, message, length / SHA256_BLOCK_SIZE);
+
+    uint8_t padding[2 * SHA256_BLOCK_SIZE], digest[SHA256_DIGEST_LEN];
+    backend->compress(state, padding, pad_tail(padding, message, length));
+    store_digest(state, digest);
+    return kat_check(vector->name, digest, vector->digest, SHA256_DIGEST_LEN);
+}
+
+// Run a multi-lane kernel over `data`, one message of `length` bytes per lane
+static void lanes_digests(const sha256_lanes_backend_t *backend, const uint8_t *const *data, size_t length,
+                          uint8_t (*digests)[SHA256_DIGEST_LEN])
+{
+    uint32_t states[SHA256_LANES_MAX][8];
+    uint32_t *state_ptrs[SHA256_LANES_MAX] = { 0 };
+    uint8_t padding[SHA256_LANES_MAX][2 * SHA256_BLOCK_SIZE];
+    const uint8_t *padding_ptrs[SHA256_LANES_MAX] = { 0 };
+    size_t blocks = 0;
+    for (size_t j = 0; j < backend->lanes; j++) {
+        initial_state(states[j]);
+        state_ptrs[j] = states[j];
+        blocks = pad_tail(padding[j], data[j], length);
+        padding_ptrs[j] = padding[j];
+    }
+
+    backend->compress_lanes(state_ptrs, data, length / SHA256_BLOCK_SIZE);
+    backend->compress_lanes(state_ptrs, padding_ptrs, blocks);
+    for (size_t j = 0; j < backend->lanes; j++) {
+        store_digest(states[j], digests[j]);
+    }
+}
+
+// Every lane of a multi-lane kernel hashing the same known-answer message
+static int check_lanes(const sha256_lanes_backend_t *backend, const sha256_vector_t *vector, size_t length)
+{
+    if (!backend) {
+        return 0;
+    }
+
+    const uint8_t *data[SHA256_LANES_MAX];
+    for (size_t j = 0; j < backend->lanes; j++) {
+        data[j] = message;
+    }
+
+    uint8_t digests[SHA256_LANES_MAX][SHA256_DIGEST_LEN];
+    lanes_digests(backend, data, length, digests);
+
+    int failed = 0;
+    for (size_t j = 0; j < backend->lanes; j++) {
+        failed |= kat_check(vector->name, digests[j], vector->digest, SHA256_DIGEST_LEN);
+    }
+    return failed;
+}
+
+// Distinct messages of `length` bytes each, `count` of them laid out back to back in `message`
+static void fill_messages(size_t length, size_t count)
+{
+    for (size_t i = 0; i < length * count; i++) {
+        message[i] = (uint8_t)((i * 131) + (i / 251));
+    }
+}
+
+static void reference_digest(const uint8_t *data, size_t length, uint8_t *digest)
+{
+    sha256_t ctx;
+    sha256_init(&ctx);
+    sha256_append(&ctx, data, length);
+    sha256_finish(&ctx, digest);
+}
+
+// Lanes fed different messages must not bleed into each other
+static int check_lanes_distinct(const sha256_lanes_backend_t *backend, size_t length)
+{
+    if (!backend) {
+        return 0;
+    }
+
+    fill_messages(length, backend->lanes);
+    const uint8_t *data[SHA256_LANES_MAX];
+    for (size_t j = 0; j < backend->lanes; j++) {
+        data[j] = &message[j * length];
+    }
+
+    uint8_t digests[SHA256_LANES_MAX][SHA256_DIGEST_LEN], expected[SHA256_DIGEST_LEN];
+    lanes_digests(backend, data, length, digests);
+
+    for (size_t j = 0; j < backend->lanes; j++) {
+        reference_digest(data[j], length, expected);
+        if (memcmp(digests[j], expected, SHA256_DIGEST_LEN)) {
+            fprintf(stderr, "SHA-256 %s lane %zu of %zu-byte messages does not match sha256_append()\n",
+                    backend->name, j, length);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whole batches of lanes plus every possible number of leftovers
+static int check_chunks(size_t length)
+{
+    enum { COUNT_MAX = SHA256_LANES_MAX + 3 };
+    fill_messages(length, COUNT_MAX);
+
+    const void *chunks[COUNT_MAX];
+    uint8_t digest_bufs[COUNT_MAX][SHA256_DIGEST_LEN];
+    uint8_t *digests[COUNT_MAX];
+    for (size_t i = 0; i < COUNT_MAX; i++) {
+        chunks[i] = &message[i * length];
+        digests[i] = digest_bufs[i];
+    }
+
+    for (size_t count = 1; count <= COUNT_MAX; count++) {
+        memset(digest_bufs, 0, sizeof(digest_bufs));
+        sha256_chunks(chunks, length, digests, count);
+        for (size_t i = 0; i < count; i++) {
+            uint8_t expected[SHA256_DIGEST_LEN];
+            reference_digest(chunks[i], length, expected);
+            if (memcmp(digests[i], expected, SHA256_DIGEST_LEN)) {
+                fprintf(stderr, "sha256_chunks() message %zu of %zu, %zu bytes each, does not match sha256_append()\n",
+                        i, count, length);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    const sha256_backend_t *backends[] = { sha256_ni_backend(), sha256_armv8_backend() };
+    for (size_t i = 0; i < sizeof(backends) / sizeof(*backends); i++) {
+        if (backends[i]) {
+            printf("SHA-256 kernel: %s\n", backends[i]->name);
+        }
+    }
+    const sha256_lanes_backend_t *lanes[] = { sha256_ni_lanes_backend(), sha256_avx2_lanes_backend() };
+    for (size_t i = 0; i < sizeof(lanes) / sizeof(*lanes); i++) {
+        if (lanes[i]) {
+            printf("SHA-256 lanes kernel: %s, %zu lanes\n", lanes[i]->name, lanes[i]->lanes);
+        }
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(*vectors); i++) {
+        const size_t length = expand_message(&vectors[i]);
+        failed |= check_stream(&vectors[i], length);
+        for (size_t j = 0; j < sizeof(backends) / sizeof(*backends); j++) {
+            failed |= check_backend(backends[j], &vectors[i], length);
+        }
+        for (size_t j = 0; j < sizeof(lanes) / sizeof(*lanes); j++) {
+            failed |= check_lanes(lanes[j], &vectors[i], length);
+        }
+    }
+
+    // Tails either side of the 56-byte padding boundary, whole blocks, and several blocks plus a tail
+    static const size_t lengths[] = { 0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 1000 };
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(*lengths); i++) {
+        for (size_t j = 0; j < sizeof(lanes) / sizeof(*lanes); j++) {
+            failed |= check_lanes_distinct(lanes[j], lengths[i]);
+        }
+        failed |= check_chunks(lengths[i]);
+    }
+    return failed;
+}
@@ -0,0 +1,225 @@
+/**
+ * @file x25519.c
+ * @brief Check X25519 against the known answers from RFC 7748, then check x25519_base(), x25519_batch(), and every
+ * multi-lane ladder the host supports against x25519(). Built once per field representation. x25519() takes the
+ * scalar as given, so the RFC scalars are clamped here first, as decodeScalar25519() does
+ * @ref https://datatracker.ietf.org/doc/html/rfc7748
+ *
+ * @copyright Copyright (c) 2022 - 2024 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "x25519-backend.h"
+#include "kat.h"
+
+enum X25519Test {
+    X25519_LEN = 32,
+    BATCH_MAX = X25519_LANES_MAX + 3,
+};
+
+typedef struct x25519_vector_t {
+    const char *name;
+    const char *secret;
+    const char *basepoint;
+    const char *public;
+} x25519_vector_t;
+
+static const x25519_vector_t vectors[] = {
+    {
+        .name = "X25519 RFC 7748 5.2 #1",
+        .secret = "a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+        .basepoint = "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c",
+        .public = "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552",
+    },
+    {
+        .name = "X25519 RFC 7748 5.2 #2",
+        .secret = "4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+        .basepoint = "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493",
+        .public = "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957",
+    },
+    {
+        .name = "X25519 RFC 7748 6.1 Alice's public key",
+        .secret = "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+        .basepoint = "0900000000000000000000000000000000000000000000000000000000000000",
+        .public = "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a",
+    },
+    {
+        .name = "X25519 RFC 7748 6.1 shared secret",
+        .secret = "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+        .basepoint = "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f",
+        .public = "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742",
+    },
+};
+
+// RFC 7748 5.2, k and u both start at 9 and each output becomes the next k, the previous k the next u
+static const char iterated_once[] = "422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079";
+static const char iterated_1000[] = "684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51";
+
+static const uint8_t basepoint_nine[X25519_LEN] = { 9 };
+
+typedef struct x25519_case_t {
+    uint8_t secret[X25519_LEN];
+    uint8_t basepoint[X25519_LEN];
+} x25519_case_t;
+
+// decodeScalar25519() (RFC 7748 section 5)
+static void clamp(uint8_t *scalar)
+{
+    scalar[0] &= 248;
+    scalar[X25519_LEN - 1] &= 127;
+    scalar[X25519_LEN - 1] |= 64;
+}
+
+static void vector_case(x25519_case_t *test, const x25519_vector_t *vector)
+{
+    (void)kat_unhex(test->secret, vector->secret);
+    (void)kat_unhex(test->basepoint, vector->basepoint);
+    clamp(test->secret);
+}
+
+static int check_vectors(void)
+{
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(*vectors); i++) {
+        x25519_case_t test;
+        vector_case(&test, &vectors[i]);
+
+        uint8_t public[X25519_LEN];
+        x25519(public, test.secret, test.basepoint);
+        failed |= kat_check(vectors[i].name, public, vectors[i].public, X25519_LEN);
+        if (!memcmp(test.basepoint, basepoint_nine, X25519_LEN)) {
+            x25519_base(public, test.secret);
+            failed |= kat_check(vectors[i].name, public, vectors[i].public, X25519_LEN);
+        }
+    }
+    return failed;
+}
+
+static int check_iterated(void)
+{
+    uint8_t k[X25519_LEN] = { 9 }, u[X25519_LEN] = { 9 }, output[X25519_LEN];
+    int failed = 0;
+    for (size_t i = 1; i <= 1000; i++) {
+        uint8_t scalar[X25519_LEN];
+        memcpy(scalar, k, X25519_LEN);
+        clamp(scalar);
+        x25519(output, scalar, u);
+        memcpy(u, k, X25519_LEN);
+        memcpy(k, output, X25519_LEN);
+        if (i == 1) {
+            failed |= kat_check("X25519 RFC 7748 5.2 after one iteration", k, iterated_once, X25519_LEN);
+        }
+    }
+    return failed | kat_check("X25519 RFC 7748 5.2 after 1,000 iterations", k, iterated_1000, X25519_LEN);
+}
+
+// Distinct unclamped secrets and points, some with the unused top bit of the point set
+static void fill_cases(x25519_case_t *cases, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < X25519_LEN; j++) {
+            cases[i].secret[j] = (uint8_t)((i * 73) + (j * 29) + 1);
+            cases[i].basepoint[j] = (uint8_t)((i * 151) + (j * 37) + 5);
+        }
+        cases[i].basepoint[X25519_LEN - 1] |= (uint8_t)(i & 1) << 7;
+    }
+}
+
+// Scalars on the fixed-base table against the ladder
+static int check_base(void)
+{
+    x25519_case_t cases[BATCH_MAX];
+    fill_cases(cases, BATCH_MAX);
+
+    for (size_t i = 0; i < BATCH_MAX; i++) {
+        uint8_t public[X25519_LEN], expected[X25519_LEN];
+        x25519_base(public, cases[i].secret);
+        x25519(expected, cases[i].secret, basepoint_nine);
+        if (memcmp(public, expected, X25519_LEN)) {
+            fprintf(stderr, "x25519_base() secret %zu does not match x25519()\n", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whole groups of lanes plus every possible number of leftovers
+static int check_batch(void)
+{
+    x25519_case_t cases[BATCH_MAX];
+    fill_cases(cases, BATCH_MAX);
+
+    uint8_t public_bufs[BATCH_MAX][X25519_LEN];
+    uint8_t *public[BATCH_MAX];
+    const uint8_t *secret[BATCH_MAX], *basepoint[BATCH_MAX];
+    for (size_t i = 0; i < BATCH_MAX; i++) {
+        public[i] = public_bufs[i];
+        secret[i] = cases[i].secret;
+        basepoint[i] = cases[i].basepoint;
+    }
+
+    for (size_t count = 1; count <= BATCH_MAX; count++) {
+        memset(public_bufs, 0, sizeof(public_bufs));
+        x25519_batch(public, secret, basepoint, count);
+        for (size_t i = 0; i < count; i++) {
+            uint8_t expected[X25519_LEN];
+            x25519(expected, secret[i], basepoint[i]);
+            if (memcmp(public[i], expected, X25519_LEN)) {
+                fprintf(stderr, "x25519_batch() computation %zu of %zu does not match x25519()\n", i, count);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Drive a multi-lane ladder directly, with the known answers spread across its lanes
+static int check_backend(const x25519_backend_t *backend)
+{
+    if (!backend) {
+        return 0;
+    }
+
+    const size_t count = sizeof(vectors) / sizeof(*vectors);
+    x25519_case_t cases[X25519_LANES_MAX];
+    uint8_t public_bufs[X25519_LANES_MAX][X25519_LEN];
+    uint8_t *public[X25519_LANES_MAX];
+    const uint8_t *secret[X25519_LANES_MAX], *basepoint[X25519_LANES_MAX];
+    for (size_t offset = 0; offset < count; offset++) {
+        for (size_t j = 0; j < backend->lanes; j++) {
+            const x25519_vector_t *vector = &vectors[(offset + j) % count];
+            vector_case(&cases[j], vector);
+            public[j] = public_bufs[j];
+            secret[j] = cases[j].secret;
+            basepoint[j] = cases[j].basepoint;
+        }
+
+        backend->ladder(public, secret, basepoint);
+
+        int failed = 0;
+        for (size_t j = 0; j < backend->lanes; j++) {
+            const x25519_vector_t *vector = &vectors[(offset + j) % count];
+            failed |= kat_check(vector->name, public[j], vector->public, X25519_LEN);
+        }
+        if (failed) {
+            fprintf(stderr, "X25519 %s ladder failed with the vectors rotated by %zu lanes\n", backend->name, offset);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    const x25519_backend_t *avx2 = x25519_avx2_backend();
+    if (avx2) {
+        printf("X25519 ladder: %s, %zu lanes\n", avx2->name, avx2->lanes);
+    }
+
+    int failed = check_vectors();
+    failed |= check_iterated();
+    failed |= check_base();
+    failed |= check_batch();
+    failed |= check_backend(avx2);
+    return failed;
+}